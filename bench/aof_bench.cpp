@@ -0,0 +1,90 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "aof.h"
+#include "flat_dict.h"
+#include "lru_cache.h"
+#include "storage.h"
+
+using Clock = std::chrono::steady_clock;
+using Storage = KVstorage<std::string, std::string>;
+
+// Put throughput of `threads` writers for `seconds`, with the given log attached (or none).
+static void run(const char* name, AppendLog* log, std::size_t threads, double seconds, std::size_t valueSize) {
+    std::vector<Cache<std::string, std::string>*> caches;
+    for (int i = 0; i < 64; ++i) caches.push_back(new LRUCache<std::string, std::string, FlatHashMap>(100000, 3600));
+    Storage storage(caches, 6400000);
+    if (log) storage.addListener(log);
+
+    const std::string value(valueSize, 'v');
+    std::atomic<bool> running{true};
+    std::vector<std::size_t> ops(threads, 0);
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::size_t n = 0;
+            std::string key = "key:" + std::to_string(t) + ":";
+            const std::size_t prefix = key.size();
+            while (running.load(std::memory_order_relaxed)) {
+                key.resize(prefix);
+                key += std::to_string(n % 100000);
+                storage.put(key, value);
+                ++n;
+            }
+            ops[t] = n;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    running.store(false);
+    for (auto& w : workers) w.join();
+
+    std::size_t total = 0;
+    for (auto n : ops) total += n;
+    std::printf("%-12s %8zu %14.0f", name, threads, double(total) / seconds);
+    if (log) {
+        auto st = log->stats();
+        std::printf(" %10llu %10llu %12.1f", static_cast<unsigned long long>(st.groups),
+                    static_cast<unsigned long long>(st.syncs),
+                    st.groups ? double(st.records) / double(st.groups) : 0.0);
+    }
+    std::printf("\n");
+}
+
+int main(int argc, char** argv) {
+    std::size_t maxThreads = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+    double seconds = argc > 2 ? std::atof(argv[2]) : 2.0;
+    std::size_t valueSize = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 64;
+    std::string path = argc > 4 ? argv[4] : "timkv-bench.aof";
+    if (maxThreads == 0) maxThreads = 1;
+
+    std::printf("%-12s %8s %14s %10s %10s %12s\n", "fsync", "threads", "puts/s", "groups", "syncs", "recs/group");
+    for (std::size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        run("off", nullptr, threads, seconds, valueSize);
+        const std::pair<const char*, AppendLog::Fsync> policies[] = {
+            {"never", AppendLog::Fsync::Never},
+            {"interval", AppendLog::Fsync::Interval},
+            {"always", AppendLog::Fsync::Always},
+        };
+        for (const auto& [name, fsync] : policies) {
+            std::remove(path.c_str());
+            AppendLog::Options options;
+            options.fsync = fsync;
+            auto log = std::make_unique<AppendLog>(path, options);
+            std::string error;
+            if (!log->open(error)) {
+                std::fprintf(stderr, "cant open %s: %s\n", path.c_str(), error.c_str());
+                return 1;
+            }
+            run(name, log.get(), threads, seconds, valueSize);
+        }
+        if (threads < maxThreads && threads * 2 > maxThreads) threads = maxThreads / 2;
+    }
+    std::remove(path.c_str());
+    return 0;
+}
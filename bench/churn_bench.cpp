@@ -0,0 +1,67 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "flat_dict.h"
+#include "lru_cache.h"
+#include "storage.h"
+
+using Clock = std::chrono::steady_clock;
+using Storage = KVstorage<std::string, std::string>;
+
+static std::size_t rssBytes() {
+    std::ifstream statm("/proc/self/statm");
+    std::size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// Overwrites random keys of a memory-bounded storage while the value size mix moves from small
+// to large and back, and reports RSS against the live data after every phase. With slab
+// compaction the pages left behind by one size mix are handed to the next.
+int main(int argc, char** argv) {
+    std::size_t maxMemory = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 256) << 20;
+    std::size_t opsPerPhase = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4000000;
+    bool compact = argc > 3 ? std::atoi(argv[3]) != 0 : true;
+    constexpr std::size_t partitions = 64;
+
+    std::vector<Cache<std::string, std::string>*> caches;
+    for (std::size_t i = 0; i < partitions; ++i)
+        caches.push_back(new LRUCache<std::string, std::string, FlatHashMap>(0, 3600, maxMemory / partitions));
+    Storage storage(caches, 0);
+
+    const std::pair<std::size_t, std::size_t> phases[] = {{16, 64}, {200, 400}, {1000, 4000}, {200, 400}, {16, 64}};
+    std::mt19937_64 rng(42);
+    const std::string filler(4096, 'v');
+    std::printf("max_memory %zu MiB, compaction %s\n", maxMemory >> 20, compact ? "on" : "off");
+    std::printf("%-12s %10s %10s %12s %12s %12s %8s\n", "values", "ns/put", "keys", "live MiB", "slab MiB", "rss MiB",
+                "rss/live");
+    for (const auto& [lo, hi] : phases) {
+        std::uniform_int_distribution<std::size_t> size(lo, hi);
+        std::uniform_int_distribution<std::size_t> key(0, 8 * maxMemory / (lo + hi));
+        auto start = Clock::now();
+        for (std::size_t i = 0; i < opsPerPhase; ++i) {
+            storage.put("key:" + std::to_string(key(rng)), filler.substr(0, size(rng)));
+            if (compact && i % 100000 == 0) {
+                for (auto* cache : caches) cache->compact(1024);
+            }
+        }
+        double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()) /
+                    double(opsPerPhase);
+        if (compact) {
+            for (auto* cache : caches) while (cache->compact(1 << 20)) {}
+        }
+        auto st = storage.stats();
+        char label[32];
+        std::snprintf(label, sizeof(label), "%zu-%zu B", lo, hi);
+        std::printf("%-12s %10.1f %10zu %12.1f %12.1f %12.1f %8.2f\n", label, ns, st.size, double(st.memory) / 1048576,
+                    double(st.slabBytes) / 1048576, double(rssBytes()) / 1048576,
+                    double(rssBytes()) / double(st.memory));
+    }
+    return 0;
+}
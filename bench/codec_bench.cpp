@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lru_cache.h"
+#include "storage.h"
+
+using Storage = KVstorage<std::string, std::string>;
+using Clock = std::chrono::steady_clock;
+
+// Readers decompressing a large value while a writer puts to the same, single partition. Decoding
+// runs outside the partition lock, so the writer's puts should not wait for a decompression: the
+// run fails if their p99 reaches the time of one decode, or if a reader sees a wrong value.
+int main(int argc, char** argv) {
+    const std::size_t valueBytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4 << 20;
+    const int readers = argc > 2 ? std::atoi(argv[2]) : 4;
+    const double seconds = argc > 3 ? std::atof(argv[3]) : 2;
+
+    Codec::Options options;
+#if defined(TIMKV_WITH_ZSTD)
+    options.algorithm = Encoding::Zstd;
+#elif defined(TIMKV_WITH_LZ4)
+    options.algorithm = Encoding::Lz4;
+#else
+    std::fprintf(stderr, "built without a codec (-DTIMKV_WITH_LZ4=ON or -DTIMKV_WITH_ZSTD=ON)\n");
+    return 1;
+#endif
+    Storage storage(std::vector<Cache<std::string, std::string>*>{new LRUCache<std::string, std::string>(1 << 16, 3600)},
+                    1 << 16);
+    storage.setCompression(options);
+
+    std::string value;
+    const char* words[] = {"alpha ", "beta ", "gamma ", "delta ", "epsilon "};
+    // Words in pseudo-random order: compressible, but still well above 16 KiB compressed, so the
+    // stored value is a shared buffer that readers retain rather than copy.
+    for (uint32_t x = 1; value.size() < valueBytes;) {
+        x = x * 1664525 + 1013904223;
+        value += words[(x >> 16) % 5];
+    }
+    value.resize(valueBytes);
+    storage.put("big", value);
+    std::size_t stored = 0;
+    storage.get("big", [&](const ValueView& v) { stored = v.bytes.size(); }, false);
+
+    auto start = Clock::now();
+    const int decodes = 20;
+    for (int i = 0; i < decodes; ++i) storage.get("big");
+    const double decodeUs =
+        std::chrono::duration<double, std::micro>(Clock::now() - start).count() / decodes;
+
+    std::atomic<bool> stop{false};
+    std::atomic<bool> wrong{false};
+    std::atomic<std::size_t> reads{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < readers; ++t) {
+        threads.emplace_back([&] {
+            while (!stop.load(std::memory_order_relaxed)) {
+                auto got = storage.get("big");
+                if (!got || *got != value) wrong = true;
+                reads.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    std::vector<double> putUs;
+    const std::string small(32, 'v');
+    start = Clock::now();
+    // Paced, so most puts land while some reader is decoding.
+    for (std::size_t i = 0; Clock::now() - start < std::chrono::duration<double>(seconds); ++i) {
+        std::this_thread::sleep_until(start + i * std::chrono::microseconds(200));
+        const auto t0 = Clock::now();
+        storage.put("k" + std::to_string(i % 1024), small);
+        putUs.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+    }
+    stop = true;
+    for (auto& t : threads) t.join();
+
+    std::sort(putUs.begin(), putUs.end());
+    const double p50 = putUs[putUs.size() / 2];
+    const double p99 = putUs[putUs.size() * 99 / 100];
+    std::printf("value %zu bytes (%zu stored), one decode %.0f us, %d readers: %zu reads\n", valueBytes, stored,
+                decodeUs, readers, reads.load());
+    std::printf("puts to the same partition: %zu, p50 %.1f us, p99 %.1f us, max %.0f us\n", putUs.size(), p50, p99,
+                putUs.back());
+    if (wrong) {
+        std::fprintf(stderr, "a reader got a wrong value\n");
+        return 1;
+    }
+    if (p99 >= decodeUs) {
+        std::fprintf(stderr, "puts wait for decompression: p99 %.1f us >= one decode %.0f us\n", p99, decodeUs);
+        return 1;
+    }
+    return 0;
+}
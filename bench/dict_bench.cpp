@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "dict.h"
+#include "flat_dict.h"
+
+using Clock = std::chrono::steady_clock;
+
+static std::vector<std::string> makeKeys(std::size_t n, std::size_t salt) {
+    std::vector<std::string> keys;
+    keys.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) keys.push_back("key:" + std::to_string(salt) + ":" + std::to_string(i));
+    return keys;
+}
+
+static double nsPerOp(Clock::time_point start, std::size_t ops) {
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()) / double(ops);
+}
+
+template <template <class...> class Map>
+static void run(const char* name, const std::vector<std::string>& keys, const std::vector<std::string>& missing) {
+    const std::size_t n = keys.size();
+    std::vector<std::size_t> order(n);
+    for (std::size_t i = 0; i < n; ++i) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+
+    auto* map = new Map<std::string, std::size_t>();
+
+    // Per-op timing of the inserts shows the worst single-op stall while the table grows.
+    long long worstNs = 0;
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < n; ++i) {
+        auto opStart = Clock::now();
+        map->insert_or_assign(keys[i], i);
+        worstNs = std::max<long long>(worstNs, std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - opStart).count());
+    }
+    double insertNs = nsPerOp(start, n);
+
+    std::size_t found = 0;
+    start = Clock::now();
+    for (std::size_t i : order) found += map->contains(keys[i]);
+    double hitNs = nsPerOp(start, n);
+
+    start = Clock::now();
+    for (const auto& k : missing) found += map->contains(k);
+    double missNs = nsPerOp(start, missing.size());
+
+    start = Clock::now();
+    for (std::size_t i : order) found -= map->erase(keys[i]);
+    double eraseNs = nsPerOp(start, n);
+
+    std::printf("%-8s %10zu %10.1f %10.1f %10.1f %10.1f %14lld %s\n", name, n, insertNs, hitNs, missNs, eraseNs,
+                worstNs, found == 0 && map->size() == 0 ? "" : "MISMATCH");
+    delete map;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::size_t> sizes;
+    for (int i = 1; i < argc; ++i) sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+    if (sizes.empty()) sizes = {1000000, 10000000};
+
+    std::printf("%-8s %10s %10s %10s %10s %10s %14s\n", "map", "keys", "insert", "hit", "miss", "erase",
+                "worst_ins_ns");
+    for (std::size_t n : sizes) {
+        auto keys = makeKeys(n, 1);
+        auto missing = makeKeys(n, 2);
+        run<HashMap>("chained", keys, missing);
+        run<FlatHashMap>("flat", keys, missing);
+    }
+    return 0;
+}
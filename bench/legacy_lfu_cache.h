@@ -0,0 +1,252 @@
+#pragma once
+// The std::list + std::unordered_set LFUCache that src/lfu_cache.h replaced, kept as a baseline for
+// timkv-lfu-bench.
+#include <chrono>
+#include <list>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "cache.h"
+#include "dict.h"
+
+// Bytes a value owns outside its own object, used for memory-budget accounting.
+template<typename T>
+size_t heapBytes(const T &) {
+    return 0;
+}
+
+inline size_t heapBytes(const std::string &s) {
+    const char *obj = reinterpret_cast<const char *>(&s);
+    if (s.data() >= obj && s.data() < obj + sizeof(s)) return 0;  // small-string buffer
+    return s.capacity() + 1;
+}
+
+template <typename Key, typename Value, template <class...> class Map = HashMap>
+class LegacyLFUCache : public Cache<Key, Value> {
+   public:
+    // capacity bounds the entry count and maxMemory the accounted bytes; 0 disables either.
+    explicit LegacyLFUCache(size_t capacity, int ttl_seconds, size_t maxMemory = 0)
+        : capacity(capacity), maxMemory(maxMemory), count(0), ttl(ttl_seconds) {
+        byKey.reserve(capacity);
+    }
+
+    using Cache<Key, Value>::put;
+    using Cache<Key, Value>::get;
+
+    // The baseline keeps owned keys and values, so the views are copied up front. It predates
+    // compression and keeps no encoding: only raw values are put here.
+    void put(std::string_view keyView, std::string_view valueView, std::chrono::milliseconds lifetime,
+             Encoding) override {
+        const Key key(keyView);
+        const Value value(valueView);
+        auto t = now();
+        auto exp = t + (lifetime.count() > 0 ? lifetime : std::chrono::milliseconds(std::chrono::seconds(ttl)));
+        if (auto it = byKey.get(key)) {
+            auto* item = *it;
+            memory -= heapBytes(item->value);
+            item->value = value;
+            item->expiration = exp;
+            memory += heapBytes(item->value);
+            increment(item);
+            while (maxMemory != 0 && memory > maxMemory && count > 1) evictVictim(item);
+        } else {
+            const size_t bytes = entryBytes(key, value);
+            while (count != 0 && ((capacity != 0 && count >= capacity) ||
+                                  (maxMemory != 0 && memory + bytes > maxMemory))) {
+                evict();
+            }
+            auto* item = new CacheItem{key, value, freqs.end(), exp};
+            byKey.insert_or_assign(key, item);
+            ++count;
+            memory += bytes;
+            increment(item);
+        }
+    }
+
+    bool get(std::string_view key, const ValueVisitor& fn) override {
+        auto it = byKey.get(Key(key));
+        if (!it) return false;
+        auto* item = *it;
+        if (expired(item)) {
+            remove(key);
+            ++expirations;
+            return false;
+        }
+        increment(item);
+        fn(ValueView{item->value, nullptr});
+        return true;
+    }
+
+    size_t remove(std::string_view keyView) override {
+        const Key key(keyView);
+        auto it = byKey.get(key);
+        if (!it) return 0;
+        auto* item = *it;
+        auto freqIt = item->freqIter;
+        removeEntry(freqIt, item);
+        byKey.erase(key);
+        memory -= entryBytes(item->key, item->value);
+        delete item;
+        --count;
+        return 1;
+    }
+
+    void evict() override {
+        evictVictim(nullptr);
+    }
+
+    size_t expire(size_t limit) override {
+        size_t removed = 0;
+        size_t seen = 0;
+        auto freqIt = freqs.begin();
+        while (freqIt != freqs.end() && seen < limit) {
+            auto nextFreq = std::next(freqIt);
+            std::vector<CacheItem*> dead;
+            for (auto* item : freqIt->entries) {
+                if (seen++ == limit) break;
+                if (expired(item)) dead.push_back(item);
+            }
+            for (auto* item : dead) {
+                byKey.erase(item->key);
+                removeEntry(freqIt, item);
+                memory -= entryBytes(item->key, item->value);
+                delete item;
+                --count;
+                ++removed;
+            }
+            freqIt = nextFreq;
+        }
+        expirations += removed;
+        return removed;
+    }
+
+    size_t size() override {
+        return count;
+    }
+
+    CacheStats stats() override {
+        CacheStats st;
+        st.size = count;
+        st.capacity = capacity;
+        st.evictions = evictions;
+        st.expirations = expirations;
+        st.memory = memory;
+        st.maxMemory = maxMemory;
+        return st;
+    }
+
+    // Snapshots are not benchmarked against the baseline.
+    void dump(const std::function<void(std::string_view, std::string_view, const EntryMeta&)>&) override {
+    }
+
+    void restore(std::string_view key, std::string_view value, const EntryMeta&) override {
+        put(key, value);
+    }
+
+    void reserve(size_t n) override {
+        byKey.reserve(n);
+    }
+
+    ~LegacyLFUCache() override {
+        for (auto& f : freqs) {
+            for (auto* p : f.entries) delete p;
+        }
+    }
+
+   private:
+    struct CacheItem;
+
+    struct FrequencyItem {
+        int freq;
+        std::unordered_set<CacheItem*> entries;
+    };
+
+    struct CacheItem {
+        Key key;
+        Value value;
+        typename std::list<FrequencyItem>::iterator freqIter;
+        std::chrono::steady_clock::time_point expiration;
+    };
+
+    Map<Key, CacheItem*> byKey;
+    std::list<FrequencyItem> freqs;
+    size_t capacity;
+    size_t maxMemory;
+    size_t memory = 0;
+    size_t count;
+    int ttl;
+    size_t evictions = 0;
+    size_t expirations = 0;
+
+    static std::chrono::steady_clock::time_point now() {
+        return std::chrono::steady_clock::now();
+    }
+
+    // Item, its frequency-set node and bucket slot, and the index entry (hash, key, pointer, chain
+    // link, bucket slot), plus whatever the key (stored twice) and the value keep on the heap.
+    static size_t entryBytes(const Key& key, const Value& value) {
+        constexpr size_t fixed = sizeof(CacheItem) + 4 * sizeof(void*) +
+                                 sizeof(size_t) + sizeof(Key) + 3 * sizeof(void*);
+        return fixed + 2 * heapBytes(key) + heapBytes(value);
+    }
+
+    // Drops the first entry of the least frequent bucket, skipping `keep`.
+    void evictVictim(const CacheItem* keep) {
+        for (auto freqIt = freqs.begin(); freqIt != freqs.end(); ++freqIt) {
+            for (auto* ci : freqIt->entries) {
+                if (ci == keep) continue;
+                byKey.erase(ci->key);
+                memory -= entryBytes(ci->key, ci->value);
+                removeEntry(freqIt, ci);
+                delete ci;
+                --count;
+                ++evictions;
+                return;
+            }
+        }
+    }
+
+    bool expired(CacheItem* item) const {
+        return now() > item->expiration;
+    }
+
+    void increment(CacheItem* item) {
+        auto curIt = item->freqIter;
+        int nextFreq = 1;
+        typename std::list<FrequencyItem>::iterator nextIt;
+
+        if (curIt == freqs.end()) {
+            nextIt = freqs.begin();
+        } else {
+            nextFreq = curIt->freq + 1;
+            nextIt = std::next(curIt);
+        }
+
+        if (nextIt == freqs.end() || nextIt->freq != nextFreq) {
+            FrequencyItem node{nextFreq, {}};
+            if (curIt == freqs.end()) {
+                freqs.push_front(std::move(node));
+                nextIt = freqs.begin();
+            } else {
+                nextIt = freqs.insert(nextIt, std::move(node));
+            }
+        }
+
+        nextIt->entries.insert(item);
+        item->freqIter = nextIt;
+
+        if (curIt != freqs.end()) {
+            removeEntry(curIt, item);
+        }
+    }
+
+    void removeEntry(typename std::list<FrequencyItem>::iterator freqIt, CacheItem* item) {
+        auto& entries = freqIt->entries;
+        entries.erase(item);
+        if (entries.empty()) {
+            freqs.erase(freqIt);
+        }
+    }
+};
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "clock_cache.h"
+#include "legacy_lfu_cache.h"
+#include "lfu_cache.h"
+#include "lru_cache.h"
+#include "zipf.h"
+
+using StringCache = Cache<std::string, std::string>;
+
+// Replays a read-through trace: every miss is followed by a put of the missing key.
+static void replay(const char* name, std::unique_ptr<StringCache> cache, const std::vector<std::string>& keys,
+                   const std::vector<std::size_t>& trace) {
+    const std::string value(64, 'v');
+    std::size_t hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t k : trace) {
+        if (cache->get(keys[k]))
+            ++hits;
+        else
+            cache->put(keys[k], value);
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%-16s %10.1f %9.2f%%\n", name, double(ns) / double(trace.size()), 100.0 * double(hits) / double(trace.size()));
+}
+
+int main(int argc, char** argv) {
+    std::size_t keyCount = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    std::size_t ops = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 5000000;
+    double skew = argc > 3 ? std::atof(argv[3]) : 0.99;
+    const int ttl = 3600;
+
+    std::vector<std::string> keys;
+    keys.reserve(keyCount);
+    for (std::size_t i = 0; i < keyCount; ++i) keys.push_back("key" + std::to_string(i));
+
+    ZipfGenerator zipf(keyCount, skew);
+    std::vector<std::size_t> trace(ops);
+    for (auto& k : trace) k = zipf();
+
+    for (std::size_t capacity : {keyCount / 100, keyCount / 10}) {
+        std::printf("\nzipf s=%.2f keys=%zu ops=%zu capacity=%zu\n", skew, keyCount, ops, capacity);
+        std::printf("%-16s %10s %10s\n", "cache", "ns/op", "hit ratio");
+        replay("lfu (legacy)", std::make_unique<LegacyLFUCache<std::string, std::string>>(capacity, ttl), keys, trace);
+        replay("lfu", std::make_unique<LFUCache<std::string, std::string>>(capacity, ttl), keys, trace);
+        replay("lfu + tinylfu", std::make_unique<LFUCache<std::string, std::string>>(capacity, ttl, 0, true), keys, trace);
+        replay("lru", std::make_unique<LRUCache<std::string, std::string>>(capacity, ttl), keys, trace);
+        replay("clock", std::make_unique<ClockCache<std::string, std::string>>(capacity, ttl), keys, trace);
+    }
+    return 0;
+}
@@ -0,0 +1,573 @@
+// timkv-bench: load generator for a running timkv. Worker threads drive many connections each from
+// an epoll loop, with up to --pipeline requests in flight per connection, and record every
+// request's latency in HDR-style histograms.
+//
+//   timkv-bench --protocol=resp --port=6379 --connections=64 --pipeline=16 --keys=1000000
+//               --dist=zipf --value-size=100 --reads=90 --seconds=10 --preload
+//
+// With --rate the load is open-loop: requests are due at fixed intervals and their latency counts
+// from when they were due, so a stalled server shows up in the tail instead of slowing the client
+// down (coordinated omission). Without it every connection sends as fast as replies come back.
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "histogram.h"
+#include "zipf.h"
+
+namespace {
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    std::string protocol = "resp";  // resp, http or raw (HTTP, gets through GET /raw/<key>)
+    int threads = 0;                 // 0: min(cores, connections)
+    int connections = 32;
+    int pipeline = 1;
+    size_t keys = 100000;
+    std::string dist = "uniform";    // uniform or zipf
+    double zipf = 0.99;
+    size_t valueSize = 100;
+    int reads = 90;                  // percent of requests that are gets
+    double seconds = 10;
+    double rate = 0;                 // total requests per second, 0 = closed loop
+    bool preload = false;            // put every key once before measuring
+};
+
+bool parseOptions(int argc, char **argv, Options &o) {
+    std::map<std::string, std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            std::fprintf(stderr, "unexpected argument %s\n", arg.c_str());
+            return false;
+        }
+        auto eq = arg.find('=');
+        if (eq != std::string::npos) args[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+        else args[arg.substr(2)] = "1";
+    }
+    for (const auto &[name, value] : args) {
+        if (name == "host") o.host = value;
+        else if (name == "port") o.port = std::atoi(value.c_str());
+        else if (name == "protocol") o.protocol = value;
+        else if (name == "threads") o.threads = std::atoi(value.c_str());
+        else if (name == "connections") o.connections = std::atoi(value.c_str());
+        else if (name == "pipeline") o.pipeline = std::atoi(value.c_str());
+        else if (name == "keys") o.keys = std::strtoull(value.c_str(), nullptr, 10);
+        else if (name == "dist") o.dist = value;
+        else if (name == "zipf") o.zipf = std::atof(value.c_str());
+        else if (name == "value-size") o.valueSize = std::strtoull(value.c_str(), nullptr, 10);
+        else if (name == "reads") o.reads = std::atoi(value.c_str());
+        else if (name == "seconds") o.seconds = std::atof(value.c_str());
+        else if (name == "rate") o.rate = std::atof(value.c_str());
+        else if (name == "preload") o.preload = value != "0";
+        else {
+            std::fprintf(stderr, "unknown option --%s\n", name.c_str());
+            return false;
+        }
+    }
+    if (o.protocol != "resp" && o.protocol != "http" && o.protocol != "raw") {
+        std::fprintf(stderr, "--protocol must be resp, http or raw\n");
+        return false;
+    }
+    if (o.dist != "uniform" && o.dist != "zipf") {
+        std::fprintf(stderr, "--dist must be uniform or zipf\n");
+        return false;
+    }
+    if (o.connections < 1 || o.pipeline < 1 || o.keys == 0 || o.reads < 0 || o.reads > 100 || o.seconds <= 0) {
+        std::fprintf(stderr, "invalid option value\n");
+        return false;
+    }
+    if (o.threads <= 0) o.threads = std::max(1, std::min<int>(int(std::thread::hardware_concurrency()), o.connections));
+    o.threads = std::min(o.threads, o.connections);
+    return true;
+}
+
+uint64_t nowNs() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+int connectTo(const std::string &host, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *res = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (addrinfo *a = res; a; a = a->ai_next) {
+        fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0) break;
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// Request encoding and reply framing for one protocol.
+class Protocol {
+public:
+    enum class Reply { Incomplete, Hit, Miss, Error };
+
+    Protocol(const Options &o) : kind(o.protocol), host(o.host + ":" + std::to_string(o.port)), value(o.valueSize, 'v') {
+    }
+
+    void get(std::string &out, std::string_view key) const {
+        if (kind == "resp") {
+            bulkArray(out, {"GET", key});
+        } else if (kind == "raw") {
+            out += "GET /raw/";
+            out += key;
+            out += " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+        } else {
+            post(out, "/get", std::string("{\"key\":\"").append(key) + "\"}");
+        }
+    }
+
+    void put(std::string &out, std::string_view key) const {
+        if (kind == "resp") bulkArray(out, {"SET", key, value});
+        else post(out, "/put", std::string("{\"key\":\"").append(key) + "\",\"value\":\"" + value + "\"}");
+    }
+
+    // Frames one reply starting at in[0]; consumed is set for anything but Incomplete.
+    Reply parse(std::string_view in, size_t &consumed) const {
+        return kind == "resp" ? parseResp(in, consumed) : parseHttp(in, consumed);
+    }
+
+private:
+    std::string kind;
+    std::string host;
+    std::string value;
+
+    static void bulkArray(std::string &out, std::initializer_list<std::string_view> args) {
+        out += '*' + std::to_string(args.size()) + "\r\n";
+        for (auto a : args) {
+            out += '$' + std::to_string(a.size()) + "\r\n";
+            out += a;
+            out += "\r\n";
+        }
+    }
+
+    void post(std::string &out, const char *path, const std::string &body) const {
+        out += "POST ";
+        out += path;
+        out += " HTTP/1.1\r\nHost: " + host + "\r\nContent-Type: application/json\r\nContent-Length: " +
+               std::to_string(body.size()) + "\r\n\r\n";
+        out += body;
+    }
+
+    static Reply parseResp(std::string_view in, size_t &consumed) {
+        auto eol = in.find("\r\n");
+        if (eol == std::string_view::npos) return Reply::Incomplete;
+        if (in[0] == '+' || in[0] == ':') {
+            consumed = eol + 2;
+            return Reply::Hit;
+        }
+        if (in[0] == '-') {
+            consumed = eol + 2;
+            return Reply::Error;
+        }
+        if (in[0] != '$') return Reply::Error;
+        const long long len = std::atoll(std::string(in.substr(1, eol - 1)).c_str());
+        if (len < 0) {
+            consumed = eol + 2;
+            return Reply::Miss;
+        }
+        if (in.size() < eol + 2 + size_t(len) + 2) return Reply::Incomplete;
+        consumed = eol + 2 + size_t(len) + 2;
+        return Reply::Hit;
+    }
+
+    // Needs Content-Length framing, which both frontends send.
+    Reply parseHttp(std::string_view in, size_t &consumed) const {
+        auto end = in.find("\r\n\r\n");
+        if (end == std::string_view::npos) return Reply::Incomplete;
+        std::string head(in.substr(0, end));
+        std::transform(head.begin(), head.end(), head.begin(), [](unsigned char c) { return std::tolower(c); });
+        auto sp = head.find(' ');
+        if (head.rfind("http/1.", 0) != 0 || sp == std::string::npos) return Reply::Error;
+        const int status = std::atoi(head.c_str() + sp + 1);
+        auto cl = head.find("\r\ncontent-length:");
+        if (cl == std::string::npos) return Reply::Error;
+        const size_t length = std::strtoull(head.c_str() + cl + 17, nullptr, 10);
+        if (in.size() < end + 4 + length) return Reply::Incomplete;
+        consumed = end + 4 + length;
+        if (status == 404) return Reply::Miss;
+        if (status != 200) return Reply::Error;
+        if (kind == "http" && in.substr(end + 4, length).find("\"not found\"") != std::string_view::npos)
+            return Reply::Miss;
+        return Reply::Hit;
+    }
+};
+
+struct Stats {
+    LatencyHistogram gets;
+    LatencyHistogram puts;
+    uint64_t misses = 0;
+    uint64_t errors = 0;
+
+    void merge(const Stats &other) {
+        gets.merge(other.gets);
+        puts.merge(other.puts);
+        misses += other.misses;
+        errors += other.errors;
+    }
+
+    void reset() {
+        gets.reset();
+        puts.reset();
+        misses = errors = 0;
+    }
+};
+
+struct Connection {
+    struct Pending {
+        uint64_t start;
+        bool get;
+    };
+
+    int fd = -1;
+    std::string out;
+    size_t written = 0;
+    std::string in;
+    size_t parsed = 0;
+    std::deque<Pending> pending;
+    uint64_t due = 0;  // open loop: when the next request is due
+    bool polledOut = false;
+};
+
+// Drives its connections until stop is set or, when preloading, until its slice of the key space
+// has been written. Latencies are published into `interval` once per loop, under `mutex`.
+class Worker {
+public:
+    Worker(const Options &o, const Protocol &protocol, const ZipfGenerator *zipf, int index)
+        : o(o), protocol(protocol), zipf(zipf), rng(0x9e3779b97f4a7c15ULL * uint64_t(index + 1)) {
+    }
+
+    bool open(int connections) {
+        epfd = epoll_create1(0);
+        for (int i = 0; i < connections; ++i) {
+            auto c = std::make_unique<Connection>();
+            c->fd = connectTo(o.host, o.port);
+            if (c->fd < 0) {
+                std::fprintf(stderr, "cannot connect to %s:%d: %s\n", o.host.c_str(), o.port, std::strerror(errno));
+                return false;
+            }
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = c.get();
+            epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+            conns.push_back(std::move(c));
+        }
+        return true;
+    }
+
+    // Open loop: each connection sends every `perConnection` ns, staggered.
+    void pace(double perConnection) {
+        interval = uint64_t(perConnection);
+        const uint64_t t = nowNs();
+        for (size_t i = 0; i < conns.size(); ++i) conns[i]->due = t + interval * i / conns.size();
+    }
+
+    // Preload: put keys [from, to) once each.
+    void preloadRange(size_t from, size_t to) {
+        nextKey = from;
+        lastKey = to;
+        preloading = true;
+    }
+
+    void run(const std::atomic<bool> &stop) {
+        std::vector<epoll_event> events(conns.size());
+        while (!stop.load(std::memory_order_relaxed)) {
+            const uint64_t t = nowNs();
+            uint64_t wake = UINT64_MAX;
+            bool idle = true;
+            for (auto &c : conns) {
+                fill(*c, t);
+                if (!c->pending.empty()) idle = false;
+                if (interval) wake = std::min(wake, c->due);
+                flush(*c);
+            }
+            if (preloading && idle && nextKey >= lastKey) {
+                preloading = false;
+                break;
+            }
+            int timeout = 100;
+            if (interval) timeout = wake <= t ? 0 : int(std::min<uint64_t>((wake - t) / 1000000, 100));
+            const int n = epoll_wait(epfd, events.data(), int(events.size()), timeout);
+            for (int i = 0; i < n; ++i) {
+                auto *c = static_cast<Connection *>(events[i].data.ptr);
+                if (events[i].events & EPOLLOUT) flush(*c);
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) receive(*c);
+            }
+            publish();
+        }
+        publish();
+    }
+
+    void close() {
+        for (auto &c : conns) ::close(c->fd);
+        if (epfd >= 0) ::close(epfd);
+    }
+
+    // Moves what was recorded since the last call into `into`.
+    void collect(Stats &into) {
+        std::lock_guard lock(mutex);
+        into.merge(interval_);
+        interval_.reset();
+    }
+
+private:
+    const Options &o;
+    const Protocol &protocol;
+    const ZipfGenerator *zipf;
+    std::mt19937_64 rng;
+    int epfd = -1;
+    std::vector<std::unique_ptr<Connection>> conns;
+    uint64_t interval = 0;
+    bool preloading = false;
+    size_t nextKey = 0;
+    size_t lastKey = 0;
+    std::string key;
+
+    Stats local;
+    std::mutex mutex;
+    Stats interval_;
+
+    void fill(Connection &c, uint64_t t) {
+        while (c.pending.size() < size_t(o.pipeline)) {
+            uint64_t start = t;
+            if (preloading) {
+                if (nextKey >= lastKey) return;
+                key = "key" + std::to_string(nextKey++);
+                protocol.put(c.out, key);
+                c.pending.push_back({start, false});
+                continue;
+            }
+            if (interval) {
+                if (c.due > t) return;
+                start = c.due;
+                c.due += interval;
+            }
+            const size_t k = zipf ? zipf->sample(rng) : size_t(rng() % o.keys);
+            key = "key" + std::to_string(k);
+            const bool get = int(rng() % 100) < o.reads;
+            if (get) protocol.get(c.out, key); else protocol.put(c.out, key);
+            c.pending.push_back({start, get});
+        }
+    }
+
+    void flush(Connection &c) {
+        while (c.written < c.out.size()) {
+            ssize_t n = ::send(c.fd, c.out.data() + c.written, c.out.size() - c.written, MSG_NOSIGNAL);
+            if (n > 0) {
+                c.written += size_t(n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            fail(c);
+            return;
+        }
+        if (c.written == c.out.size()) {
+            c.out.clear();
+            c.written = 0;
+        }
+        const bool wantOut = !c.out.empty();
+        if (wantOut != c.polledOut) {
+            epoll_event ev{};
+            ev.events = EPOLLIN | (wantOut ? uint32_t(EPOLLOUT) : 0u);
+            ev.data.ptr = &c;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+            c.polledOut = wantOut;
+        }
+    }
+
+    void receive(Connection &c) {
+        char buf[64 * 1024];
+        for (;;) {
+            ssize_t n = ::recv(c.fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+                c.in.append(buf, size_t(n));
+                if (size_t(n) < sizeof(buf)) break;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            fail(c);
+            return;
+        }
+        const uint64_t t = nowNs();
+        while (!c.pending.empty()) {
+            size_t consumed = 0;
+            auto reply = protocol.parse(std::string_view(c.in).substr(c.parsed), consumed);
+            if (reply == Protocol::Reply::Incomplete) break;
+            if (reply == Protocol::Reply::Error && consumed == 0) {
+                fail(c);
+                return;
+            }
+            c.parsed += consumed;
+            const auto p = c.pending.front();
+            c.pending.pop_front();
+            (p.get ? local.gets : local.puts).record(t - p.start);
+            if (reply == Protocol::Reply::Miss) ++local.misses;
+            if (reply == Protocol::Reply::Error) ++local.errors;
+        }
+        if (c.parsed == c.in.size()) {
+            c.in.clear();
+            c.parsed = 0;
+        } else if (c.parsed > 1 << 20) {
+            c.in.erase(0, c.parsed);
+            c.parsed = 0;
+        }
+    }
+
+    // The server closed the connection or sent garbage: its requests count as errors and it is
+    // opened again.
+    void fail(Connection &c) {
+        local.errors += c.pending.size();
+        c.pending.clear();
+        c.out.clear();
+        c.in.clear();
+        c.written = c.parsed = 0;
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+        ::close(c.fd);
+        c.fd = connectTo(o.host, o.port);
+        if (c.fd < 0) {
+            std::fprintf(stderr, "lost connection to %s:%d\n", o.host.c_str(), o.port);
+            std::exit(1);
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = &c;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+        c.polledOut = false;
+    }
+
+    void publish() {
+        std::lock_guard lock(mutex);
+        interval_.merge(local);
+        local.reset();
+    }
+};
+
+double us(uint64_t ns) {
+    return double(ns) / 1000.0;
+}
+
+void printLatency(const char *name, const LatencyHistogram &h, double seconds) {
+    if (h.count() == 0) return;
+    std::printf("%-4s %12llu ops %12.0f ops/s   p50 %9.1f  p90 %9.1f  p99 %9.1f  p999 %9.1f  max %9.1f us\n", name,
+                static_cast<unsigned long long>(h.count()), double(h.count()) / seconds, us(h.percentile(50)),
+                us(h.percentile(90)), us(h.percentile(99)), us(h.percentile(99.9)), us(h.max()));
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    Options o;
+    if (!parseOptions(argc, argv, o)) {
+        std::fprintf(stderr,
+                     "usage: timkv-bench [--host=127.0.0.1] [--port=6379] [--protocol=resp|http|raw] [--threads=N]\n"
+                     "                   [--connections=32] [--pipeline=1] [--keys=100000] [--dist=uniform|zipf]\n"
+                     "                   [--zipf=0.99] [--value-size=100] [--reads=90] [--seconds=10] [--rate=0]\n"
+                     "                   [--preload]\n");
+        return 2;
+    }
+
+    Protocol protocol(o);
+    std::unique_ptr<ZipfGenerator> zipf;
+    if (o.dist == "zipf") zipf = std::make_unique<ZipfGenerator>(o.keys, o.zipf);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int t = 0; t < o.threads; ++t) {
+        auto w = std::make_unique<Worker>(o, protocol, zipf.get(), t);
+        if (!w->open(o.connections / o.threads + (t < o.connections % o.threads ? 1 : 0))) return 1;
+        workers.push_back(std::move(w));
+    }
+
+    std::atomic<bool> stop{false};
+    if (o.preload) {
+        const uint64_t start = nowNs();
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < workers.size(); ++t) {
+            workers[t]->preloadRange(o.keys * t / workers.size(), o.keys * (t + 1) / workers.size());
+            threads.emplace_back([&, t] { workers[t]->run(stop); });
+        }
+        for (auto &th : threads) th.join();
+        Stats loaded;
+        for (auto &w : workers) w->collect(loaded);
+        std::printf("preloaded %zu keys in %.2f s, %llu errors\n", o.keys, double(nowNs() - start) / 1e9,
+                    static_cast<unsigned long long>(loaded.errors));
+    }
+
+    std::printf("%s %s:%d  threads %d  connections %d  pipeline %d  keys %zu %s", o.protocol.c_str(), o.host.c_str(),
+                o.port, o.threads, o.connections, o.pipeline, o.keys, o.dist.c_str());
+    if (zipf) std::printf(" %.2f", o.zipf);
+    std::printf("  value %zu B  reads %d%%", o.valueSize, o.reads);
+    if (o.rate > 0) std::printf("  rate %.0f/s", o.rate);
+    std::printf("\n%6s %12s %10s %10s %10s %10s %8s\n", "sec", "ops/s", "p50 us", "p99 us", "p999 us", "max us", "errors");
+
+    if (o.rate > 0)
+        for (auto &w : workers) w->pace(1e9 * double(o.connections) / o.rate);
+    std::vector<std::thread> threads;
+    for (auto &w : workers) threads.emplace_back([&stop, w = w.get()] { w->run(stop); });
+
+    Stats total;
+    const uint64_t start = nowNs();
+    uint64_t last = start;
+    for (int sec = 1; double(sec) <= o.seconds + 1e-9; ++sec) {
+        const uint64_t target = start + uint64_t(sec) * 1000000000ULL;
+        std::this_thread::sleep_for(std::chrono::nanoseconds(target - std::min(target, nowNs())));
+        Stats interval;
+        for (auto &w : workers) w->collect(interval);
+        LatencyHistogram all = interval.gets;
+        all.merge(interval.puts);
+        const uint64_t t = nowNs();
+        std::printf("%6d %12.0f %10.1f %10.1f %10.1f %10.1f %8llu\n", sec, double(all.count()) * 1e9 / double(t - last),
+                    us(all.percentile(50)), us(all.percentile(99)), us(all.percentile(99.9)), us(all.max()),
+                    static_cast<unsigned long long>(interval.errors));
+        std::fflush(stdout);
+        total.merge(interval);
+        last = t;
+    }
+    stop.store(true);
+    for (auto &th : threads) th.join();
+    const double elapsed = double(last - start) / 1e9;
+    for (auto &w : workers) w->close();
+
+    std::printf("\n");
+    printLatency("get", total.gets, elapsed);
+    printLatency("set", total.puts, elapsed);
+    const uint64_t gets = total.gets.count();
+    std::printf("misses %llu (%.1f%% of gets), errors %llu\n", static_cast<unsigned long long>(total.misses),
+                gets ? 100.0 * double(total.misses) / double(gets) : 0.0, static_cast<unsigned long long>(total.errors));
+    return total.errors == 0 ? 0 : 1;
+}
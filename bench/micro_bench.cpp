@@ -0,0 +1,326 @@
+// Microbenchmarks of the index maps and the cache policies on Google Benchmark. For a report that
+// can be compared across releases:
+//   timkv-micro-bench --benchmark_format=json --benchmark_out=micro.json
+// Map arguments are {entries, max_load * 100, move_per_op}; cache arguments are {capacity}.
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "clock_cache.h"
+#include "dict.h"
+#include "flat_dict.h"
+#include "histogram.h"
+#include "lfu_cache.h"
+#include "lru_cache.h"
+
+namespace {
+
+using Chained = HashMap<std::string, std::size_t>;
+using Flat = FlatHashMap<std::string, std::size_t>;
+using Lru = LRUCache<std::string, std::string>;
+using Lfu = LFUCache<std::string, std::string>;
+using Clock = ClockCache<std::string, std::string>;
+
+const std::vector<std::string>& keys(std::size_t n) {
+    static std::map<std::size_t, std::vector<std::string>> cache;
+    auto& k = cache[n];
+    if (k.empty()) {
+        k.reserve(n);
+        for (std::size_t i = 0; i < n; ++i) k.push_back("key:" + std::to_string(i));
+    }
+    return k;
+}
+
+// A shuffled permutation of 0..n-1, so lookups don't follow insertion order.
+std::vector<std::size_t> shuffled(std::size_t n) {
+    std::vector<std::size_t> order(n);
+    for (std::size_t i = 0; i < n; ++i) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+    return order;
+}
+
+template <typename M>
+std::unique_ptr<M> makeMap(const benchmark::State& state) {
+    const double load = state.range(1) / 100.0;
+    return std::make_unique<M>(16, load, std::size_t(state.range(2)));
+}
+
+template <typename M>
+void fill(M& m, std::size_t n) {
+    const auto& k = keys(n);
+    for (std::size_t i = 0; i < n; ++i) m.insert_or_assign(k[i], i);
+    while (m.rehash_in_progress()) m.rehash_step(1024);
+}
+
+template <typename M>
+void BM_MapInsert(benchmark::State& state) {
+    const std::size_t n = std::size_t(state.range(0));
+    const auto& k = keys(n);
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto m = makeMap<M>(state);
+        state.ResumeTiming();
+        for (std::size_t i = 0; i < n; ++i) m->insert_or_assign(k[i], i);
+        state.PauseTiming();
+        m.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(n));
+}
+
+// Every insert timed on its own: the tail shows what one op pays while the table grows and its
+// buckets are moved move_per_op at a time.
+template <typename M>
+void BM_MapInsertTail(benchmark::State& state) {
+    using Clk = std::chrono::steady_clock;
+    const std::size_t n = std::size_t(state.range(0));
+    const auto& k = keys(n);
+    LatencyHistogram ops;
+    for (auto _ : state) {
+        auto m = makeMap<M>(state);
+        Clk::duration total{};
+        for (std::size_t i = 0; i < n; ++i) {
+            const auto start = Clk::now();
+            m->insert_or_assign(k[i], i);
+            const auto took = Clk::now() - start;
+            total += took;
+            ops.record(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(took).count()));
+        }
+        state.SetIterationTime(std::chrono::duration<double>(total).count());
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(n));
+    state.counters["p50_ns"] = double(ops.percentile(50));
+    state.counters["p999_ns"] = double(ops.percentile(99.9));
+    state.counters["max_ns"] = double(ops.max());
+}
+
+template <typename M>
+void BM_MapGet(benchmark::State& state) {
+    const std::size_t n = std::size_t(state.range(0));
+    auto m = makeMap<M>(state);
+    fill(*m, n);
+    const auto& k = keys(n);
+    const auto order = shuffled(n);
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(m->find_ptr(k[order[i]]));
+        if (++i == n) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["load"] = m->load_factor();
+}
+
+template <typename M>
+void BM_MapMiss(benchmark::State& state) {
+    const std::size_t n = std::size_t(state.range(0));
+    auto m = makeMap<M>(state);
+    fill(*m, n);
+    std::vector<std::string> missing;
+    for (std::size_t i = 0; i < 4096; ++i) missing.push_back("absent:" + std::to_string(i));
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(m->find_ptr(missing[i]));
+        i = (i + 1) & 4095;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename M>
+void BM_MapErase(benchmark::State& state) {
+    const std::size_t n = std::size_t(state.range(0));
+    const auto& k = keys(n);
+    const auto order = shuffled(n);
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto m = makeMap<M>(state);
+        fill(*m, n);
+        state.ResumeTiming();
+        for (std::size_t i : order) m->erase(k[i]);
+        state.PauseTiming();
+        m.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(n));
+}
+
+// One rehash_step(1) call, from the insert that starts a resize to the end of it.
+template <typename M>
+void BM_MapRehashStep(benchmark::State& state) {
+    const std::size_t n = std::size_t(state.range(0));
+    const auto& k = keys(n);
+    int64_t steps = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto m = std::make_unique<M>(16, state.range(1) / 100.0, 1);
+        for (std::size_t i = 0; i < n && !(i >= n / 2 && m->rehash_in_progress()); ++i) m->insert_or_assign(k[i], i);
+        state.ResumeTiming();
+        while (m->rehash_in_progress()) {
+            m->rehash_step(1);
+            ++steps;
+        }
+        state.PauseTiming();
+        m.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(steps);
+}
+
+// Keys are drawn from twice the capacity, so about half the puts evict.
+template <typename C>
+void BM_CachePut(benchmark::State& state) {
+    const std::size_t capacity = std::size_t(state.range(0));
+    const auto& k = keys(2 * capacity);
+    const auto order = shuffled(2 * capacity);
+    C cache(capacity, 3600);
+    const std::string value(32, 'v');
+    std::size_t i = 0;
+    for (auto _ : state) {
+        cache.put(k[order[i]], value);
+        if (++i == order.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["evictions"] = double(cache.stats().evictions);
+}
+
+template <typename C>
+void fillCache(C& cache, std::size_t n) {
+    const auto& k = keys(n);
+    const std::string value(32, 'v');
+    for (std::size_t i = 0; i < n; ++i) cache.put(k[i], value);
+}
+
+// The exclusive get: reorders the policy's structure on every hit (LRU touch, LFU increment).
+template <typename C>
+void BM_CacheGet(benchmark::State& state) {
+    const std::size_t capacity = std::size_t(state.range(0));
+    C cache(capacity, 3600);
+    fillCache(cache, capacity);
+    const auto& k = keys(capacity);
+    const auto order = shuffled(capacity);
+    std::size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(cache.get(k[order[i]], [](const ValueView&) {}));
+        if (++i == capacity) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// The shared-lock read: queues the hit, and applies the queue whenever it asks to be drained.
+template <typename C>
+void BM_CacheRead(benchmark::State& state) {
+    const std::size_t capacity = std::size_t(state.range(0));
+    C cache(capacity, 3600);
+    fillCache(cache, capacity);
+    const auto& k = keys(capacity);
+    const auto order = shuffled(capacity);
+    std::size_t i = 0;
+    for (auto _ : state) {
+        bool drain = false;
+        benchmark::DoNotOptimize(cache.read(k[order[i]], drain, [](const ValueView&) {}));
+        if (drain) cache.maintain();
+        if (++i == capacity) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename C>
+void BM_CacheEvict(benchmark::State& state) {
+    const std::size_t capacity = std::size_t(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto cache = std::make_unique<C>(capacity, 3600);
+        fillCache(*cache, capacity);
+        state.ResumeTiming();
+        for (std::size_t i = 0; i < capacity; ++i) cache->evict();
+        state.PauseTiming();
+        cache.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(capacity));
+}
+
+template <typename C>
+void BM_CacheRemove(benchmark::State& state) {
+    const std::size_t capacity = std::size_t(state.range(0));
+    const auto& k = keys(capacity);
+    const auto order = shuffled(capacity);
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto cache = std::make_unique<C>(capacity, 3600);
+        fillCache(*cache, capacity);
+        state.ResumeTiming();
+        for (std::size_t i : order) cache->remove(k[i]);
+        state.PauseTiming();
+        cache.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(capacity));
+}
+
+// HashMap chains, so loads above 1 are meaningful; FlatHashMap clamps at 0.9375.
+void chainedLoads(benchmark::internal::Benchmark* b) {
+    for (int64_t n : {1 << 10, 1 << 16, 1 << 20})
+        for (int64_t load : {50, 100, 200, 400}) b->Args({n, load, 1});
+}
+
+void flatLoads(benchmark::internal::Benchmark* b) {
+    for (int64_t n : {1 << 10, 1 << 16, 1 << 20})
+        for (int64_t load : {50, 75, 87, 93}) b->Args({n, load, 1});
+}
+
+// The two rehash knobs against the per-op tail, at one size large enough to resize many times.
+void rehashSweep(benchmark::internal::Benchmark* b, int64_t maxLoad) {
+    for (int64_t load : {int64_t(50), maxLoad})
+        for (int64_t move : {1, 4, 16, 64, 256}) b->Args({1 << 20, load, move});
+}
+
+void chainedSweep(benchmark::internal::Benchmark* b) {
+    rehashSweep(b, 200);
+}
+
+void flatSweep(benchmark::internal::Benchmark* b) {
+    rehashSweep(b, 87);
+}
+
+void capacities(benchmark::internal::Benchmark* b) {
+    for (int64_t capacity : {1 << 10, 1 << 16, 1 << 20}) b->Args({capacity});
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_MapInsert, Chained)->Apply(chainedLoads)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_MapInsert, Flat)->Apply(flatLoads)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_MapInsertTail, Chained)->Apply(chainedSweep)->UseManualTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_MapInsertTail, Flat)->Apply(flatSweep)->UseManualTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_MapGet, Chained)->Apply(chainedLoads);
+BENCHMARK_TEMPLATE(BM_MapGet, Flat)->Apply(flatLoads);
+BENCHMARK_TEMPLATE(BM_MapMiss, Chained)->Apply(chainedLoads);
+BENCHMARK_TEMPLATE(BM_MapMiss, Flat)->Apply(flatLoads);
+BENCHMARK_TEMPLATE(BM_MapErase, Chained)->Apply(chainedLoads)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_MapErase, Flat)->Apply(flatLoads)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_MapRehashStep, Chained)->Args({1 << 20, 100, 1});
+BENCHMARK_TEMPLATE(BM_MapRehashStep, Flat)->Args({1 << 20, 87, 1});
+
+BENCHMARK_TEMPLATE(BM_CachePut, Lru)->Apply(capacities);
+BENCHMARK_TEMPLATE(BM_CachePut, Lfu)->Apply(capacities);
+BENCHMARK_TEMPLATE(BM_CachePut, Clock)->Apply(capacities);
+BENCHMARK_TEMPLATE(BM_CacheGet, Lru)->Apply(capacities);
+BENCHMARK_TEMPLATE(BM_CacheGet, Lfu)->Apply(capacities);
+BENCHMARK_TEMPLATE(BM_CacheGet, Clock)->Apply(capacities);
+BENCHMARK_TEMPLATE(BM_CacheRead, Lru)->Apply(capacities);
+BENCHMARK_TEMPLATE(BM_CacheRead, Lfu)->Apply(capacities);
+BENCHMARK_TEMPLATE(BM_CacheRead, Clock)->Apply(capacities);
+BENCHMARK_TEMPLATE(BM_CacheEvict, Lru)->Apply(capacities)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_CacheEvict, Lfu)->Apply(capacities)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_CacheEvict, Clock)->Apply(capacities)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_CacheRemove, Lru)->Apply(capacities)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_CacheRemove, Lfu)->Apply(capacities)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_CacheRemove, Clock)->Apply(capacities)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
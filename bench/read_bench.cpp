@@ -0,0 +1,112 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clock_cache.h"
+#include "flat_dict.h"
+#include "lru_cache.h"
+#include "storage.h"
+#include "zipf.h"
+
+using Storage = KVstorage<std::string, std::string>;
+using Lru = LRUCache<std::string, std::string, FlatHashMap>;
+using Clock = ClockCache<std::string, std::string, FlatHashMap>;
+
+// LRU with the shared read path turned off, i.e. every get takes the partition lock
+// exclusively and reorders the list in place.
+class ExclusiveLru : public Lru {
+public:
+    using Lru::Lru;
+
+    bool sharedReads() const override {
+        return false;
+    }
+};
+
+template<typename C>
+static Storage* makeStorage(std::size_t keys, std::size_t partitions) {
+    std::vector<Cache<std::string, std::string>*> caches;
+    for (std::size_t i = 0; i < partitions; ++i) caches.push_back(new C(2 * keys / partitions + 1, 3600));
+    return new Storage(caches, 2 * keys);
+}
+
+// Ops/s of `threads` workers replaying the Zipfian trace from different offsets; readPercent of
+// the ops are gets, the rest overwrite the key.
+static double run(Storage& storage, const std::vector<std::string>& keys, const std::vector<uint32_t>& trace,
+                  int threads, int readPercent, double seconds) {
+    std::atomic<bool> stop{false};
+    std::atomic<std::size_t> total{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            const std::string value(32, 'v');
+            std::size_t pos = trace.size() / std::size_t(threads) * std::size_t(t);
+            std::size_t ops = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 256; ++i) {
+                    if (++pos == trace.size()) pos = 0;
+                    const std::string& key = keys[trace[pos]];
+                    if (int(pos % 100) < readPercent)
+                        storage.get(key);
+                    else
+                        storage.put(key, value);
+                }
+                ops += 256;
+            }
+            total.fetch_add(ops);
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop.store(true);
+    for (auto& w : workers) w.join();
+    return double(total.load()) / seconds;
+}
+
+int main(int argc, char** argv) {
+    std::size_t keyCount = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    std::size_t partitions = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 64;
+    double seconds = argc > 3 ? std::atof(argv[3]) : 2.0;
+    int maxThreads = argc > 4 ? std::atoi(argv[4]) : int(std::thread::hardware_concurrency());
+    double skew = argc > 5 ? std::atof(argv[5]) : 0.99;
+    if (keyCount == 0) keyCount = 1;
+    if (partitions == 0) partitions = 1;
+    if (maxThreads < 1) maxThreads = 1;
+
+    std::vector<std::string> keys;
+    keys.reserve(keyCount);
+    for (std::size_t i = 0; i < keyCount; ++i) keys.push_back("key" + std::to_string(i));
+    ZipfGenerator zipf(keyCount, skew, 42);
+    std::vector<uint32_t> trace(4 * keyCount);
+    for (auto& k : trace) k = static_cast<uint32_t>(zipf());
+
+    std::printf("%zu keys, zipf %.2f, %zu partitions\n", keyCount, skew, partitions);
+    std::printf("%-10s %-8s %-6s %14s %10s\n", "reads", "threads", "read%", "ops/s", "vs excl");
+    for (int readPercent : {100, 95}) {
+        Storage* exclusive = makeStorage<ExclusiveLru>(keyCount, partitions);
+        Storage* shared = makeStorage<Lru>(keyCount, partitions);
+        Storage* clock = makeStorage<Clock>(keyCount, partitions);
+        const std::string value(32, 'v');
+        for (const auto& key : keys) {
+            exclusive->put(key, value);
+            shared->put(key, value);
+            clock->put(key, value);
+        }
+        for (int threads = 1; threads <= maxThreads; threads *= 2) {
+            double base = run(*exclusive, keys, trace, threads, readPercent, seconds);
+            double ops = run(*shared, keys, trace, threads, readPercent, seconds);
+            double clockOps = run(*clock, keys, trace, threads, readPercent, seconds);
+            std::printf("%-10s %-8d %-6d %14.0f %10s\n", "exclusive", threads, readPercent, base, "");
+            std::printf("%-10s %-8d %-6d %14.0f %9.2fx\n", "shared", threads, readPercent, ops, ops / base);
+            std::printf("%-10s %-8d %-6d %14.0f %9.2fx\n", "clock", threads, readPercent, clockOps, clockOps / base);
+            if (threads < maxThreads && threads * 2 > maxThreads) threads = maxThreads / 2;
+        }
+        delete exclusive;
+        delete shared;
+        delete clock;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "routing.h"
+
+using Clock = std::chrono::steady_clock;
+
+static std::vector<std::string> makeShards(std::size_t n) {
+    std::vector<std::string> shards;
+    for (std::size_t i = 0; i < n; ++i) shards.push_back("10.0.0." + std::to_string(i + 1) + ":8080");
+    return shards;
+}
+
+static double nsPerOp(Clock::time_point start, std::size_t ops) {
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()) / double(ops);
+}
+
+template <typename Route>
+static std::vector<std::size_t> assign(const std::vector<std::string>& keys, Route route, double& ns) {
+    std::vector<std::size_t> owners(keys.size());
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < keys.size(); ++i) owners[i] = route(keys[i]);
+    ns = nsPerOp(start, keys.size());
+    return owners;
+}
+
+// Share of keys whose owner address differs between two shard lists, and the most loaded
+// shard relative to a perfectly even split.
+static void report(const char* name, std::size_t vnodes, const std::vector<std::string>& keys,
+                   const std::vector<std::string>& before, const std::vector<std::string>& after) {
+    double ns = 0;
+    std::vector<std::size_t> a, b;
+    if (vnodes == 0) {
+        auto mod = [](const std::vector<std::string>& shards) {
+            return [&shards](const std::string& k) { return std::hash<std::string_view>{}(k) % shards.size(); };
+        };
+        a = assign(keys, mod(before), ns);
+        double unused = 0;
+        b = assign(keys, mod(after), unused);
+    } else {
+        ShardRing ringBefore(before, vnodes), ringAfter(after, vnodes);
+        a = assign(keys, [&](const std::string& k) { return ringBefore.owner(k); }, ns);
+        double unused = 0;
+        b = assign(keys, [&](const std::string& k) { return ringAfter.owner(k); }, unused);
+    }
+
+    std::size_t moved = 0;
+    std::vector<std::size_t> load(before.size());
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        moved += before[a[i]] != after[b[i]];
+        ++load[a[i]];
+    }
+    double skew = double(*std::max_element(load.begin(), load.end())) * double(before.size()) / double(keys.size());
+    std::printf("%-10s %7zu %10.1f %12.1f%% %10.3f\n", name, vnodes, ns, 100.0 * double(moved) / double(keys.size()),
+                skew);
+}
+
+int main(int argc, char** argv) {
+    std::size_t shardsCount = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 8;
+    std::size_t keysCount = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000;
+    if (shardsCount < 2) shardsCount = 2;
+
+    std::vector<std::string> keys;
+    keys.reserve(keysCount);
+    for (std::size_t i = 0; i < keysCount; ++i) keys.push_back("key" + std::to_string(i));
+
+    auto shards = makeShards(shardsCount);
+    auto grown = makeShards(shardsCount + 1);
+    auto shrunk = shards;
+    shrunk.erase(shrunk.begin() + shardsCount / 2);
+
+    std::printf("%zu shards, %zu keys; ideal movement %.1f%% on grow, %.1f%% on shrink\n", shardsCount, keysCount,
+                100.0 / double(shardsCount + 1), 100.0 / double(shardsCount));
+    std::printf("%-10s %7s %10s %13s %10s\n", "grow", "vnodes", "ns/route", "moved", "max/avg");
+    report("modulo", 0, keys, shards, grown);
+    for (std::size_t v : {16, 64, 160, 512}) report("ring", v, keys, shards, grown);
+    std::printf("%-10s %7s %10s %13s %10s\n", "shrink", "vnodes", "ns/route", "moved", "max/avg");
+    report("modulo", 0, keys, shards, shrunk);
+    for (std::size_t v : {16, 64, 160, 512}) report("ring", v, keys, shards, shrunk);
+    return 0;
+}
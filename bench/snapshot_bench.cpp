@@ -0,0 +1,61 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "flat_dict.h"
+#include "lru_cache.h"
+#include "storage.h"
+
+using Clock = std::chrono::steady_clock;
+using Storage = KVstorage<std::string, std::string>;
+
+static Storage* makeStorage(std::size_t keys, std::size_t partitions) {
+    std::vector<Cache<std::string, std::string>*> caches;
+    for (std::size_t i = 0; i < partitions; ++i)
+        caches.push_back(new LRUCache<std::string, std::string, FlatHashMap>(keys / partitions * 2 + 1, 3600));
+    return new Storage(caches, keys * 2);
+}
+
+static long long msSince(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    std::size_t keys = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    std::size_t valueSize = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 32;
+    std::size_t partitions = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 64;
+    std::string path = argc > 4 ? argv[4] : "timkv-bench.snapshot";
+
+    auto* source = makeStorage(keys, partitions);
+    const std::string value(valueSize, 'v');
+    std::vector<std::pair<std::string, std::string>> batch;
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < keys; ++i) {
+        batch.emplace_back("key:" + std::to_string(i), value);
+        if (batch.size() == 4096 || i + 1 == keys) {
+            source->multiPut(batch);
+            batch.clear();
+        }
+    }
+    std::printf("fill  %zu keys x %zu B: %lld ms\n", keys, valueSize, msSince(start));
+
+    start = Clock::now();
+    if (!source->saveSnapshot(path)) {
+        std::fprintf(stderr, "save failed\n");
+        return 1;
+    }
+    std::printf("save  %lld ms\n", msSince(start));
+    delete source;
+
+    auto* target = makeStorage(keys, partitions);
+    std::string error;
+    start = Clock::now();
+    target->loadSnapshot(path, error);
+    std::printf("load  %lld ms, %zu keys%s%s\n", msSince(start), target->size(), error.empty() ? "" : ", ",
+                error.c_str());
+    delete target;
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lru_cache.h"
+#include "storage.h"
+
+using Storage = KVstorage<std::string, std::string>;
+
+static constexpr std::size_t kKeys = 1 << 20;
+static constexpr int kTtl = 3600;
+
+static Storage* makeStorage(std::size_t partitions) {
+    std::vector<Cache<std::string, std::string>*> caches;
+    std::size_t cap = (kKeys + partitions - 1) / partitions;
+    for (std::size_t i = 0; i < partitions; ++i)
+        caches.push_back(new LRUCache<std::string, std::string>(cap, kTtl));
+    return new Storage(caches, kKeys);
+}
+
+static double run(Storage& storage, int threads, int readPercent, double seconds) {
+    std::atomic<bool> stop{false};
+    std::atomic<std::size_t> total{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 rng(t + 1);
+            std::uniform_int_distribution<std::size_t> keyDist(0, kKeys - 1);
+            std::uniform_int_distribution<int> opDist(0, 99);
+            const std::string value(32, 'v');
+            std::size_t ops = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 256; ++i) {
+                    std::string key = "key" + std::to_string(keyDist(rng));
+                    if (opDist(rng) < readPercent)
+                        storage.get(key);
+                    else
+                        storage.put(key, value);
+                }
+                ops += 256;
+            }
+            total.fetch_add(ops);
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop.store(true);
+    for (auto& w : workers) w.join();
+    return double(total.load()) / seconds;
+}
+
+int main(int argc, char** argv) {
+    std::size_t partitions = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    double seconds = argc > 2 ? std::atof(argv[2]) : 2.0;
+    int maxThreads = argc > 3 ? std::atoi(argv[3]) : int(std::thread::hardware_concurrency());
+    if (partitions == 0) partitions = 1;
+    if (maxThreads < 1) maxThreads = 1;
+
+    std::printf("%-10s %-8s %-6s %14s %14s\n", "partitions", "threads", "read%", "ops/s", "speedup");
+    for (std::size_t parts : {std::size_t(1), partitions}) {
+        for (int readPercent : {90, 50}) {
+            Storage* storage = makeStorage(parts);
+            const std::string value(32, 'v');
+            for (std::size_t i = 0; i < kKeys; ++i) storage->put("key" + std::to_string(i), value);
+
+            double base = 0;
+            for (int threads = 1; threads <= maxThreads; threads *= 2) {
+                double ops = run(*storage, threads, readPercent, seconds);
+                if (threads == 1) base = ops;
+                std::printf("%-10zu %-8d %-6d %14.0f %13.2fx\n", parts, threads, readPercent, ops, ops / base);
+                if (threads < maxThreads && threads * 2 > maxThreads) threads = maxThreads / 2;
+            }
+            delete storage;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Samples ranks 0..n-1 with P(k) ~ 1 / (k + 1)^s by binary search over the precomputed CDF.
+class ZipfGenerator {
+public:
+    ZipfGenerator(std::size_t n, double s, uint64_t seed = 1) : rng(seed), cdf(n) {
+        double sum = 0;
+        for (std::size_t k = 0; k < n; ++k) {
+            sum += 1.0 / std::pow(double(k + 1), s);
+            cdf[k] = sum;
+        }
+        for (auto& c : cdf) c /= sum;
+    }
+
+    std::size_t operator()() {
+        return sample(rng);
+    }
+
+    // Draws with the caller's engine, so threads can share one table.
+    std::size_t sample(std::mt19937_64& engine) const {
+        auto it = std::lower_bound(cdf.begin(), cdf.end(), std::uniform_real_distribution<double>(0.0, 1.0)(engine));
+        return std::min<std::size_t>(it - cdf.begin(), cdf.size() - 1);
+    }
+
+private:
+    std::mt19937_64 rng;
+    std::vector<double> cdf;
+};
@@ -0,0 +1,365 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "cache.h"
+#include "snapshot.h"
+#include "storage.h"
+
+// Append-only log of puts and removes, little-endian:
+//   header  "TIMKVAO1"
+//   record  u8 op (1 put, 2 remove) | u32 key length | u32 value length | i64 unix ms the entry
+//           expires at (0 for removes) | key | value
+// Writers only append to an in-memory group; a flusher thread writes each group with one
+// write() and, depending on the policy, one fdatasync():
+//   always    a mutation returns once its group is synced (group commit),
+//   interval  groups are written when they reach groupBytes or every interval, synced every interval,
+//   never     like interval, but syncing is left to the kernel.
+class AppendLog : public MutationListener {
+public:
+    enum class Fsync { Always, Interval, Never };
+
+    struct Options {
+        Fsync fsync = Fsync::Interval;
+        std::chrono::milliseconds interval{1000};
+        size_t groupBytes = 1 << 20;
+        int ttlSeconds = 3600;         // lifetime of a put, as configured for the caches
+        size_t rewriteMinBytes = 64 << 20;  // rewrite once the log is this big and twice its last rewrite
+    };
+
+    struct Stats {
+        uint64_t records = 0;
+        uint64_t groups = 0;
+        uint64_t syncs = 0;
+        uint64_t bytes = 0;
+        uint64_t rewrites = 0;
+    };
+
+    // Fills chunk with the encoded entries of partition i; false once i is past the last one.
+    using RewriteSource = std::function<bool(size_t i, std::string &chunk)>;
+
+    static constexpr char kMagic[8] = {'T', 'I', 'M', 'K', 'V', 'A', 'O', '1'};
+    static constexpr uint8_t kPut = 1;
+    static constexpr uint8_t kRemove = 2;
+    static constexpr size_t kRecordHeaderSize = 17;
+
+    AppendLog(std::string path, Options options) : path(std::move(path)), options(options) {
+    }
+
+    ~AppendLog() override {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        rewriteWake.notify_all();
+        if (rewriter.joinable()) rewriter.join();
+        if (flusher.joinable()) flusher.join();
+        if (fd >= 0) {
+            if (options.fsync != Fsync::Never) ::fdatasync(fd);
+            ::close(fd);
+        }
+    }
+
+    // Opens (or creates) the log for appending and starts the flusher; replay it first.
+    bool open(std::string &error) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            error = std::strerror(errno);
+            return false;
+        }
+        struct stat st{};
+        ::fstat(fd, &st);
+        fileBytes = size_t(st.st_size);
+        if (fileBytes == 0 && !writeAll(fd, kMagic, sizeof(kMagic))) {
+            error = std::strerror(errno);
+            return false;
+        }
+        fileBytes = std::max(fileBytes, sizeof(kMagic));
+        rewrittenBytes = fileBytes;
+        flusher = std::thread([this] { flushLoop(); });
+        return true;
+    }
+
+    // Rewrites the log in the background whenever it outgrows rewriteMinBytes and twice its size
+    // after the last rewrite.
+    void startRewrites(RewriteSource source) {
+        rewriter = std::thread([this, source = std::move(source)] {
+            std::unique_lock lock(mutex);
+            while (!stopping) {
+                rewriteWake.wait_for(lock, std::chrono::seconds(1));
+                if (stopping || fileBytes < options.rewriteMinBytes || fileBytes < 2 * rewrittenBytes) continue;
+                lock.unlock();
+                if (!rewrite(source)) std::fprintf(stderr, "append log rewrite of %s failed\n", path.c_str());
+                lock.lock();
+            }
+        });
+    }
+
+    uint64_t onPut(std::string_view key, std::string_view value, std::chrono::milliseconds ttl) override {
+        std::string record;
+        const int64_t lifetime = ttl.count() > 0 ? ttl.count() : int64_t(options.ttlSeconds) * 1000;
+        encode(record, kPut, key, value, snapshot::unixMs() + lifetime);
+        return append(record);
+    }
+
+    uint64_t onRemove(std::string_view key) override {
+        std::string record;
+        encode(record, kRemove, key, {}, 0);
+        return append(record);
+    }
+
+    void await(uint64_t ticket) override {
+        if (options.fsync != Fsync::Always) return;
+        std::unique_lock lock(mutex);
+        durableCv.wait(lock, [&] { return durable >= ticket || stopping; });
+    }
+
+    // Replaces the log with one put per live entry. Mutations made meanwhile still go to the old
+    // log and are also kept aside, then appended to the new log before it takes the old one's
+    // place, so replaying the new log gives the same state.
+    bool rewrite(const RewriteSource &source) {
+        std::lock_guard single(rewriteMutex);
+        const std::string tmp = path + ".rewrite";
+        int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) return false;
+        {
+            std::lock_guard lock(mutex);
+            rewriting = true;
+            sideBuffer.clear();
+        }
+
+        bool ok = writeAll(out, kMagic, sizeof(kMagic));
+        std::string chunk;
+        for (size_t i = 0; ok; ++i) {
+            chunk.clear();
+            if (!source(i, chunk)) break;
+            ok = writeAll(out, chunk.data(), chunk.size());
+        }
+
+        // Catch up on the mutations made during the dump without blocking writers, then take
+        // the last bit and switch files with writers held off.
+        std::string side;
+        for (int round = 0; ok && round < 4; ++round) {
+            {
+                std::lock_guard lock(mutex);
+                side.swap(sideBuffer);
+                sideBuffer.clear();
+            }
+            if (side.empty()) break;
+            ok = writeAll(out, side.data(), side.size());
+        }
+
+        std::lock_guard file(fileMutex);
+        std::lock_guard lock(mutex);
+        rewriting = false;
+        ok = ok && writeAll(out, sideBuffer.data(), sideBuffer.size()) && ::fdatasync(out) == 0 &&
+             ::rename(tmp.c_str(), path.c_str()) == 0;
+        sideBuffer.clear();
+        sideBuffer.shrink_to_fit();
+        if (!ok) {
+            ::close(out);
+            ::unlink(tmp.c_str());
+            return false;
+        }
+        // Everything still in the group, or taken by the flusher and not yet written, is already in
+        // the new file.
+        ::close(fd);
+        fd = out;
+        ++generation;
+        group.clear();
+        durable = appended;
+        durableCv.notify_all();
+        struct stat st{};
+        ::fstat(fd, &st);
+        fileBytes = rewrittenBytes = size_t(st.st_size);
+        ++counters.rewrites;
+        return true;
+    }
+
+    Stats stats() {
+        std::lock_guard lock(mutex);
+        return counters;
+    }
+
+    // Encodes a live entry as a put, for RewriteSource implementations.
+    static void encodeEntry(std::string &out, std::string_view key, std::string_view value, const EntryMeta &meta) {
+        encode(out, kPut, key, value, snapshot::unixMs() + meta.ttlMs);
+    }
+
+    // Calls onPut(key, value, ttlMs) for puts that have not expired yet, and onRemove(key) for
+    // removes and expired puts, in log order. A torn record at the end (a crash mid-write) is cut
+    // off; anything else malformed fails the replay. Returns the number of records applied.
+    template<typename OnPut, typename OnRemove>
+    static size_t replay(const std::string &path, OnPut onPut, OnRemove onRemove, std::string &error) {
+        int fd = ::open(path.c_str(), O_RDWR);
+        if (fd < 0) {
+            if (errno != ENOENT) error = std::strerror(errno);
+            return 0;
+        }
+        struct stat st{};
+        ::fstat(fd, &st);
+        const size_t len = size_t(st.st_size);
+        if (len == 0) {
+            ::close(fd);
+            return 0;
+        }
+        void *m = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (m == MAP_FAILED) {
+            error = std::strerror(errno);
+            ::close(fd);
+            return 0;
+        }
+        ::madvise(m, len, MADV_SEQUENTIAL);
+        const char *data = static_cast<const char *>(m);
+
+        size_t applied = 0;
+        size_t pos = sizeof(kMagic);
+        if (len < sizeof(kMagic) || std::memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+            error = "bad magic";
+        } else {
+            const int64_t now = snapshot::unixMs();
+            while (len - pos >= kRecordHeaderSize) {
+                uint8_t op = uint8_t(data[pos]);
+                uint32_t keyLen = snapshot::get<uint32_t>(data + pos + 1);
+                uint32_t valueLen = snapshot::get<uint32_t>(data + pos + 5);
+                int64_t expiresAt = snapshot::get<int64_t>(data + pos + 9);
+                if (op != kPut && op != kRemove) {
+                    error = "corrupt record at " + std::to_string(pos);
+                    break;
+                }
+                if (len - pos - kRecordHeaderSize < size_t(keyLen) + valueLen) break;
+                std::string_view key(data + pos + kRecordHeaderSize, keyLen);
+                std::string_view value(data + pos + kRecordHeaderSize + keyLen, valueLen);
+                if (op == kPut && expiresAt > now) onPut(key, value, expiresAt - now); else onRemove(key);
+                pos += kRecordHeaderSize + keyLen + valueLen;
+                ++applied;
+            }
+            if (error.empty() && pos != len) {
+                std::fprintf(stderr, "append log %s: dropping %zu bytes of a torn record\n", path.c_str(), len - pos);
+                if (::ftruncate(fd, off_t(pos)) != 0) error = std::strerror(errno);
+            }
+        }
+        ::munmap(m, len);
+        ::close(fd);
+        return applied;
+    }
+
+private:
+    std::string path;
+    Options options;
+    int fd = -1;
+
+    std::mutex mutex;  // guards everything below up to fileMutex
+    std::condition_variable wake;  // the flusher
+    std::condition_variable rewriteWake;
+    std::condition_variable durableCv;
+    std::string group;
+    uint64_t appended = 0;
+    uint64_t durable = 0;
+    bool stopping = false;
+    bool rewriting = false;
+    uint64_t generation = 0;  // bumped when a rewrite replaces the file
+    std::string sideBuffer;
+    size_t fileBytes = 0;
+    size_t rewrittenBytes = 0;
+    Stats counters;
+
+    std::mutex fileMutex;     // held while fd is written to or replaced
+    std::mutex rewriteMutex;  // one rewrite at a time
+    std::thread flusher;
+    std::thread rewriter;
+
+    static void encode(std::string &out, uint8_t op, std::string_view key, std::string_view value, int64_t expiresAt) {
+        out += char(op);
+        snapshot::put<uint32_t>(out, static_cast<uint32_t>(key.size()));
+        snapshot::put<uint32_t>(out, static_cast<uint32_t>(value.size()));
+        snapshot::put<int64_t>(out, expiresAt);
+        out += key;
+        out += value;
+    }
+
+    static bool writeAll(int fd, const char *data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            len -= size_t(n);
+        }
+        return true;
+    }
+
+    uint64_t append(const std::string &record) {
+        std::lock_guard lock(mutex);
+        group += record;
+        if (rewriting) sideBuffer += record;
+        ++counters.records;
+        const uint64_t ticket = ++appended;
+        if (options.fsync == Fsync::Always || group.size() >= options.groupBytes) wake.notify_one();
+        return ticket;
+    }
+
+    void flushLoop() {
+        auto lastSync = std::chrono::steady_clock::now();
+        std::string batch;
+        std::unique_lock lock(mutex);
+        while (true) {
+            if (options.fsync == Fsync::Always) {
+                wake.wait(lock, [&] { return stopping || !group.empty(); });
+            } else {
+                wake.wait_for(lock, options.interval, [&] { return stopping || group.size() >= options.groupBytes; });
+            }
+            if (stopping && group.empty()) break;
+
+            batch.swap(group);
+            group.clear();
+            const uint64_t upTo = appended;
+            const uint64_t batchGeneration = generation;
+            lock.unlock();
+
+            bool sync = false;
+            bool ok = true;
+            {
+                std::lock_guard file(fileMutex);
+                // A rewrite that finished since the swap already wrote this batch.
+                if (batchGeneration != generation) batch.clear();
+                if (!batch.empty()) ok = writeAll(fd, batch.data(), batch.size());
+                auto now = std::chrono::steady_clock::now();
+                sync = options.fsync == Fsync::Always ||
+                       (options.fsync == Fsync::Interval && now - lastSync >= options.interval);
+                if (sync && ok) {
+                    ok = ::fdatasync(fd) == 0;
+                    lastSync = now;
+                }
+            }
+            if (!ok) std::fprintf(stderr, "append log %s: %s\n", path.c_str(), std::strerror(errno));
+
+            lock.lock();
+            fileBytes += batch.size();
+            counters.bytes += batch.size();
+            if (!batch.empty()) ++counters.groups;
+            if (sync) ++counters.syncs;
+            // A failed write still releases the waiters rather than blocking requests forever.
+            if (upTo > durable) durable = upTo;
+            durableCv.notify_all();
+            batch.clear();
+        }
+    }
+};
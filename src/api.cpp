@@ -0,0 +1,585 @@
+#include "api.h"
+
+#include <Poco/JSON/Array.h>
+#include <Poco/JSON/Parser.h>
+#include <Poco/JSON/Stringifier.h>
+#include <Poco/URI.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+
+#include "metrics.h"
+
+// Optional "ttl" of a put in seconds; absent or 0 keeps the configured lifetime.
+static std::chrono::milliseconds ttlOf(const Poco::JSON::Object::Ptr &request) {
+    auto seconds = request->optValue<Poco::Int64>("ttl", 0);
+    if (seconds < 0) throw std::invalid_argument("ttl");
+    return std::chrono::seconds(seconds);
+}
+
+static bool isRaw(const std::string &method, const std::string &uri) {
+    return method == "GET" && uri.rfind("/raw/", 0) == 0;
+}
+
+// Whether an Accept-Encoding header lists coding with a non-zero q.
+static bool accepts(std::string_view header, std::string_view coding) {
+    auto trim = [](std::string_view s) {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+        return s;
+    };
+    while (!header.empty()) {
+        const size_t comma = header.find(',');
+        std::string_view item = header.substr(0, comma);
+        header = comma == std::string_view::npos ? std::string_view() : header.substr(comma + 1);
+        const size_t semi = item.find(';');
+        const std::string_view name = trim(item.substr(0, semi));
+        if (name.size() != coding.size() ||
+            !std::equal(name.begin(), name.end(), coding.begin(),
+                        [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == b; }))
+            continue;
+        if (semi == std::string_view::npos) return true;
+        const std::string_view q = trim(item.substr(semi + 1));
+        return !(q.rfind("q=0", 0) == 0 && q.find_first_not_of("0.", 3) == std::string_view::npos);
+    }
+    return false;
+}
+
+static bool isWrite(const std::string &method, const std::string &uri) {
+    return method == "POST" && (uri == "/put" || uri == "/delete" || uri == "/mput" || uri == "/mdelete");
+}
+
+bool Api::hasRoute(const std::string &method, const std::string &uri) const {
+    if (uri == "/stats" || uri == "/hotkeys" || uri == "/metrics" || isRaw(method, uri)) return true;
+    if (method != "POST") return false;
+    return uri == "/get" || uri == "/put" || uri == "/delete" ||
+           uri == "/mget" || uri == "/mput" || uri == "/mdelete";
+}
+
+void Api::enableProxy(int respBasePort) {
+    peers.clear();
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (static_cast<int>(i) == curr) {
+            peers.push_back(nullptr);
+            continue;
+        }
+        const std::string &addr = shards[i];
+        peers.push_back(std::make_unique<ShardClient>(addr.substr(0, addr.rfind(':')), respBasePort + static_cast<int>(i)));
+    }
+}
+
+void Api::enableReplication(std::function<ReplicationStats()> stats, bool replica) {
+    replicationStats = std::move(stats);
+    this->replica = replica;
+}
+
+void Api::enableHotKeys(HotKeys *hotKeys, NearCache *nearCache) {
+    this->hotKeys = hotKeys;
+    this->nearCache = nearCache;
+}
+
+RespReply Api::fetch(size_t shard, const std::string &key) {
+    if (!nearCache) return peers[shard]->call({"GET", key});
+    hotKeys->record(key);
+    RespReply reply;
+    if (nearCache->get(key, reply.str)) {
+        reply.type = RespReply::Type::Bulk;
+        return reply;
+    }
+    if (!hotKeys->isHot(key)) return peers[shard]->call({"GET", key});
+    const uint64_t epoch = nearCache->epoch();
+    reply = peers[shard]->call({"NEARGET", key, std::to_string(curr)});
+    if (reply.type == RespReply::Type::Bulk) nearCache->fill(key, reply.str, epoch);
+    return reply;
+}
+
+bool Api::forwardIfNeeded(const std::string &uri, const Poco::JSON::Object::Ptr &request,
+                          Poco::JSON::Object::Ptr &result, ApiResponse &response) {
+    auto key = request->getValue<std::string>("key");
+    size_t shard = 0;
+    if (key.empty() || isLocal(key, shard)) return false;
+
+    RespReply reply;
+    if (uri == "/get") {
+        reply = fetch(shard, key);
+    } else if (uri == "/put") {
+        auto value = request->getValue<std::string>("value");
+        auto ttl = ttlOf(request);
+        if (ttl.count() > 0) reply = peers[shard]->call({"SET", key, value, "PX", std::to_string(ttl.count())});
+        else reply = peers[shard]->call({"SET", key, value});
+    } else {
+        reply = peers[shard]->call({"DEL", key});
+    }
+    // Our own copy goes now rather than on the owner's INVALIDATE, so this client's next read sees
+    // the write; an error may still have reached the owner.
+    if (nearCache && uri != "/get") nearCache->invalidate(key);
+
+    if (reply.isError()) {
+        response.status = 502;
+        result->set("status", "error");
+        result->set("error", reply.str);
+    } else if (uri == "/get" && reply.type == RespReply::Type::Null) {
+        result->set("status", "not found");
+    } else {
+        result->set("status", "ok");
+        if (uri == "/get") result->set("value", reply.str);
+    }
+    return true;
+}
+
+bool Api::redirectIfNeeded(const std::string &key, const std::string &uri, ApiResponse &response) {
+    if (shards.size() == 1 || key.empty()) return false;
+    size_t idx = ring.owner(key);
+    if (static_cast<int>(idx) != curr) {
+        response.status = 307;
+        response.location = "http://" + shards[idx] + uri;
+        return true;
+    }
+    return false;
+}
+
+void Api::handle(const std::string &method, const std::string &uri, std::istream &body, ApiResponse &response,
+                 std::string_view acceptEncoding) {
+    if (isRaw(method, uri)) {
+        rawGet(uri, response, accepts(acceptEncoding, "zstd"));
+        return;
+    }
+    if (uri == "/metrics") {
+        prometheus(response);
+        return;
+    }
+    if (replica && isWrite(method, uri)) {
+        response.status = 307;
+        response.location = "http://" + shards[curr] + uri;
+        return;
+    }
+    Poco::JSON::Object::Ptr jsonResp = new Poco::JSON::Object;
+    if (uri == "/stats") {
+        stats(jsonResp);
+    } else if (uri == "/hotkeys") {
+        hot(jsonResp);
+    } else if (!hasRoute(method, uri)) {
+        response.status = 404;
+        return;
+    } else {
+        try {
+            metrics::StageTimer timer;
+            Poco::JSON::Parser parser;
+            auto reqObj = parser.parse(body).extract<Poco::JSON::Object::Ptr>();
+            timer.lap(metrics::Stage::Parse);
+            if (uri == "/mget") {
+                multiGet(reqObj, jsonResp);
+            } else if (uri == "/mput") {
+                multiPut(reqObj, jsonResp);
+            } else if (uri == "/mdelete") {
+                multiRemove(reqObj, jsonResp);
+            } else {
+                // A foreign key is answered by its owner when proxying, or else redirected to it.
+                const bool forwarded = !peers.empty() && forwardIfNeeded(uri, reqObj, jsonResp, response);
+                if (!forwarded) {
+                    if (redirectIfNeeded(reqObj->getValue<std::string>("key"), uri, response)) return;
+                    if (uri == "/get") get(reqObj, jsonResp);
+                    else if (uri == "/put") put(reqObj, jsonResp);
+                    else remove(reqObj, jsonResp);
+                }
+            }
+        } catch (...) {
+            response.status = 400;
+        }
+    }
+    std::ostringstream out;
+    Poco::JSON::Stringifier::stringify(jsonResp, out);
+    response.body = out.str();
+}
+
+void Api::get(const Poco::JSON::Object::Ptr &request, Poco::JSON::Object::Ptr &result) {
+    auto res = storage->get(request->getValue<std::string>("key"));
+    if (res) {
+        result->set("status", "ok");
+        result->set("value", res.value());
+    } else {
+        result->set("status", "not found");
+    }
+}
+
+void Api::rawGet(const std::string &uri, ApiResponse &response, bool acceptsZstd) {
+    response.contentType = "application/octet-stream";
+    std::string key;
+    try {
+        Poco::URI::decode(uri.substr(5, uri.find('?') - 5), key);
+    } catch (...) {
+        response.status = 400;
+        return;
+    }
+    size_t shard = 0;
+    if (key.empty()) {
+        response.status = 400;
+    } else if (!peers.empty() && !isLocal(key, shard)) {
+        RespReply reply = fetch(shard, key);
+        if (reply.isError()) response.status = 502;
+        else if (reply.type == RespReply::Type::Null) response.status = 404;
+        else response.body = std::move(reply.str);
+    } else if (!redirectIfNeeded(key, uri, response)) {
+        // A large value is retained rather than copied and goes out after the lock is released.
+        const bool found = storage->get(key, [&](const ValueView &stored) {
+            const bool passThrough = acceptsZstd && stored.encoding == Encoding::Zstd;
+            if (passThrough) response.contentEncoding = "zstd";
+            const ValueView value = passThrough ? stored : Codec::decode(stored);
+            if (value.buffer) response.shared = SharedValue(value.buffer); else response.body.assign(value.bytes);
+        }, false);
+        if (!found) response.status = 404;
+    }
+}
+
+void Api::put(const Poco::JSON::Object::Ptr &request, Poco::JSON::Object::Ptr &result) {
+    auto key = request->getValue<std::string>("key");
+    auto value = request->getValue<std::string>("value");
+    storage->put(key, value, ttlOf(request));
+    result->set("status", "ok");
+}
+
+void Api::remove(const Poco::JSON::Object::Ptr &request, Poco::JSON::Object::Ptr &result) {
+    storage->remove(request->getValue<std::string>("key"));
+    result->set("status", "ok");
+}
+
+bool Api::isLocal(const std::string &key, size_t &shard) const {
+    if (shards.size() == 1) return true;
+    shard = ring.owner(key);
+    return static_cast<int>(shard) == curr;
+}
+
+Poco::JSON::Object::Ptr Api::groupByShard(const std::vector<const Foreign *> &items) const {
+    Poco::JSON::Object::Ptr moved = new Poco::JSON::Object;
+    for (const Foreign *f : items) {
+        const std::string &addr = shards[f->shard];
+        if (!moved->has(addr)) moved->set(addr, Poco::JSON::Array::Ptr(new Poco::JSON::Array));
+        moved->getArray(addr)->add(f->key);
+    }
+    return moved;
+}
+
+std::vector<RespReply> Api::forward(const std::vector<Foreign> &foreign, const char *command, bool withValue,
+                                    std::chrono::milliseconds ttl) {
+    const std::string px = std::to_string(ttl.count());
+    std::vector<std::future<RespReply>> pending;
+    pending.reserve(foreign.size());
+    for (const auto &f : foreign) {
+        std::vector<std::string_view> args{command, f.key};
+        if (withValue) args.emplace_back(f.value);
+        if (ttl.count() > 0) {
+            args.emplace_back("PX");
+            args.emplace_back(px);
+        }
+        pending.push_back(peers[f.shard]->send(args));
+    }
+    std::vector<RespReply> replies;
+    replies.reserve(foreign.size());
+    for (size_t i = 0; i < foreign.size(); ++i) replies.push_back(peers[foreign[i].shard]->wait(pending[i]));
+    return replies;
+}
+
+void Api::multiGet(const Poco::JSON::Object::Ptr &request, Poco::JSON::Object::Ptr &result) {
+    auto keysArr = request->getArray("keys");
+    if (!keysArr) throw std::invalid_argument("keys");
+    std::vector<std::string> keys;
+    std::vector<Foreign> foreign;
+    keys.reserve(keysArr->size());
+    for (size_t i = 0; i < keysArr->size(); ++i) {
+        auto key = keysArr->getElement<std::string>(i);
+        size_t shard = 0;
+        if (isLocal(key, shard)) keys.push_back(std::move(key)); else foreign.push_back({shard, std::move(key), {}});
+    }
+
+    Poco::JSON::Object::Ptr found = new Poco::JSON::Object;
+    Poco::JSON::Array::Ptr missing = new Poco::JSON::Array;
+    std::vector<const Foreign *> moved;
+    if (!peers.empty()) {
+        // Near copies answer first; the rest is forwarded and fills none, which /get and /raw do.
+        if (nearCache) {
+            std::string value;
+            std::erase_if(foreign, [&](const Foreign &f) {
+                hotKeys->record(f.key);
+                if (!nearCache->get(f.key, value)) return false;
+                found->set(f.key, value);
+                return true;
+            });
+        }
+        auto replies = forward(foreign, "GET", false);
+        for (size_t i = 0; i < foreign.size(); ++i) {
+            if (replies[i].type == RespReply::Type::Bulk) found->set(foreign[i].key, replies[i].str);
+            else if (replies[i].type == RespReply::Type::Null) missing->add(foreign[i].key);
+            else moved.push_back(&foreign[i]);
+        }
+    } else {
+        for (const auto &f : foreign) moved.push_back(&f);
+    }
+
+    auto values = storage->multiGet(keys);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (values[i]) found->set(keys[i], *values[i]); else missing->add(keys[i]);
+    }
+    result->set("status", "ok");
+    result->set("values", found);
+    result->set("not_found", missing);
+    result->set("moved", groupByShard(moved));
+}
+
+void Api::multiPut(const Poco::JSON::Object::Ptr &request, Poco::JSON::Object::Ptr &result) {
+    auto itemsObj = request->getObject("items");
+    if (!itemsObj) throw std::invalid_argument("items");
+    const auto ttl = ttlOf(request);
+    std::vector<std::pair<std::string, std::string>> items;
+    std::vector<Foreign> foreign;
+    items.reserve(itemsObj->size());
+    for (const auto &[key, value] : *itemsObj) {
+        size_t shard = 0;
+        if (isLocal(key, shard)) items.emplace_back(key, value.convert<std::string>());
+        else foreign.push_back({shard, key, value.convert<std::string>()});
+    }
+
+    size_t stored = items.size();
+    std::vector<const Foreign *> moved;
+    if (!peers.empty()) {
+        auto replies = forward(foreign, "SET", true, ttl);
+        for (size_t i = 0; i < foreign.size(); ++i) {
+            if (nearCache) nearCache->invalidate(foreign[i].key);
+            if (replies[i].isError()) moved.push_back(&foreign[i]); else ++stored;
+        }
+    } else {
+        for (const auto &f : foreign) moved.push_back(&f);
+    }
+
+    storage->multiPut(items, ttl);
+    result->set("status", "ok");
+    result->set("stored", stored);
+    result->set("moved", groupByShard(moved));
+}
+
+void Api::multiRemove(const Poco::JSON::Object::Ptr &request, Poco::JSON::Object::Ptr &result) {
+    auto keysArr = request->getArray("keys");
+    if (!keysArr) throw std::invalid_argument("keys");
+    std::vector<std::string> keys;
+    std::vector<Foreign> foreign;
+    keys.reserve(keysArr->size());
+    for (size_t i = 0; i < keysArr->size(); ++i) {
+        auto key = keysArr->getElement<std::string>(i);
+        size_t shard = 0;
+        if (isLocal(key, shard)) keys.push_back(std::move(key)); else foreign.push_back({shard, std::move(key), {}});
+    }
+
+    size_t removed = 0;
+    std::vector<const Foreign *> moved;
+    if (!peers.empty()) {
+        auto replies = forward(foreign, "DEL", false);
+        for (size_t i = 0; i < foreign.size(); ++i) {
+            if (nearCache) nearCache->invalidate(foreign[i].key);
+            if (replies[i].type == RespReply::Type::Integer) removed += size_t(replies[i].integer);
+            else moved.push_back(&foreign[i]);
+        }
+    } else {
+        for (const auto &f : foreign) moved.push_back(&f);
+    }
+
+    removed += storage->multiRemove(keys);
+    result->set("status", "ok");
+    result->set("removed", removed);
+    result->set("moved", groupByShard(moved));
+}
+
+void Api::stats(Poco::JSON::Object::Ptr &result) {
+    auto st = storage->stats();
+    result->set("status", "ok");
+    result->set("size", st.size);
+    result->set("capacity", st.capacity);
+    result->set("evictions", st.evictions);
+    result->set("expirations", st.expirations);
+    result->set("memory", st.memory);
+    result->set("max_memory", st.maxMemory);
+    result->set("rejections", st.rejections);
+    result->set("partitions", storage->partitionsCount());
+    result->set("slab_bytes", st.slabBytes);
+    Poco::JSON::Array::Ptr slabs = new Poco::JSON::Array();
+    for (const auto &cls : st.slabs) {
+        if (cls.pages == 0) continue;
+        Poco::JSON::Object::Ptr item = new Poco::JSON::Object();
+        item->set("chunk_size", cls.chunkSize);
+        item->set("pages", cls.pages);
+        item->set("used", cls.used);
+        item->set("free", cls.free);
+        slabs->add(item);
+    }
+    result->set("slabs", slabs);
+
+    const auto m = metrics::snapshot();
+    const uint64_t hits = m.count(metrics::Event::Hit);
+    const uint64_t lookups = hits + m.count(metrics::Event::Miss);
+    result->set("uptime_seconds", std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started).count());
+    result->set("hits", hits);
+    result->set("misses", m.count(metrics::Event::Miss));
+    result->set("hit_ratio", lookups ? double(hits) / double(lookups) : 0.0);
+    result->set("puts", m.count(metrics::Event::Put));
+    result->set("removes", m.count(metrics::Event::Remove));
+    result->set("index_capacity", st.indexCapacity);
+    result->set("load_factor", st.indexCapacity ? double(st.size) / double(st.indexCapacity) : 0.0);
+    result->set("rehashing_partitions", st.rehashing);
+    Poco::JSON::Object::Ptr latency = new Poco::JSON::Object();
+    for (size_t i = 0; i < metrics::kStages; ++i) {
+        const auto &h = m.stages[i].histogram;
+        auto us = [](uint64_t ns) { return double(ns) / 1000.0; };
+        Poco::JSON::Object::Ptr stage = new Poco::JSON::Object();
+        stage->set("count", h.count());
+        stage->set("mean_us", h.count() ? us(m.stages[i].sumNs) / double(h.count()) : 0.0);
+        stage->set("p50_us", us(h.percentile(50)));
+        stage->set("p99_us", us(h.percentile(99)));
+        stage->set("p999_us", us(h.percentile(99.9)));
+        stage->set("max_us", us(h.max()));
+        latency->set(metrics::kStageNames[i], stage);
+    }
+    result->set("latency", latency);
+
+    // ratio is raw over stored bytes of the values kept compressed; the seconds are the CPU spent
+    // on every value tried, kept or not, and on reads.
+    const uint64_t packedIn = m.count(metrics::Event::CompressedIn);
+    const uint64_t packedOut = m.count(metrics::Event::CompressedOut);
+    Poco::JSON::Object::Ptr compression = new Poco::JSON::Object();
+    compression->set("algorithm", Codec::name(storage->compression().algorithm()));
+    compression->set("compressed", m.count(metrics::Event::Compressed));
+    compression->set("incompressible", m.count(metrics::Event::Incompressible));
+    compression->set("bytes_in", packedIn);
+    compression->set("bytes_out", packedOut);
+    compression->set("ratio", packedOut ? double(packedIn) / double(packedOut) : 0.0);
+    compression->set("compress_seconds", double(m.stage(metrics::Stage::Compress).sumNs) / 1e9);
+    compression->set("decompress_seconds", double(m.stage(metrics::Stage::Decompress).sumNs) / 1e9);
+    result->set("compression", compression);
+
+    if (replicationStats) {
+        const auto rs = replicationStats();
+        Poco::JSON::Object::Ptr replication = new Poco::JSON::Object();
+        replication->set("role", replica ? "replica" : "primary");
+        if (replica) {
+            replication->set("synced", rs.synced);
+            replication->set("applied", rs.applied);
+            replication->set("full_syncs", rs.fullSyncs);
+        } else {
+            replication->set("replicas", rs.replicas);
+            replication->set("backlog_bytes", rs.backlogBytes);
+        }
+        result->set("replication", replication);
+    }
+}
+
+// The hottest keys by estimated reads (sampled, halved every half-life), with the owning shard and,
+// on a node with a near cache, its counters.
+void Api::hot(Poco::JSON::Object::Ptr &result) {
+    if (!hotKeys) {
+        result->set("status", "error");
+        result->set("error", "hot key tracking is off");
+        return;
+    }
+    Poco::JSON::Array::Ptr keys = new Poco::JSON::Array();
+    for (const auto &k : hotKeys->top(32)) {
+        Poco::JSON::Object::Ptr item = new Poco::JSON::Object();
+        item->set("key", k.key);
+        item->set("reads", k.count);
+        item->set("error", k.error);
+        item->set("hot", k.hot);
+        item->set("shard", shards.size() == 1 ? 0 : ring.owner(k.key));
+        keys->add(item);
+    }
+    result->set("status", "ok");
+    result->set("sample_rate", hotKeys->settings().sampleRate);
+    result->set("half_life_ms", hotKeys->settings().halfLife.count());
+    result->set("keys", keys);
+    if (nearCache) {
+        const auto nc = nearCache->stats();
+        Poco::JSON::Object::Ptr near = new Poco::JSON::Object();
+        near->set("entries", nc.entries);
+        near->set("hits", nc.hits);
+        near->set("misses", nc.misses);
+        near->set("fills", nc.fills);
+        near->set("invalidated", nc.invalidated);
+        near->set("tracked", nc.tracked);
+        near->set("invalidations_sent", nc.invalidationsSent);
+        result->set("near_cache", near);
+    }
+}
+
+// Prometheus text exposition (version 0.0.4). Stage latencies are a histogram with one bucket per
+// power of two of nanoseconds, which the log-linear buckets underneath count exactly (up to a
+// sample of exactly 2^k ns, counted one bucket up).
+void Api::prometheus(ApiResponse &response) {
+    const auto st = storage->stats();
+    const auto m = metrics::snapshot();
+    std::string out;
+    char line[256];
+    auto metric = [&](const char *name, const char *type, const char *help, double value) {
+        std::snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n", name, help, name, type, name, value);
+        out += line;
+    };
+    metric("timkv_get_hits_total", "counter", "Gets that found the key.", double(m.count(metrics::Event::Hit)));
+    metric("timkv_get_misses_total", "counter", "Gets that did not find the key.", double(m.count(metrics::Event::Miss)));
+    metric("timkv_puts_total", "counter", "Entries written.", double(m.count(metrics::Event::Put)));
+    metric("timkv_removes_total", "counter", "Entries deleted.", double(m.count(metrics::Event::Remove)));
+    metric("timkv_evictions_total", "counter", "Entries evicted by policy.", double(st.evictions));
+    metric("timkv_expirations_total", "counter", "Entries dropped at the end of their ttl.", double(st.expirations));
+    metric("timkv_rejections_total", "counter", "Puts refused by the admission policy.", double(st.rejections));
+    metric("timkv_entries", "gauge", "Live entries.", double(st.size));
+    metric("timkv_capacity", "gauge", "Entry limit, 0 when unbounded.", double(st.capacity));
+    metric("timkv_memory_bytes", "gauge", "Accounted bytes of the entries.", double(st.memory));
+    metric("timkv_max_memory_bytes", "gauge", "Memory budget, 0 when unbounded.", double(st.maxMemory));
+    metric("timkv_slab_bytes", "gauge", "Pages held by the entry allocators.", double(st.slabBytes));
+    metric("timkv_index_load_factor", "gauge", "Entries per index slot.",
+           st.indexCapacity ? double(st.size) / double(st.indexCapacity) : 0.0);
+    metric("timkv_rehashing_partitions", "gauge", "Partitions whose index is rehashing.", double(st.rehashing));
+    metric("timkv_compressed_total", "counter", "Values stored compressed.", double(m.count(metrics::Event::Compressed)));
+    metric("timkv_incompressible_total", "counter", "Values stored raw because compression saved too little.",
+           double(m.count(metrics::Event::Incompressible)));
+    metric("timkv_compress_in_bytes_total", "counter", "Raw bytes of the values stored compressed.",
+           double(m.count(metrics::Event::CompressedIn)));
+    metric("timkv_compress_out_bytes_total", "counter", "Stored bytes of the values stored compressed.",
+           double(m.count(metrics::Event::CompressedOut)));
+    if (nearCache) {
+        const auto nc = nearCache->stats();
+        metric("timkv_near_cache_hits_total", "counter", "Foreign reads served from the near cache.", double(nc.hits));
+        metric("timkv_near_cache_misses_total", "counter", "Foreign reads the near cache did not have.", double(nc.misses));
+        metric("timkv_near_cache_entries", "gauge", "Copies held in the near cache.", double(nc.entries));
+        metric("timkv_near_cache_invalidated_total", "counter", "Copies dropped on the owner's word.", double(nc.invalidated));
+        metric("timkv_near_cache_invalidations_sent_total", "counter", "Invalidations sent to other shards.",
+               double(nc.invalidationsSent));
+    }
+    if (replicationStats) {
+        const auto rs = replicationStats();
+        if (replica) {
+            metric("timkv_replica_synced", "gauge", "1 once the full sync is done and the stream followed.", rs.synced);
+            metric("timkv_replica_applied_total", "counter", "Commands applied from the primary.", double(rs.applied));
+            metric("timkv_replica_full_syncs_total", "counter", "Full syncs received.", double(rs.fullSyncs));
+        } else {
+            metric("timkv_replicas", "gauge", "Replicas being fed.", double(rs.replicas));
+            metric("timkv_replication_backlog_bytes", "gauge", "Mutations queued for replicas.", double(rs.backlogBytes));
+        }
+    }
+
+    out += "# HELP timkv_stage_seconds Time spent per request stage.\n# TYPE timkv_stage_seconds histogram\n";
+    for (size_t i = 0; i < metrics::kStages; ++i) {
+        const char *name = metrics::kStageNames[i];
+        const auto &h = m.stages[i].histogram;
+        for (int k = 7; k <= 35; ++k) {
+            std::snprintf(line, sizeof(line), "timkv_stage_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n", name,
+                          double(uint64_t(1) << k) / 1e9, static_cast<unsigned long long>(h.countAtMost((uint64_t(1) << k) - 1)));
+            out += line;
+        }
+        std::snprintf(line, sizeof(line),
+                      "timkv_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+                      "timkv_stage_seconds_sum{stage=\"%s\"} %.9g\n"
+                      "timkv_stage_seconds_count{stage=\"%s\"} %llu\n",
+                      name, static_cast<unsigned long long>(h.count()), name, double(m.stages[i].sumNs) / 1e9, name,
+                      static_cast<unsigned long long>(h.count()));
+        out += line;
+    }
+    response.contentType = "text/plain; version=0.0.4";
+    response.body = std::move(out);
+}
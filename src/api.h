@@ -0,0 +1,105 @@
+#pragma once
+#include <Poco/JSON/Object.h>
+
+#include <chrono>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hot_keys.h"
+#include "near_cache.h"
+#include "replication.h"
+#include "routing.h"
+#include "shard_client.h"
+#include "storage.h"
+
+struct ApiResponse {
+    int status = 200;
+    std::string contentType = "application/json";
+    std::string location;
+    std::string contentEncoding;  // set when the body is a value still compressed
+    std::string body;
+    SharedValue shared;  // a large value, sent as the body from the cache's buffer instead of `body`
+};
+
+// The JSON API (/get, /put, /delete, /mget, /mput, /mdelete, /stats, /hotkeys), the raw GET
+// /raw/<key> and the Prometheus /metrics, independent of the HTTP server that carries them, so the Poco and the libhv
+// frontends answer identically.
+class Api {
+public:
+    Api(KVstorage<std::string, std::string> *storage,
+        const std::vector<std::string> &shards,
+        int curr)
+        : storage(storage), shards(shards), ring(shards), curr(curr) {
+    }
+
+    bool hasRoute(const std::string &method, const std::string &uri) const;
+
+    // Serve foreign keys by forwarding them to the owner's RESP listener (shard i listens on
+    // respBasePort + i) over one pipelined connection per shard, instead of answering 307.
+    void enableProxy(int respBasePort);
+
+    // Adds the replication state to /stats and /metrics. A replica serves reads and answers writes
+    // with 307 to its primary, the shard's own address.
+    void enableReplication(std::function<ReplicationStats()> stats, bool replica);
+
+    // Serves /hotkeys from hotKeys. With a near cache (proxy routing), a foreign key read by /get,
+    // /raw or /mget is counted here too, and while it is hot it is served from the near cache,
+    // filled by NEARGET from its owner.
+    void enableHotKeys(HotKeys *hotKeys, NearCache *nearCache);
+
+    // acceptEncoding is the request's Accept-Encoding header: a value stored as zstd is sent as it
+    // is to a /raw client that accepts zstd.
+    void handle(const std::string &method, const std::string &uri, std::istream &body, ApiResponse &response,
+                std::string_view acceptEncoding = {});
+
+private:
+    KVstorage<std::string, std::string> *storage;
+    std::vector<std::string> shards;
+    ShardRing ring;
+    int curr;
+    std::vector<std::unique_ptr<ShardClient>> peers;
+    std::function<ReplicationStats()> replicationStats;
+    bool replica = false;
+    HotKeys *hotKeys = nullptr;
+    NearCache *nearCache = nullptr;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+    struct Foreign {
+        size_t shard;
+        std::string key;
+        std::string value;
+    };
+
+    bool redirectIfNeeded(const std::string &key, const std::string &uri, ApiResponse &response);
+    bool forwardIfNeeded(const std::string &uri, const Poco::JSON::Object::Ptr &request,
+                         Poco::JSON::Object::Ptr &result, ApiResponse &response);
+    // Sends `command key [value] [PX ttl]` for every foreign item, pipelined per shard.
+    std::vector<RespReply> forward(const std::vector<Foreign> &foreign, const char *command, bool withValue,
+                                   std::chrono::milliseconds ttl = std::chrono::milliseconds(0));
+
+    // GET of a foreign key from its owner, through the near cache when there is one.
+    RespReply fetch(size_t shard, const std::string &key);
+
+    void get(const Poco::JSON::Object::Ptr &request, Poco::JSON::Object::Ptr &result);
+    void put(const Poco::JSON::Object::Ptr &request, Poco::JSON::Object::Ptr &result);
+    void remove(const Poco::JSON::Object::Ptr &request, Poco::JSON::Object::Ptr &result);
+    void stats(Poco::JSON::Object::Ptr &result);
+    void prometheus(ApiResponse &response);
+    void hot(Poco::JSON::Object::Ptr &result);
+    // GET /raw/<percent-encoded key>: the value alone as application/octet-stream, without JSON
+    // escaping; 404 when missing. Foreign keys are forwarded or redirected as for /get.
+    void rawGet(const std::string &uri, ApiResponse &response, bool acceptsZstd);
+
+    // Batch requests serve the local keys and report the rest under "moved", grouped by the
+    // address of the owning shard, instead of failing the whole batch. In proxy mode foreign keys
+    // are forwarded and only those whose shard could not be reached end up in "moved".
+    void multiGet(const Poco::JSON::Object::Ptr &request, Poco::JSON::Object::Ptr &result);
+    void multiPut(const Poco::JSON::Object::Ptr &request, Poco::JSON::Object::Ptr &result);
+    void multiRemove(const Poco::JSON::Object::Ptr &request, Poco::JSON::Object::Ptr &result);
+    bool isLocal(const std::string &key, size_t &shard) const;
+    Poco::JSON::Object::Ptr groupByShard(const std::vector<const Foreign *> &items) const;
+};
@@ -1,20 +1,131 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <functional>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "slab.h"
+#include "value_buffer.h"
+
+struct CacheStats {
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t evictions = 0;
+    size_t expirations = 0;
+    size_t memory = 0;
+    size_t maxMemory = 0;
+    size_t rejections = 0;  // puts refused by an admission policy
+    size_t slabBytes = 0;   // pages held by the entry allocators
+    size_t indexCapacity = 0;  // slots of the index (both tables while it rehashes)
+    size_t rehashing = 0;      // indexes in the middle of an incremental rehash
+    std::vector<SlabClassStats> slabs;
+
+    CacheStats &operator+=(const CacheStats &other) {
+        size += other.size;
+        capacity += other.capacity;
+        evictions += other.evictions;
+        expirations += other.expirations;
+        memory += other.memory;
+        maxMemory += other.maxMemory;
+        rejections += other.rejections;
+        slabBytes += other.slabBytes;
+        indexCapacity += other.indexCapacity;
+        rehashing += other.rehashing;
+        if (slabs.size() < other.slabs.size()) slabs.resize(other.slabs.size());
+        for (size_t i = 0; i < other.slabs.size(); ++i) slabs[i] += other.slabs[i];
+        return *this;
+    }
+};
+
+// Per-entry state a snapshot keeps besides key and value.
+struct EntryMeta {
+    int64_t ttlMs = 0;  // time left to live
+    uint64_t freq = 0;  // LFU use count, 0 for policies that have none
+    Encoding encoding = Encoding::Raw;
+};
+
+// Receives a value in place: the bytes point into the cache and are only valid during the call,
+// unless the reader retains the buffer of a large value.
+using ValueVisitor = std::function<void(const ValueView &)>;
 
 template<typename Key, typename Value>
 class Cache {
 public:
-    virtual void put(const Key &key, const Value &value) = 0;
+    // Inserts or updates, evicting by policy first when the cache is full. The entry expires after
+    // ttl, or after the cache's default lifetime when ttl is zero. The encoding is kept with the
+    // entry and handed back with its value; the cache itself only sees bytes.
+    virtual void put(std::string_view key, std::string_view value, std::chrono::milliseconds ttl,
+                     Encoding encoding) = 0;
+
+    void put(std::string_view key, std::string_view value, std::chrono::milliseconds ttl) {
+        put(key, value, ttl, Encoding::Raw);
+    }
+
+    void put(std::string_view key, std::string_view value) {
+        put(key, value, std::chrono::milliseconds(0), Encoding::Raw);
+    }
+
+    virtual size_t remove(std::string_view key) = 0;
 
-    virtual size_t remove(const Key &key) = 0;
+    // Calls fn with the value on a hit and returns whether there was one.
+    virtual bool get(std::string_view key, const ValueVisitor &fn) = 0;
 
-    virtual std::optional<Value> get(const Key &key) = 0;
+    std::optional<Value> get(std::string_view key) {
+        std::optional<Value> value;
+        get(key, [&](const ValueView &v) { value.emplace(v.bytes); });
+        return value;
+    }
 
+    // True when read() may be called by several threads at once, with no other call running.
+    virtual bool sharedReads() const {
+        return false;
+    }
+
+    // get() for the shared case: leaves the index and the eviction order alone and queues the
+    // hit, which the next other call applies. drain is set once applying it is worth taking the
+    // lock exclusively for maintain().
+    virtual bool read(std::string_view, bool &drain, const ValueVisitor &) {
+        drain = false;
+        return false;
+    }
+
+    std::optional<Value> read(std::string_view key, bool &drain) {
+        std::optional<Value> value;
+        read(key, drain, [&](const ValueView &v) { value.emplace(v.bytes); });
+        return value;
+    }
+
+    virtual void maintain() {
+    }
+
+    // Drops one entry chosen by the eviction policy.
     virtual void evict() = 0;
 
-    virtual bool needEvict() =0;
+    // Removes at most `limit` expired entries.
+    virtual size_t expire(size_t limit) = 0;
 
     virtual size_t size() =0;
 
+    virtual CacheStats stats() = 0;
+
+    // Visits every live entry from the cold end to the hot end of the eviction order.
+    virtual void dump(const std::function<void(std::string_view, std::string_view, const EntryMeta &)> &fn) = 0;
+
+    // Inserts an entry read back from dump as the hottest one, so restoring a dump in order
+    // rebuilds the eviction order. Evicts first when full, like put.
+    virtual void restore(std::string_view key, std::string_view value, const EntryMeta &meta) = 0;
+
+    virtual void reserve(size_t n) = 0;
+
+    // Moves up to `limit` entries out of sparsely used allocator pages so the pages can be
+    // released; returns how many moved.
+    virtual size_t compact(size_t) {
+        return 0;
+    }
+
     virtual ~Cache() = default;
 };
@@ -0,0 +1,338 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "cache.h"
+#include "dict.h"
+#include "slab.h"
+#include "timer_wheel.h"
+
+// CLOCK approximation of LRU: entries sit in a ring of slots and a hit only sets the entry's
+// reference bit, so there is no list to reorder and no recency links per entry. To evict, the hand sweeps
+// the ring clearing set bits and takes the first entry found without one; the new entry goes into
+// the victim's slot, just behind the hand, so it gets a full turn before it is looked at. Since a
+// hit writes nothing but that bit, read() needs no queue. Entries live in slab chunks and are
+// expired through a timer wheel, as in LRUCache.
+template <typename Key, typename Value, template <class...> class Map = HashMap>
+class ClockCache : public Cache<Key, Value> {
+    static_assert(std::is_same_v<Key, std::string> && std::is_same_v<Value, std::string>,
+                  "entries keep their key and value as bytes inside a slab chunk");
+
+   public:
+    // capacity bounds the entry count and maxMemory the accounted bytes; 0 disables either.
+    explicit ClockCache(std::size_t capacity, int ttl_seconds, std::size_t maxMemory = 0)
+        : capacity(capacity), maxMemory(maxMemory), ttl(ttl_seconds) {
+        index.reserve(this->capacity);
+        ring.reserve(this->capacity);
+    }
+
+    ~ClockCache() override {
+        for (Node* n : ring)
+            if (n) release(n);
+    }
+
+    using Cache<Key, Value>::put;
+    using Cache<Key, Value>::get;
+    using Cache<Key, Value>::read;
+
+    void put(std::string_view key, std::string_view value, std::chrono::milliseconds lifetime,
+             Encoding encoding) override {
+        upsert(key, value, deadlineFor(lifetime), encoding);
+    }
+
+    std::size_t remove(std::string_view key) override {
+        if (auto it = index.get(key)) {
+            erase(*it);
+            return 1;
+        }
+        return 0;
+    }
+
+    bool get(std::string_view key, const ValueVisitor& fn) override {
+        auto it = index.get(key);
+        if (!it) return false;
+        Node* n = *it;
+        if (expired(n)) {
+            erase(n);
+            ++expirations;
+            return false;
+        }
+        n->referenced = 1;
+        fn(n->view());
+        return true;
+    }
+
+    bool sharedReads() const override {
+        return true;
+    }
+
+    // The bit is only stored when clear, so readers of a hot key don't keep writing its line.
+    bool read(std::string_view key, bool& drain, const ValueVisitor& fn) override {
+        drain = false;
+        auto it = index.find_ptr(key);
+        if (!it || expired(*it)) return false;
+        Node* n = *it;
+        std::atomic_ref<uint8_t> referenced(n->referenced);
+        if (!referenced.load(std::memory_order_relaxed)) referenced.store(1, std::memory_order_relaxed);
+        fn(n->view());
+        return true;
+    }
+
+    void evict() override {
+        if (index.size() == 0) return;
+        for (;; advance()) {
+            Node* n = ring[hand];
+            if (!n) continue;
+            if (n->referenced) {
+                n->referenced = 0;
+                continue;
+            }
+            advance();
+            erase(n);
+            ++evictions;
+            return;
+        }
+    }
+
+    std::size_t expire(std::size_t limit) override {
+        const std::size_t removed = wheel.advance(now(), limit, [&](TimerWheel::Node* t) { erase(nodeOf(t)); });
+        expirations += removed;
+        return removed;
+    }
+
+    std::size_t compact(std::size_t limit) override {
+        return slab.rebalance(limit, [&](void* from, void* to) {
+            relocate(static_cast<Node*>(from), static_cast<Node*>(to));
+        });
+    }
+
+    size_t size() override {
+        return index.size();
+    }
+
+    CacheStats stats() override {
+        CacheStats st;
+        st.size = index.size();
+        st.capacity = capacity;
+        st.evictions = evictions;
+        st.expirations = expirations;
+        st.memory = memory;
+        st.maxMemory = maxMemory;
+        st.slabs = slab.stats();
+        st.slabBytes = slab.bytes();
+        st.indexCapacity = index.capacity();
+        st.rehashing = index.rehash_in_progress();
+        return st;
+    }
+
+    // Ring order starting at the hand, which is the order the hand would reach them.
+    void dump(const std::function<void(std::string_view, std::string_view, const EntryMeta&)>& fn) override {
+        const int64_t t = now();
+        for (std::size_t i = 0; i < ring.size(); ++i) {
+            Node* n = ring[(hand + i) % ring.size()];
+            if (!n || n->timer.deadline <= t) continue;
+            fn(n->key(), n->value(), EntryMeta{n->timer.deadline - t, 0, Encoding(n->encoding)});
+        }
+    }
+
+    void restore(std::string_view key, std::string_view value, const EntryMeta& meta) override {
+        upsert(key, value, now() + meta.ttlMs, meta.encoding);
+    }
+
+    void reserve(std::size_t n) override {
+        index.reserve(n);
+        ring.reserve(n);
+    }
+
+   private:
+    struct Node {
+        TimerWheel::Node timer;  // first, so nodeOf() can cast back
+        uint32_t slot;
+        uint32_t keySize : 30;
+        uint32_t encoding : 2;  // an Encoding, handed out with the value
+        uint32_t valueSize;
+        uint8_t referenced;
+
+        char* bytes() {
+            return reinterpret_cast<char*>(this + 1);
+        }
+
+        std::string_view key() {
+            return {bytes(), keySize};
+        }
+
+        ValueView view() {
+            ValueView v = ValueSlot::load(bytes() + keySize, valueSize);
+            v.encoding = Encoding(encoding);
+            return v;
+        }
+
+        std::string_view value() {
+            return view().bytes;
+        }
+    };
+
+    SlabAllocator slab;
+    Map<std::string_view, Node*> index;
+    TimerWheel wheel;
+    std::vector<Node*> ring;             // null where an entry was removed
+    std::vector<uint32_t> holes;         // null slots of the ring, last freed on top
+    std::size_t hand = 0;
+    std::size_t capacity;
+    std::size_t maxMemory;
+    std::size_t memory = 0;
+    int ttl;
+    std::size_t evictions = 0;
+    std::size_t expirations = 0;
+
+    static constexpr std::size_t kInlineExpire = 16;
+
+    static int64_t now() {
+        return coarseNowMs();
+    }
+
+    int64_t deadlineFor(std::chrono::milliseconds lifetime) const {
+        return now() + (lifetime.count() > 0 ? lifetime.count() : int64_t(ttl) * 1000);
+    }
+
+    static Node* nodeOf(TimerWheel::Node* t) {
+        return reinterpret_cast<Node*>(t);
+    }
+
+    static std::size_t nodeBytes(std::size_t keySize, std::size_t valueSize) {
+        return sizeof(Node) + keySize + ValueSlot::bytes(valueSize);
+    }
+
+    // The chunk, a ring slot and an index entry (hash, key view, pointer, chain link, bucket slot).
+    std::size_t entryBytes(std::size_t keySize, std::size_t valueSize) const {
+        constexpr std::size_t indexBytes = sizeof(std::size_t) + sizeof(std::string_view) + 3 * sizeof(void*);
+        return slab.chunkSize(nodeBytes(keySize, valueSize)) + ValueSlot::outsideBytes(valueSize) + sizeof(Node*) + indexBytes;
+    }
+
+    bool expired(const Node* n) const {
+        return n->timer.deadline <= now();
+    }
+
+    void advance() {
+        if (++hand >= ring.size()) hand = 0;
+    }
+
+    Node* create(std::string_view key, std::string_view value, int64_t deadline, Encoding encoding) {
+        auto* n = static_cast<Node*>(slab.allocate(nodeBytes(key.size(), value.size())));
+        n->timer = TimerWheel::Node{nullptr, nullptr, deadline};
+        n->keySize = static_cast<uint32_t>(key.size());
+        n->valueSize = static_cast<uint32_t>(value.size());
+        n->encoding = uint32_t(encoding);
+        n->referenced = 0;
+        std::memcpy(n->bytes(), key.data(), key.size());
+        ValueSlot::store(n->bytes() + key.size(), value);
+        wheel.schedule(&n->timer);
+        return n;
+    }
+
+    void release(Node* n) {
+        ValueSlot::clear(n->bytes() + n->keySize, n->valueSize);
+        slab.deallocate(n, nodeBytes(n->keySize, n->valueSize));
+    }
+
+    // Into the most recently freed slot (the last victim's, right behind the hand, during a put
+    // that evicted), otherwise at the end of the ring.
+    void place(Node* n) {
+        if (!holes.empty()) {
+            n->slot = holes.back();
+            holes.pop_back();
+            ring[n->slot] = n;
+        } else {
+            n->slot = static_cast<uint32_t>(ring.size());
+            ring.push_back(n);
+        }
+        index.insert_or_assign(n->key(), n);
+    }
+
+    void upsert(std::string_view key, std::string_view value, int64_t deadline, Encoding encoding) {
+        if (auto it = index.get(key)) {
+            Node* n = *it;
+            const std::size_t oldBytes = entryBytes(n->keySize, n->valueSize);
+            const std::size_t chunk = slab.chunkSize(nodeBytes(n->keySize, n->valueSize));
+            if (slab.chunkSize(nodeBytes(key.size(), value.size())) == chunk) {
+                ValueSlot::clear(n->bytes() + n->keySize, n->valueSize);
+                ValueSlot::store(n->bytes() + n->keySize, value);
+                n->valueSize = static_cast<uint32_t>(value.size());
+                n->encoding = uint32_t(encoding);
+                wheel.reschedule(&n->timer, deadline);
+            } else {
+                wheel.cancel(&n->timer);
+                Node* moved = create(key, value, deadline, encoding);
+                moved->slot = n->slot;
+                ring[n->slot] = moved;
+                index.erase(n->key());
+                release(n);
+                index.insert_or_assign(moved->key(), moved);
+                n = moved;
+            }
+            n->referenced = 1;
+            memory = memory - oldBytes + entryBytes(n->keySize, n->valueSize);
+            while (maxMemory != 0 && memory > maxMemory && index.size() > 1) evictOther(n);
+        } else {
+            const std::size_t bytes = entryBytes(key.size(), value.size());
+            auto full = [&] {
+                return index.size() != 0 && ((capacity != 0 && index.size() >= capacity) ||
+                                             (maxMemory != 0 && memory + bytes > maxMemory));
+            };
+            // Room taken by expired entries goes first.
+            if (full()) expire(kInlineExpire);
+            while (full()) evict();
+            place(create(key, value, deadline, encoding));
+            memory += bytes;
+        }
+    }
+
+    // Evicts while keeping `keep`, the entry a put just grew.
+    void evictOther(Node* keep) {
+        keep->referenced = 1;
+        if (ring[hand] == keep) advance();
+        evict();
+    }
+
+    void erase(Node* n) {
+        memory -= entryBytes(n->keySize, n->valueSize);
+        wheel.cancel(&n->timer);
+        index.erase(n->key());
+        ring[n->slot] = nullptr;
+        holes.push_back(n->slot);
+        release(n);
+        if (holes.size() > 64 && holes.size() * 2 > ring.size()) shrink();
+    }
+
+    // Drops the holes once they are half the ring, keeping the order of the rest and the hand's
+    // position among them.
+    void shrink() {
+        std::size_t out = 0;
+        std::size_t newHand = 0;
+        for (std::size_t i = 0; i < ring.size(); ++i) {
+            if (i == hand) newHand = out;
+            if (!ring[i]) continue;
+            ring[out] = ring[i];
+            ring[out]->slot = static_cast<uint32_t>(out);
+            ++out;
+        }
+        ring.resize(out);
+        holes.clear();
+        hand = out == 0 ? 0 : newHand % out;
+    }
+
+    // The chunk at `from` was copied to `to` by the slab; repoint the ring and the index.
+    void relocate(Node* from, Node* to) {
+        wheel.relocated(&to->timer);
+        ring[to->slot] = to;
+        index.erase(from->key());
+        index.insert_or_assign(to->key(), to);
+    }
+};
@@ -0,0 +1,171 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#ifdef TIMKV_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef TIMKV_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "metrics.h"
+#include "value_buffer.h"
+
+// Value compression for KVstorage. A value of at least minBytes is compressed before the partition
+// lock is taken and kept compressed only when that saves an eighth or more; the entry records the
+// Encoding. Readers get raw bytes back, decompressed into a per-thread buffer, unless they accept
+// the stored encoding as it is. Stored forms:
+//   Lz4   u32 little-endian raw size | LZ4 block
+//   Zstd  a Zstandard frame (with its content size), valid as HTTP "Content-Encoding: zstd"
+// A codec is only available when built in (-DTIMKV_WITH_LZ4=ON, -DTIMKV_WITH_ZSTD=ON).
+class Codec {
+public:
+    struct Options {
+        Encoding algorithm = Encoding::Raw;  // Raw: compression off
+        size_t minBytes = 512;
+        int level = 3;  // Zstandard level; LZ4 has none
+    };
+
+    static bool available(Encoding encoding) {
+        switch (encoding) {
+            case Encoding::Raw:
+                return true;
+            case Encoding::Lz4:
+#ifdef TIMKV_WITH_LZ4
+                return true;
+#else
+                return false;
+#endif
+            case Encoding::Zstd:
+#ifdef TIMKV_WITH_ZSTD
+                return true;
+#else
+                return false;
+#endif
+        }
+        return false;
+    }
+
+    static const char *name(Encoding encoding) {
+        switch (encoding) {
+            case Encoding::Lz4:
+                return "lz4";
+            case Encoding::Zstd:
+                return "zstd";
+            default:
+                return "none";
+        }
+    }
+
+    Codec() = default;
+
+    explicit Codec(Options options) : options(options) {
+        if (!available(options.algorithm)) this->options.algorithm = Encoding::Raw;
+    }
+
+    bool enabled() const {
+        return options.algorithm != Encoding::Raw;
+    }
+
+    Encoding algorithm() const {
+        return options.algorithm;
+    }
+
+    // Returns how value should be stored: compressed into out, or Raw for value itself.
+    Encoding encode(std::string_view value, std::string &out) const {
+        if (!enabled() || value.size() < options.minBytes || value.size() > UINT32_MAX) return Encoding::Raw;
+        metrics::StageTimer timer;
+        const bool compressed = compress(value, out) && out.size() <= value.size() - value.size() / 8;
+        timer.lap(metrics::Stage::Compress);
+        if (!compressed) {
+            metrics::count(metrics::Event::Incompressible);
+            return Encoding::Raw;
+        }
+        metrics::count(metrics::Event::Compressed);
+        metrics::count(metrics::Event::CompressedIn, value.size());
+        metrics::count(metrics::Event::CompressedOut, out.size());
+        return options.algorithm;
+    }
+
+    // The raw bytes of a stored value: v itself when Raw, otherwise decompressed into a buffer of
+    // the calling thread that the next decode() on it overwrites.
+    static ValueView decode(const ValueView &v) {
+        if (v.encoding == Encoding::Raw) return v;
+        thread_local std::string out;
+        metrics::StageTimer timer;
+        const bool ok = decompress(v, out);
+        timer.lap(metrics::Stage::Decompress);
+        if (!ok) {
+            std::fprintf(stderr, "corrupt %s value of %zu bytes\n", name(v.encoding), v.bytes.size());
+            out.clear();
+        }
+        return ValueView{out, nullptr, Encoding::Raw};
+    }
+
+private:
+    Options options;
+
+    bool compress([[maybe_unused]] std::string_view value, [[maybe_unused]] std::string &out) const {
+        switch (options.algorithm) {
+#ifdef TIMKV_WITH_LZ4
+            case Encoding::Lz4: {
+                const int bound = LZ4_compressBound(static_cast<int>(value.size()));
+                if (bound <= 0) return false;
+                out.resize(4 + size_t(bound));
+                const uint32_t size = static_cast<uint32_t>(value.size());
+                std::memcpy(out.data(), &size, 4);
+                const int n = LZ4_compress_default(value.data(), out.data() + 4, static_cast<int>(value.size()), bound);
+                if (n <= 0) return false;
+                out.resize(4 + size_t(n));
+                return true;
+            }
+#endif
+#ifdef TIMKV_WITH_ZSTD
+            case Encoding::Zstd: {
+                thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx *)> cctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+                out.resize(ZSTD_compressBound(value.size()));
+                const size_t n = ZSTD_compressCCtx(cctx.get(), out.data(), out.size(), value.data(), value.size(), options.level);
+                if (ZSTD_isError(n)) return false;
+                out.resize(n);
+                return true;
+            }
+#endif
+            default:
+                return false;
+        }
+    }
+
+    static bool decompress(const ValueView &v, [[maybe_unused]] std::string &out) {
+        [[maybe_unused]] const std::string_view in = v.bytes;
+        switch (v.encoding) {
+#ifdef TIMKV_WITH_LZ4
+            case Encoding::Lz4: {
+                if (in.size() < 4) return false;
+                uint32_t size;
+                std::memcpy(&size, in.data(), 4);
+                out.resize(size);
+                const int n = LZ4_decompress_safe(in.data() + 4, out.data(), static_cast<int>(in.size() - 4),
+                                                  static_cast<int>(size));
+                return n >= 0 && uint32_t(n) == size;
+            }
+#endif
+#ifdef TIMKV_WITH_ZSTD
+            case Encoding::Zstd: {
+                thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+                const unsigned long long size = ZSTD_getFrameContentSize(in.data(), in.size());
+                if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR) return false;
+                out.resize(size);
+                const size_t n = ZSTD_decompressDCtx(dctx.get(), out.data(), out.size(), in.data(), in.size());
+                return !ZSTD_isError(n) && n == size;
+            }
+#endif
+            default:
+                return false;
+        }
+    }
+};
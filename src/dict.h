@@ -85,6 +85,15 @@ public:
         return false;
     }
 
+    // Lookup without a rehash step, so concurrent callers don't modify the map.
+    const V* find_ptr(const K& key) const {
+        const std::size_t h = hasher_(key);
+
+        if (Node* n = find_node_(ht_[0], h, key)) return &n->value;
+        if (is_rehashing_()) if (Node* n = find_node_(ht_[1], h, key)) return &n->value;
+        return nullptr;
+    }
+
     bool contains(const K& key) {
         rehash_step(move_per_op_);
         const std::size_t h = hasher_(key);
@@ -199,7 +208,7 @@ private:
 
     bool is_rehashing_() const   { return rehash_idx_ != -1; }
 
-    Node* find_node_(Table& t, std::size_t h, const K& key) const {
+    Node* find_node_(const Table& t, std::size_t h, const K& key) const {
         if (t.capacity() == 0) return nullptr;
         Node* n = t.buckets[h & t.mask];
         while (n) {
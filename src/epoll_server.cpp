@@ -0,0 +1,474 @@
+#include "epoll_server.h"
+
+#include <Poco/MemoryInputStream.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <utility>
+
+#include "metrics.h"
+
+namespace {
+
+constexpr size_t kMaxHead = 64 * 1024;
+constexpr size_t kMaxRequest = 512 * 1024 * 1024;
+constexpr size_t kMaxBatch = 1024 * 1024;  // responses held back for one write while more requests are read
+constexpr auto kAcceptPause = std::chrono::milliseconds(100);  // after accept ran out of descriptors or memory
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+const char *reasonPhrase(int status) {
+    switch (status) {
+        case 200:
+            return "OK";
+        case 307:
+            return "Temporary Redirect";
+        case 400:
+            return "Bad Request";
+        case 404:
+            return "Not Found";
+        case 413:
+            return "Content Too Large";
+        case 500:
+            return "Internal Server Error";
+        case 502:
+            return "Bad Gateway";
+        default:
+            return "";
+    }
+}
+
+}  // namespace
+
+HttpParser::Result HttpParser::parse(const char *data, size_t len, size_t &consumed, HttpRequestView &request) {
+    request = HttpRequestView{};
+    std::string_view buf(data, len);
+    // Empty lines ahead of a request line are ignored (RFC 9112, 2.2).
+    size_t start = 0;
+    while (buf.substr(start, 2) == "\r\n") start += 2;
+    const size_t headEnd = buf.find("\r\n\r\n", start);
+    if (headEnd == std::string_view::npos) return len - start > kMaxHead ? Result::Error : Result::Incomplete;
+
+    const std::string_view head = buf.substr(start, headEnd + 2 - start);
+    size_t eol = head.find("\r\n");
+    const std::string_view line = head.substr(0, eol);
+    const size_t sp1 = line.find(' ');
+    const size_t sp2 = sp1 == std::string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+    if (sp2 == std::string_view::npos || sp1 == 0 || sp2 == sp1 + 1) return Result::Error;
+    request.method = line.substr(0, sp1);
+    request.target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    const std::string_view version = line.substr(sp2 + 1);
+    if (version == "HTTP/1.1") {
+        request.keepAlive = true;
+    } else if (version == "HTTP/1.0") {
+        request.keepAlive = false;
+        request.http10 = true;
+    } else {
+        return Result::Error;
+    }
+
+    size_t length = 0;
+    bool expect = false;
+    for (size_t pos = eol + 2; pos < head.size(); pos = eol + 2) {
+        eol = head.find("\r\n", pos);
+        const std::string_view field = head.substr(pos, eol - pos);
+        const size_t colon = field.find(':');
+        if (colon == std::string_view::npos) return Result::Error;
+        const std::string_view name = field.substr(0, colon);
+        const std::string_view value = trim(field.substr(colon + 1));
+        if (equalsIgnoreCase(name, "Content-Length")) {
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+            if (ec != std::errc() || ptr != value.data() + value.size() || length > kMaxRequest) return Result::Error;
+        } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+            if (!equalsIgnoreCase(value, "identity")) return Result::Error;
+        } else if (equalsIgnoreCase(name, "Connection")) {
+            if (equalsIgnoreCase(value, "close")) request.keepAlive = false;
+            else if (equalsIgnoreCase(value, "keep-alive")) request.keepAlive = true;
+        } else if (equalsIgnoreCase(name, "Accept-Encoding")) {
+            request.acceptEncoding = value;
+        } else if (equalsIgnoreCase(name, "Expect")) {
+            expect = equalsIgnoreCase(value, "100-continue");
+        }
+    }
+
+    const size_t total = headEnd + 4 + length;
+    if (len < total) {
+        request.expectContinue = expect;
+        return Result::Incomplete;
+    }
+    request.body = buf.substr(headEnd + 4, length);
+    consumed = total;
+    return Result::Ok;
+}
+
+struct EpollServer::Loop {
+    int epfd = -1;
+    int listenFd = -1;
+    int wakeFd = -1;
+    std::thread thread;
+    std::unordered_set<Connection *> connections;
+
+    ~Loop() {
+        for (int fd : {epfd, listenFd, wakeFd})
+            if (fd >= 0) ::close(fd);
+    }
+};
+
+// The state of one connection, living in its coroutine's frame. The socket is watched edge
+// triggered for both directions from the start; the coroutine suspends in ready() and is resumed
+// by the next event, then retries whatever would have blocked.
+struct EpollServer::Connection {
+    Loop &loop;
+    int fd;
+    std::coroutine_handle<> waiting;
+    std::vector<char> in = std::vector<char>(16 * 1024);
+    size_t begin = 0;
+    size_t end = 0;
+    std::string out;
+    bool broken = false;
+
+    // A large value waiting in the responses: it goes out from its buffer, after out[0, offset).
+    struct Held {
+        size_t offset;
+        SharedValue value;
+    };
+    std::vector<Held> held;
+    size_t heldBytes = 0;
+    std::vector<iovec> iov;  // out and held, being written
+    size_t next = 0;         // first segment of iov not fully written
+
+    Connection(Loop &loop, int fd) : loop(loop), fd(fd) {
+        loop.connections.insert(this);
+    }
+
+    ~Connection() {
+        ::close(fd);
+        loop.connections.erase(this);
+    }
+
+    bool watch() {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = this;
+        return ::epoll_ctl(loop.epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+
+    auto ready() {
+        struct Awaiter {
+            Connection &c;
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> h) noexcept {
+                c.waiting = h;
+            }
+
+            void await_resume() const noexcept {
+            }
+        };
+        return Awaiter{*this};
+    }
+
+    // Moves unread bytes to the front, or grows the buffer; false if a request won't fit.
+    bool makeRoom() {
+        if (begin > 0) {
+            std::memmove(in.data(), in.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        } else if (in.size() < kMaxRequest) {
+            in.resize(std::min(in.size() * 2, kMaxRequest));
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    void respond(ApiResponse &response, bool keepAlive, bool http10 = false) {
+        const size_t length = response.shared ? response.shared.view().size() : response.body.size();
+        out += "HTTP/1.1 ";
+        out += std::to_string(response.status);
+        out += ' ';
+        out += reasonPhrase(response.status);
+        out += "\r\nContent-Type: ";
+        out += response.contentType;
+        out += "\r\nContent-Length: ";
+        out += std::to_string(length);
+        out += "\r\n";
+        if (!response.location.empty()) {
+            out += "Location: ";
+            out += response.location;
+            out += "\r\n";
+        }
+        if (!response.contentEncoding.empty()) {
+            out += "Content-Encoding: ";
+            out += response.contentEncoding;
+            out += "\r\n";
+        }
+        if (!keepAlive) out += "Connection: close\r\n";
+        else if (http10) out += "Connection: keep-alive\r\n";  // else a 1.0 client reads until EOF
+        out += "\r\n";
+        if (response.shared) {
+            heldBytes += length;
+            held.push_back(Held{out.size(), std::move(response.shared)});
+        } else {
+            out += response.body;
+        }
+    }
+
+    // Writes the pending responses: true once they are all out or the connection broke, false
+    // when the socket is full.
+    bool flush() {
+        if (iov.empty()) {
+            if (out.empty()) return true;
+            size_t from = 0;
+            for (const auto &h : held) {
+                const std::string_view value = h.value.view();
+                iov.push_back(iovec{out.data() + from, h.offset - from});
+                iov.push_back(iovec{const_cast<char *>(value.data()), value.size()});
+                from = h.offset;
+            }
+            iov.push_back(iovec{out.data() + from, out.size() - from});
+            next = 0;
+        }
+        while (next < iov.size()) {
+            msghdr msg{};
+            msg.msg_iov = iov.data() + next;
+            msg.msg_iovlen = std::min<size_t>(iov.size() - next, IOV_MAX);
+            metrics::StageTimer timer;
+            const ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+            timer.lap(metrics::Stage::Write);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+                broken = true;
+                break;
+            }
+            size_t left = size_t(n);
+            while (next < iov.size() && left >= iov[next].iov_len) left -= iov[next++].iov_len;
+            if (left > 0) {
+                iov[next].iov_base = static_cast<char *>(iov[next].iov_base) + left;
+                iov[next].iov_len -= left;
+            }
+        }
+        out.clear();
+        held.clear();
+        heldBytes = 0;
+        iov.clear();
+        return true;
+    }
+};
+
+EpollServer::EpollServer(Api *api, int port, int threads) : api(api), port(port), threads(std::max(threads, 1)) {
+}
+
+EpollServer::~EpollServer() {
+    stop();
+}
+
+bool EpollServer::start() {
+    for (int i = 0; i < threads; ++i) {
+        auto loop = std::make_unique<Loop>();
+        loop->epfd = ::epoll_create1(EPOLL_CLOEXEC);
+        loop->wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        loop->listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        epoll_event listenEv{};
+        listenEv.events = EPOLLIN;
+        listenEv.data.ptr = nullptr;
+        epoll_event wakeEv{};
+        wakeEv.events = EPOLLIN;
+        wakeEv.data.ptr = loop.get();
+        if (loop->epfd < 0 || loop->wakeFd < 0 || loop->listenFd < 0 ||
+            ::setsockopt(loop->listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+            ::setsockopt(loop->listenFd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+            ::bind(loop->listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            ::listen(loop->listenFd, SOMAXCONN) != 0 ||
+            ::epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->listenFd, &listenEv) != 0 ||
+            ::epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakeFd, &wakeEv) != 0) {
+            std::fprintf(stderr, "epoll frontend: cannot listen on port %d: %s\n", port, std::strerror(errno));
+            stop();
+            return false;
+        }
+        loops.push_back(std::move(loop));
+    }
+    for (auto &loop : loops) loop->thread = std::thread([this, l = loop.get()] { run(*l); });
+    return true;
+}
+
+void EpollServer::stop() {
+    for (auto &loop : loops) {
+        if (!loop->thread.joinable()) continue;
+        const uint64_t one = 1;
+        [[maybe_unused]] ssize_t n = ::write(loop->wakeFd, &one, sizeof(one));
+        loop->thread.join();
+    }
+    loops.clear();
+}
+
+void EpollServer::run(Loop &loop) {
+    epoll_event events[256];
+    bool running = true;
+    bool acceptPaused = false;
+    std::chrono::steady_clock::time_point acceptAgain;
+    while (running) {
+        int timeout = -1;
+        if (acceptPaused) {
+            const auto left = acceptAgain - std::chrono::steady_clock::now();
+            timeout = static_cast<int>(std::max<int64_t>(
+                0, std::chrono::ceil<std::chrono::milliseconds>(left).count()));
+        }
+        const int n = ::epoll_wait(loop.epfd, events, 256, timeout);
+        if (acceptPaused && std::chrono::steady_clock::now() >= acceptAgain) {
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = nullptr;
+            ::epoll_ctl(loop.epfd, EPOLL_CTL_MOD, loop.listenFd, &ev);
+            acceptPaused = false;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        // An fd appears once per batch and a coroutine only ever closes its own, so the
+        // connection behind each event is alive when its turn comes.
+        for (int i = 0; i < n; ++i) {
+            void *tag = events[i].data.ptr;
+            if (tag == &loop) {
+                running = false;
+            } else if (tag == nullptr) {
+                while (true) {
+                    const int fd = ::accept4(loop.listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd < 0) {
+                        if (errno == EINTR || errno == ECONNABORTED) continue;
+                        if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                            // The connection stays queued, so the level-triggered listening socket
+                            // would report it again at once: stop watching it for a while instead.
+                            epoll_event ev{};
+                            ev.data.ptr = nullptr;
+                            ::epoll_ctl(loop.epfd, EPOLL_CTL_MOD, loop.listenFd, &ev);
+                            acceptPaused = true;
+                            acceptAgain = std::chrono::steady_clock::now() + kAcceptPause;
+                        }
+                        break;
+                    }
+                    int one = 1;
+                    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    serve(loop, fd);
+                }
+            } else {
+                auto *c = static_cast<Connection *>(tag);
+                if (c->waiting) std::exchange(c->waiting, nullptr).resume();
+            }
+        }
+    }
+    // Every connection left is suspended; destroying its frame closes the socket.
+    std::vector<Connection *> live(loop.connections.begin(), loop.connections.end());
+    for (Connection *c : live) c->waiting.destroy();
+}
+
+EpollServer::Task EpollServer::serve(Loop &loop, int fd) {
+    Connection c(loop, fd);
+    if (!c.watch()) co_return;
+    HttpRequestView request;
+    bool open = true;
+    bool continued = false;  // 100 Continue sent for the request at c.begin
+    while (open) {
+        if (c.end == c.in.size() && !c.makeRoom()) {
+            ApiResponse tooLarge;
+            tooLarge.status = 413;
+            c.respond(tooLarge, false);
+            while (!c.flush()) co_await c.ready();
+            break;
+        }
+        const ssize_t n = ::read(fd, c.in.data() + c.end, c.in.size() - c.end);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            bool waited = false;
+            while (!c.flush()) {
+                co_await c.ready();
+                waited = true;
+            }
+            if (c.broken) break;
+            // Both directions share one edge-triggered registration: the event that ended a wait
+            // for the write may have been the read edge, so read again rather than wait for it.
+            if (!waited) co_await c.ready();
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0)
+                while (!c.flush()) co_await c.ready();
+            break;
+        }
+        const bool filled = size_t(n) == c.in.size() - c.end;
+        c.end += size_t(n);
+
+        while (open && c.begin < c.end) {
+            size_t consumed = 0;
+            const auto res = HttpParser::parse(c.in.data() + c.begin, c.end - c.begin, consumed, request);
+            if (res == HttpParser::Result::Incomplete) {
+                if (request.expectContinue && !continued) {
+                    c.out += "HTTP/1.1 100 Continue\r\n\r\n";
+                    continued = true;
+                }
+                break;
+            }
+            ApiResponse response;
+            if (res == HttpParser::Result::Error) {
+                response.status = 400;
+                c.respond(response, false);
+                open = false;
+                break;
+            }
+            continued = false;
+            const std::string method(request.method);
+            const std::string target(request.target);
+            try {
+                Poco::MemoryInputStream body(request.body.data(), request.body.size());
+                if (api->hasRoute(method, target)) api->handle(method, target, body, response, request.acceptEncoding);
+                else response.status = 404;
+            } catch (const std::exception &) {
+                response = ApiResponse{};
+                response.status = 500;
+            }
+            c.respond(response, request.keepAlive, request.http10);
+            c.begin += consumed;
+            open = request.keepAlive;
+        }
+        if (c.begin == c.end) c.begin = c.end = 0;
+
+        // A read that filled the buffer may have left more pipelined requests in the socket: their
+        // responses join this write.
+        if (open && filled && c.out.size() + c.heldBytes < kMaxBatch) continue;
+        while (!c.flush()) co_await c.ready();
+        if (c.broken) break;
+    }
+}
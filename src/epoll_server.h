@@ -0,0 +1,87 @@
+#pragma once
+#include <sys/uio.h>
+
+#include <coroutine>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "api.h"
+
+struct HttpRequestView {
+    std::string_view method;
+    std::string_view target;
+    std::string_view body;
+    std::string_view acceptEncoding;
+    bool keepAlive = true;
+    bool http10 = false;  // keep-alive then has to be confirmed in the response
+    bool expectContinue = false;  // set on an Incomplete result once the head is in
+};
+
+// Parses one HTTP/1.1 request with a Content-Length body (or none) straight out of the receive
+// buffer; the views stay valid until it is refilled. Chunked request bodies are not supported.
+class HttpParser {
+public:
+    enum class Result { Ok, Incomplete, Error };
+
+    static Result parse(const char *data, size_t len, size_t &consumed, HttpRequestView &request);
+};
+
+// Event-loop HTTP frontend on epoll and C++20 coroutines, without dependencies: `threads` loops,
+// each with its own epoll instance and its own SO_REUSEPORT listening socket, so the kernel spreads
+// connections over them. A connection is a coroutine that suspends whenever its socket would
+// block. Requests pipelined on it are run in order as soon as they are complete in the buffer, and
+// all the responses to one read go out in a single writev, large values from their cache buffers.
+// Handlers run on the loop: a forwarded key holds up that loop's other connections until its owner
+// answers.
+class EpollServer {
+public:
+    EpollServer(Api *api, int port, int threads);
+    ~EpollServer();
+
+    EpollServer(const EpollServer &) = delete;
+    EpollServer &operator=(const EpollServer &) = delete;
+
+    // False, with the reason on stderr, if the port can't be bound.
+    bool start();
+    void stop();
+
+private:
+    // A detached coroutine: it runs on its own once started and frees its frame when it returns.
+    struct Task {
+        struct promise_type {
+            Task get_return_object() noexcept {
+                return {};
+            }
+
+            std::suspend_never initial_suspend() noexcept {
+                return {};
+            }
+
+            std::suspend_never final_suspend() noexcept {
+                return {};
+            }
+
+            void return_void() noexcept {
+            }
+
+            void unhandled_exception() noexcept {
+                std::terminate();
+            }
+        };
+    };
+
+    struct Loop;
+    struct Connection;
+
+    Api *api;
+    int port;
+    int threads;
+    std::vector<std::unique_ptr<Loop>> loops;
+
+    void run(Loop &loop);
+    Task serve(Loop &loop, int fd);
+};
@@ -0,0 +1,347 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <optional>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Open-addressing drop-in for HashMap (dict.h). Slots live in one flat array split into groups
+// of 16; a parallel array of control bytes holds 7 bits of each slot's hash, so a lookup
+// compares a whole group with one SSE2 compare before touching any key. Growth keeps
+// HashMap's two-table scheme: every operation migrates at most move_per_op non-empty groups.
+template <class K, class V,
+          class Hasher = std::hash<K>,
+          class KeyEqual = std::equal_to<K>>
+class FlatHashMap {
+public:
+    explicit FlatHashMap(std::size_t initial_bucket_count = kGroup,
+                         double max_load = 0.875,
+                         std::size_t move_per_op = 1)
+        : hasher_(), eq_(),
+          max_load_factor_(clamp_load_(max_load)),
+          move_per_op_(move_per_op == 0 ? 1 : move_per_op),
+          size_(0),
+          rehash_idx_(-1)
+    {
+        init_table_(ht_[0], groups_for_(initial_bucket_count));
+    }
+
+    ~FlatHashMap() {
+        free_table_(ht_[0]);
+        free_table_(ht_[1]);
+    }
+
+    FlatHashMap(const FlatHashMap&) = delete;
+    FlatHashMap& operator=(const FlatHashMap&) = delete;
+    FlatHashMap(FlatHashMap&&) = delete;
+    FlatHashMap& operator=(FlatHashMap&&) = delete;
+
+    void insert_or_assign(const K& key, const V& value) {
+        rehash_step(move_per_op_);
+        const std::size_t h = hash_(key);
+
+        if (Slot* s = find_slot_(ht_[0], h, key)) { s->value = value; return; }
+        if (is_rehashing_()) if (Slot* s = find_slot_(ht_[1], h, key)) { s->value = value; return; }
+        emplace_new_(h, key, value);
+    }
+
+    bool insert(const K& key, const V& value) {
+        rehash_step(move_per_op_);
+        const std::size_t h = hash_(key);
+
+        if (find_slot_(ht_[0], h, key) || (is_rehashing_() && find_slot_(ht_[1], h, key)))
+            return false;
+        emplace_new_(h, key, value);
+        return true;
+    }
+
+    std::optional<V> get(const K& key) {
+        rehash_step(move_per_op_);
+        if (Slot* s = lookup_(key)) return s->value;
+        return std::nullopt;
+    }
+
+    bool find(const K& key, V& out) {
+        rehash_step(move_per_op_);
+        if (Slot* s = lookup_(key)) { out = s->value; return true; }
+        return false;
+    }
+
+    // Lookup without a rehash step, so concurrent callers don't modify the map.
+    const V* find_ptr(const K& key) const {
+        if (Slot* s = lookup_(key)) return &s->value;
+        return nullptr;
+    }
+
+    bool contains(const K& key) {
+        rehash_step(move_per_op_);
+        return lookup_(key) != nullptr;
+    }
+
+    bool erase(const K& key) {
+        rehash_step(move_per_op_);
+        const std::size_t h = hash_(key);
+
+        if (erase_from_(ht_[0], h, key)) { --size_; return true; }
+        if (is_rehashing_() && erase_from_(ht_[1], h, key)) { --size_; return true; }
+        return false;
+    }
+
+    void rehash_step(std::size_t steps = 1) {
+        if (!is_rehashing_()) return;
+        if (steps == 0) steps = 1;
+
+        std::size_t moved_non_empty = 0;
+        std::size_t empty_visits = steps * 10;
+        const std::size_t old_groups = ht_[0].groups();
+
+        while (rehash_idx_ < static_cast<long long>(old_groups) && moved_non_empty < steps) {
+            const std::size_t base = static_cast<std::size_t>(rehash_idx_) * kGroup;
+            std::uint32_t full = match_full_(ht_[0].ctrl + base);
+            ++rehash_idx_;
+            if (!full) {
+                if (--empty_visits == 0) break;
+                continue;
+            }
+            for (; full; full &= full - 1) {
+                const std::size_t i = base + std::countr_zero(full);
+                Slot& s = ht_[0].slots[i];
+                place_(ht_[1], s.hash, std::move(s.key), std::move(s.value));
+                s.~Slot();
+                // Tombstone rather than empty: other old-table entries may have probed past it.
+                ht_[0].ctrl[i] = kDeleted;
+            }
+            ++moved_non_empty;
+        }
+
+        if (rehash_idx_ >= static_cast<long long>(old_groups)) {
+            free_table_(ht_[0]);
+            ht_[0] = ht_[1];
+            ht_[1] = Table{};
+            rehash_idx_ = -1;
+        }
+    }
+
+    bool rehash_in_progress() const   { return is_rehashing_(); }
+    double load_factor() const   {
+        return ht_[0].capacity() ? double(size_) / double(capacity()) : 0.0;
+    }
+
+    std::size_t size() const   { return size_; }
+    std::size_t capacity() const   {
+        return ht_[0].capacity() + (is_rehashing_() ? ht_[1].capacity() : 0);
+    }
+
+    void clear() {
+        free_table_(ht_[0]);
+        free_table_(ht_[1]);
+        size_ = 0;
+        rehash_idx_ = -1;
+        init_table_(ht_[0], 1);
+    }
+
+    void reserve(std::size_t n_elems) {
+        const std::size_t need = groups_for_(std::size_t(double(n_elems) / max_load_factor_ + 0.999));
+        if (!is_rehashing_() && need > ht_[0].groups()) start_rehash_to_(need);
+    }
+
+    void set_max_load_factor(double f) {
+        max_load_factor_ = clamp_load_(f);
+        ht_[0].growth_limit = growth_limit_(ht_[0].capacity());
+        ht_[1].growth_limit = growth_limit_(ht_[1].capacity());
+    }
+    void set_move_per_op(std::size_t n) { move_per_op_ = (n == 0 ? 1 : n); }
+
+private:
+    static constexpr std::size_t kGroup = 16;
+    static constexpr std::int8_t kEmpty = -128;  // 0b10000000
+    static constexpr std::int8_t kDeleted = -2;  // 0b11111110, full slots are 0b0xxxxxxx
+
+    struct Slot {
+        std::size_t hash;
+        K key;
+        V value;
+    };
+
+    struct Table {
+        std::int8_t* ctrl = nullptr;
+        Slot* slots = nullptr;
+        std::size_t group_mask = 0;
+        std::size_t used = 0;  // full + deleted slots
+        std::size_t growth_limit = 0;
+
+        std::size_t groups() const   { return ctrl ? group_mask + 1 : 0; }
+        std::size_t capacity() const   { return groups() * kGroup; }
+    };
+
+    Hasher hasher_;
+    KeyEqual eq_;
+    double max_load_factor_;
+    std::size_t move_per_op_;
+    std::size_t size_;
+    Table ht_[2];
+    long long rehash_idx_;
+
+    static double clamp_load_(double f) {
+        if (f <= 0.0) return 0.875;
+        return f > 0.9375 ? 0.9375 : f;
+    }
+
+    static std::size_t next_pow2_(std::size_t x) {
+        if (x <= 1) return 1;
+        --x;
+        for (std::size_t i = 1; i < sizeof(std::size_t) * 8; i <<= 1) x |= x >> i;
+        return x + 1;
+    }
+
+    static std::size_t groups_for_(std::size_t slots) {
+        return next_pow2_((slots + kGroup - 1) / kGroup);
+    }
+
+    std::size_t growth_limit_(std::size_t cap) const {
+        return static_cast<std::size_t>(double(cap) * max_load_factor_);
+    }
+
+    // std::hash is the identity for integers, so spread the bits before splitting the hash into
+    // the group index (h1) and the control byte fingerprint (h2).
+    std::size_t hash_(const K& key) const {
+        std::uint64_t x = hasher_(key);
+        x ^= x >> 32;
+        x *= 0x9e3779b97f4a7c15ULL;
+        x ^= x >> 29;
+        return static_cast<std::size_t>(x);
+    }
+    static std::size_t h1_(std::size_t h) { return h >> 7; }
+    static std::int8_t h2_(std::size_t h) { return static_cast<std::int8_t>(h & 0x7f); }
+
+#if defined(__SSE2__)
+    static std::uint32_t match_(const std::int8_t* g, std::int8_t h2) {
+        const __m128i ctrl = _mm_load_si128(reinterpret_cast<const __m128i*>(g));
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl)));
+    }
+    static std::uint32_t match_empty_or_deleted_(const std::int8_t* g) {
+        const __m128i ctrl = _mm_load_si128(reinterpret_cast<const __m128i*>(g));
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(ctrl));
+    }
+#else
+    static std::uint32_t match_(const std::int8_t* g, std::int8_t h2) {
+        std::uint32_t m = 0;
+        for (std::size_t i = 0; i < kGroup; ++i) m |= std::uint32_t(g[i] == h2) << i;
+        return m;
+    }
+    static std::uint32_t match_empty_or_deleted_(const std::int8_t* g) {
+        std::uint32_t m = 0;
+        for (std::size_t i = 0; i < kGroup; ++i) m |= std::uint32_t(g[i] < 0) << i;
+        return m;
+    }
+#endif
+    static std::uint32_t match_empty_(const std::int8_t* g) { return match_(g, kEmpty); }
+    static std::uint32_t match_full_(const std::int8_t* g) { return ~match_empty_or_deleted_(g) & 0xffffu; }
+
+    void init_table_(Table& t, std::size_t groups) {
+        const std::size_t cap = groups * kGroup;
+        t.ctrl = static_cast<std::int8_t*>(::operator new(cap, std::align_val_t(kGroup)));
+        std::memset(t.ctrl, kEmpty, cap);
+        t.slots = static_cast<Slot*>(::operator new(cap * sizeof(Slot), std::align_val_t(alignof(Slot))));
+        t.group_mask = groups - 1;
+        t.used = 0;
+        t.growth_limit = growth_limit_(cap);
+    }
+
+    void free_table_(Table& t) {
+        if (!t.ctrl) return;
+        const std::size_t cap = t.capacity();
+        for (std::size_t i = 0; i < cap; ++i)
+            if (t.ctrl[i] >= 0) t.slots[i].~Slot();
+        ::operator delete(t.ctrl, std::align_val_t(kGroup));
+        ::operator delete(t.slots, std::align_val_t(alignof(Slot)));
+        t = Table{};
+    }
+
+    bool is_rehashing_() const   { return rehash_idx_ != -1; }
+
+    Slot* find_slot_(const Table& t, std::size_t h, const K& key) const {
+        if (!t.ctrl) return nullptr;
+        const std::int8_t h2 = h2_(h);
+        std::size_t g = h1_(h) & t.group_mask;
+        for (std::size_t probe = 1;; ++probe) {
+            const std::int8_t* ctrl = t.ctrl + g * kGroup;
+            for (std::uint32_t m = match_(ctrl, h2); m; m &= m - 1) {
+                Slot& s = t.slots[g * kGroup + std::countr_zero(m)];
+                if (s.hash == h && eq_(s.key, key)) return &s;
+            }
+            if (match_empty_(ctrl) || probe > t.group_mask) return nullptr;
+            g = (g + probe) & t.group_mask;
+        }
+    }
+
+    Slot* lookup_(const K& key) const {
+        const std::size_t h = hash_(key);
+        if (Slot* s = find_slot_(ht_[0], h, key)) return s;
+        if (is_rehashing_()) return find_slot_(ht_[1], h, key);
+        return nullptr;
+    }
+
+    template <class KK, class VV>
+    void place_(Table& t, std::size_t h, KK&& key, VV&& value) {
+        std::size_t g = h1_(h) & t.group_mask;
+        for (std::size_t probe = 1;; ++probe) {
+            if (std::uint32_t m = match_empty_or_deleted_(t.ctrl + g * kGroup)) {
+                const std::size_t i = g * kGroup + std::countr_zero(m);
+                if (t.ctrl[i] == kEmpty) ++t.used;
+                t.ctrl[i] = h2_(h);
+                new (&t.slots[i]) Slot{h, std::forward<KK>(key), std::forward<VV>(value)};
+                return;
+            }
+            g = (g + probe) & t.group_mask;
+        }
+    }
+
+    void emplace_new_(std::size_t h, const K& key, const V& value) {
+        if (is_rehashing_() && ht_[1].used >= ht_[1].growth_limit)
+            rehash_step(ht_[0].groups());
+
+        Table& t = is_rehashing_() ? ht_[1] : ht_[0];
+        place_(t, h, key, value);
+        ++size_;
+
+        if (!is_rehashing_()) maybe_expand_();
+    }
+
+    bool erase_from_(Table& t, std::size_t h, const K& key) {
+        Slot* s = find_slot_(t, h, key);
+        if (!s) return false;
+        const std::size_t i = static_cast<std::size_t>(s - t.slots);
+        s->~Slot();
+        // A group that still has an empty slot never made a probe move on, so the slot can be
+        // reused outright; otherwise leave a tombstone.
+        if (match_empty_(t.ctrl + (i & ~(kGroup - 1)))) {
+            t.ctrl[i] = kEmpty;
+            --t.used;
+        } else {
+            t.ctrl[i] = kDeleted;
+        }
+        return true;
+    }
+
+    void start_rehash_to_(std::size_t new_groups) {
+        if (is_rehashing_()) return;
+        init_table_(ht_[1], new_groups);
+        rehash_idx_ = 0;
+    }
+
+    void maybe_expand_() {
+        if (ht_[0].used <= ht_[0].growth_limit) return;
+        // Mostly tombstones: rebuild at the same size instead of doubling.
+        if (size_ * 2 <= ht_[0].growth_limit)
+            start_rehash_to_(ht_[0].groups());
+        else
+            start_rehash_to_(ht_[0].groups() * 2);
+    }
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// TinyLFU popularity estimate: a count-min sketch of 4-bit counters, four rows, sixteen counters
+// packed per 64-bit word. After sampleSize increments every counter is halved, so the estimate
+// follows the recent access history instead of growing forever.
+class FrequencySketch {
+public:
+    explicit FrequencySketch(size_t capacity) {
+        size_t words = 8;
+        while (words < capacity) words <<= 1;
+        table.assign(words, 0);
+        mask = words - 1;
+        sampleSize = 10 * (capacity ? capacity : words);
+    }
+
+    void increment(uint64_t hash) {
+        bool added = false;
+        for (int i = 0; i < 4; ++i) {
+            uint64_t h = spread(hash, i);
+            uint64_t &word = table[h & mask];
+            unsigned shift = unsigned(h >> 60) * 4;
+            if (((word >> shift) & 0xf) != 0xf) {
+                word += uint64_t(1) << shift;
+                added = true;
+            }
+        }
+        if (added && ++additions >= sampleSize) reset();
+    }
+
+    unsigned estimate(uint64_t hash) const {
+        unsigned freq = 0xf;
+        for (int i = 0; i < 4; ++i) {
+            uint64_t h = spread(hash, i);
+            unsigned count = unsigned(table[h & mask] >> (unsigned(h >> 60) * 4)) & 0xf;
+            if (count < freq) freq = count;
+        }
+        return freq;
+    }
+
+private:
+    std::vector<uint64_t> table;
+    size_t mask;
+    size_t additions = 0;
+    size_t sampleSize;
+
+    static uint64_t spread(uint64_t x, int row) {
+        static constexpr uint64_t seeds[4] = {
+            0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+        x = (x + seeds[row]) * 0x9e3779b97f4a7c15ULL;
+        x ^= x >> 29;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 32;
+        return x;
+    }
+
+    void reset() {
+        for (auto &word : table) word = (word >> 1) & 0x7777777777777777ULL;
+        additions /= 2;
+    }
+};
@@ -0,0 +1,101 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// XXH64 (https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md), seed 0 unless given.
+// Unlike std::hash its output is fixed across platforms and standard libraries, so servers and
+// clients written in other languages agree on where a key lives.
+namespace xxh64_detail {
+
+constexpr uint64_t P1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t P3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;  // little-endian hosts only, like the rest of the tree
+}
+
+inline uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t accumulate(uint64_t acc, uint64_t input) {
+    acc += input * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+}
+
+inline uint64_t merge(uint64_t acc, uint64_t val) {
+    acc ^= accumulate(0, val);
+    return acc * P1 + P4;
+}
+
+}  // namespace xxh64_detail
+
+inline uint64_t xxh64(const void *data, size_t len, uint64_t seed = 0) {
+    using namespace xxh64_detail;
+    const auto *p = static_cast<const unsigned char *>(data);
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + P1 + P2;
+        uint64_t v2 = seed + P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - P1;
+        do {
+            v1 = accumulate(v1, read64(p));
+            v2 = accumulate(v2, read64(p + 8));
+            v3 = accumulate(v3, read64(p + 16));
+            v4 = accumulate(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(h, v1);
+        h = merge(h, v2);
+        h = merge(h, v3);
+        h = merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+    h += len;
+
+    while (end - p >= 8) {
+        h ^= accumulate(0, read64(p));
+        h = rotl(h, 27) * P1 + P4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        h ^= uint64_t(read32(p)) * P1;
+        h = rotl(h, 23) * P2 + P3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * P5;
+        h = rotl(h, 11) * P1;
+        ++p;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+inline uint64_t xxh64(std::string_view s, uint64_t seed = 0) {
+    return xxh64(s.data(), s.size(), seed);
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Log-linear histogram in the manner of HdrHistogram: values below 128 are counted exactly,
+// larger ones in 64 buckets per power of two, so a reported percentile is at most 1/64 above the
+// true value. Recording is an index computation and an increment; the buckets are allocated once.
+class LatencyHistogram {
+public:
+    static constexpr int kSubBits = 7;
+    static constexpr size_t kHalf = size_t(1) << (kSubBits - 1);
+    static constexpr size_t kBuckets = (64 - kSubBits + 2) * kHalf;
+
+    LatencyHistogram() : counts(kBuckets, 0) {
+    }
+
+    void record(uint64_t value) {
+        ++counts[indexOf(value)];
+        ++total;
+        maxValue = std::max(maxValue, value);
+    }
+
+    // Adds n values that fell into bucket `index` (see indexOf), e.g. from a concurrent copy of
+    // the buckets.
+    void add(size_t index, uint64_t n) {
+        if (n == 0) return;
+        counts[index] += n;
+        total += n;
+        maxValue = std::max(maxValue, highestIn(index));
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < kBuckets; ++i) counts[i] += other.counts[i];
+        total += other.total;
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    void reset() {
+        std::fill(counts.begin(), counts.end(), 0);
+        total = 0;
+        maxValue = 0;
+    }
+
+    uint64_t count() const {
+        return total;
+    }
+
+    uint64_t max() const {
+        return maxValue;
+    }
+
+    // Upper bound of the bucket holding the p-th percentile (0 < p <= 100); 0 when empty.
+    uint64_t percentile(double p) const {
+        if (total == 0) return 0;
+        const uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(p / 100.0 * double(total))));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += counts[i];
+            if (seen >= rank) return std::min(highestIn(i), maxValue);
+        }
+        return maxValue;
+    }
+
+    // How many values were at most v; exact when v + 1 is a power of two.
+    uint64_t countAtMost(uint64_t v) const {
+        uint64_t n = 0;
+        for (size_t i = 0; i < kBuckets && highestIn(i) <= v; ++i) n += counts[i];
+        return n;
+    }
+
+    static constexpr size_t indexOf(uint64_t v) {
+        if (v < 2 * kHalf) return size_t(v);
+        const int shift = 63 - std::countl_zero(v) - (kSubBits - 1);
+        return size_t(shift) * kHalf + size_t(v >> shift);
+    }
+
+    static constexpr uint64_t highestIn(size_t i) {
+        if (i < 2 * kHalf) return i;
+        const int shift = int(i / kHalf) - 1;
+        const uint64_t mantissa = i % kHalf + kHalf;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+private:
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+};
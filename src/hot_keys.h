@@ -0,0 +1,275 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct StringViewHash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view s) const {
+        return std::hash<std::string_view>{}(s);
+    }
+};
+
+// Space-Saving top-k (Metwally, Agrawal, El Abbadi): `capacity` counters kept as a min-heap on
+// their count. A key without a counter takes over the smallest one and inherits its count as the
+// error, so the key's true count lies in [count - error, count], and any key with more than
+// total / capacity of the additions is sure to hold a counter.
+class SpaceSaving {
+public:
+    struct Counter {
+        std::string key;
+        uint64_t count = 0;
+        uint64_t error = 0;
+    };
+
+    explicit SpaceSaving(size_t capacity) : capacity(std::max<size_t>(capacity, 1)) {
+        heap.reserve(this->capacity);
+        slots.reserve(this->capacity);
+    }
+
+    void add(std::string_view key, uint64_t n = 1) {
+        auto it = slots.find(key);
+        if (it != slots.end()) {
+            heap[it->second].count += n;
+            down(it->second);
+            return;
+        }
+        if (heap.size() < capacity) {
+            heap.push_back(Counter{std::string(key), n, 0});
+            slots.emplace(heap.back().key, heap.size() - 1);
+            up(heap.size() - 1);
+            return;
+        }
+        Counter &min = heap.front();
+        slots.erase(min.key);
+        min.key.assign(key);
+        min.error = min.count;
+        min.count += n;
+        slots.emplace(min.key, 0);
+        down(0);
+    }
+
+    // Halves every count `times` times over, which keeps the heap order.
+    void decay(unsigned times = 1) {
+        if (times > 63) times = 63;
+        for (auto &c : heap) {
+            c.count >>= times;
+            c.error >>= times;
+        }
+    }
+
+    bool full() const {
+        return heap.size() == capacity;
+    }
+
+    // Bounds the count of any key without a counter.
+    uint64_t floor() const {
+        return full() ? heap.front().count : 0;
+    }
+
+    const std::vector<Counter> &counters() const {
+        return heap;
+    }
+
+private:
+    size_t capacity;
+    std::vector<Counter> heap;
+    std::unordered_map<std::string, size_t, StringViewHash, std::equal_to<>> slots;
+
+    void place(size_t i) {
+        slots.find(heap[i].key)->second = i;
+    }
+
+    void up(size_t i) {
+        while (i > 0 && heap[(i - 1) / 2].count > heap[i].count) {
+            std::swap(heap[(i - 1) / 2], heap[i]);
+            place(i);
+            i = (i - 1) / 2;
+        }
+        place(i);
+    }
+
+    void down(size_t i) {
+        while (true) {
+            size_t least = i;
+            for (size_t c = 2 * i + 1; c <= 2 * i + 2 && c < heap.size(); ++c)
+                if (heap[c].count < heap[least].count) least = c;
+            if (least == i) break;
+            std::swap(heap[least], heap[i]);
+            place(i);
+            i = least;
+        }
+        place(i);
+    }
+};
+
+// The keys read most on this node, for /hotkeys and the near cache. A thread counts one read in
+// sampleRate, weighted sampleRate, into one of kStripes sketches (picked per thread, each behind
+// its own mutex). A key is hot while the lower bound of its merged count reaches what
+// hotReadsPerSecond adds up to over a half-life. The hot set is read without a lock; a background
+// thread rebuilds it from the sketches every kRefresh and halves their counts once per halfLife
+// passed, idle or not, so the ranking follows the current traffic and no read pays for either.
+class HotKeys {
+public:
+    struct Options {
+        size_t counters = 256;  // per sketch
+        uint32_t sampleRate = 8;
+        std::chrono::milliseconds halfLife{5000};
+        uint64_t hotReadsPerSecond = 1000;
+    };
+
+    struct Key {
+        std::string key;
+        uint64_t count = 0;  // estimated reads, decayed; an upper bound
+        uint64_t error = 0;  // count - error is a lower bound
+        bool hot = false;
+    };
+
+    static constexpr size_t kStripes = 16;
+    static constexpr auto kRefresh = std::chrono::milliseconds(200);
+
+    explicit HotKeys(Options options)
+        : options(options),
+          hotCount(options.hotReadsPerSecond * static_cast<uint64_t>(options.halfLife.count()) / 1000),
+          hot(std::make_shared<const HotSet>()) {
+        if (this->options.sampleRate == 0) this->options.sampleRate = 1;
+        if (this->options.halfLife.count() <= 0) this->options.halfLife = std::chrono::milliseconds(5000);
+        for (auto &s : stripes) s = std::make_unique<Stripe>(this->options.counters);
+        refresher = std::thread([this] { run(); });
+    }
+
+    ~HotKeys() {
+        stop();
+    }
+
+    HotKeys(const HotKeys &) = delete;
+    HotKeys &operator=(const HotKeys &) = delete;
+
+    void record(std::string_view key) {
+        thread_local uint32_t tick = 0;
+        if (++tick < options.sampleRate) return;
+        tick = 0;
+        Stripe &s = *stripes[stripeIndex()];
+        std::lock_guard lock(s.mutex);
+        s.sketch.add(key, options.sampleRate);
+    }
+
+    bool isHot(std::string_view key) const {
+        const auto set = hot.load(std::memory_order_acquire);
+        return !set->empty() && set->find(key) != set->end();
+    }
+
+    // The n keys with the highest counts, merged over the sketches: a key missing from a full
+    // sketch may still have been read there up to that sketch's floor, which widens its error.
+    std::vector<Key> top(size_t n) const {
+        struct Merged {
+            uint64_t count = 0;
+            uint64_t error = 0;
+            uint64_t floors = 0;  // of the sketches that hold the key
+        };
+        std::unordered_map<std::string, Merged> merged;
+        uint64_t floors = 0;
+        for (const auto &s : stripes) {
+            std::lock_guard lock(s->mutex);
+            const uint64_t floor = s->sketch.floor();
+            floors += floor;
+            for (const auto &c : s->sketch.counters()) {
+                Merged &m = merged[c.key];
+                m.count += c.count;
+                m.error += c.error;
+                m.floors += floor;
+            }
+        }
+        std::vector<Key> keys;
+        keys.reserve(merged.size());
+        for (auto &[key, m] : merged) {
+            const uint64_t unseen = floors - m.floors;
+            Key k{key, m.count + unseen, m.error + unseen, false};
+            k.hot = k.count - k.error >= std::max<uint64_t>(hotCount, 1);
+            keys.push_back(std::move(k));
+        }
+        n = std::min(n, keys.size());
+        std::partial_sort(keys.begin(), keys.begin() + n, keys.end(),
+                          [](const Key &a, const Key &b) { return a.count > b.count; });
+        keys.resize(n);
+        return keys;
+    }
+
+    const Options &settings() const {
+        return options;
+    }
+
+    void stop() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (refresher.joinable()) refresher.join();
+    }
+
+private:
+    using HotSet = std::unordered_set<std::string, StringViewHash, std::equal_to<>>;
+
+    struct Stripe {
+        explicit Stripe(size_t counters) : sketch(counters) {
+        }
+
+        mutable std::mutex mutex;
+        SpaceSaving sketch;
+    };
+
+    Options options;
+    uint64_t hotCount;
+    std::unique_ptr<Stripe> stripes[kStripes];
+    std::atomic<std::shared_ptr<const HotSet>> hot;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread refresher;
+
+    static size_t stripeIndex() {
+        static std::atomic<size_t> threads{0};
+        thread_local const size_t index = threads.fetch_add(1, std::memory_order_relaxed) % kStripes;
+        return index;
+    }
+
+    void run() {
+        auto nextDecay = std::chrono::steady_clock::now() + options.halfLife;
+        std::unique_lock lock(mutex);
+        while (!wake.wait_for(lock, kRefresh, [this] { return stopping; })) {
+            lock.unlock();
+            const auto now = std::chrono::steady_clock::now();
+            if (now >= nextDecay) {
+                // A late wake-up still halves once for every half-life that went by.
+                const auto periods = (now - nextDecay) / options.halfLife + 1;
+                for (auto &s : stripes) {
+                    std::lock_guard stripeLock(s->mutex);
+                    s->sketch.decay(static_cast<unsigned>(std::min<int64_t>(periods, 63)));
+                }
+                nextDecay += periods * options.halfLife;
+            }
+            refresh();
+            lock.lock();
+        }
+    }
+
+    void refresh() {
+        auto set = std::make_shared<HotSet>();
+        for (auto &k : top(SIZE_MAX))
+            if (k.hot) set->insert(std::move(k.key));
+        hot.store(std::move(set), std::memory_order_release);
+    }
+};
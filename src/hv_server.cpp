@@ -0,0 +1,48 @@
+#include "hv_server.h"
+
+#include <Poco/MemoryStream.h>
+
+HvServer::HvServer(Api *api, int port, int threads) : api(api) {
+    auto handler = [this](HttpRequest *req, HttpResponse *resp) { return handle(req, resp); };
+    router.POST("/get", handler);
+    router.POST("/put", handler);
+    router.POST("/delete", handler);
+    router.POST("/mget", handler);
+    router.POST("/mput", handler);
+    router.POST("/mdelete", handler);
+    router.GET("/stats", handler);
+    router.GET("/hotkeys", handler);
+    router.GET("/raw/*", handler);
+    router.GET("/metrics", handler);
+    router.POST("/stats", handler);
+
+    server.registerHttpService(&router);
+    server.setPort(port);
+    server.setThreadNum(threads);
+}
+
+void HvServer::start() {
+    server.start();
+}
+
+void HvServer::stop() {
+    server.stop();
+}
+
+int HvServer::handle(HttpRequest *req, HttpResponse *resp) {
+    ApiResponse out;
+    Poco::MemoryInputStream body(req->body.data(), req->body.size());
+    api->handle(http_method_str(req->method), req->Path(), body, out, req->GetHeader("Accept-Encoding"));
+    resp->status_code = static_cast<http_status>(out.status);
+    if (!out.location.empty()) {
+        resp->SetHeader("Location", out.location);
+    }
+    resp->SetHeader("Content-Type", out.contentType);
+    if (!out.contentEncoding.empty()) {
+        resp->SetHeader("Content-Encoding", out.contentEncoding);
+    }
+    // libhv's response owns its body, so a shared value is copied into it.
+    if (out.shared) resp->body.assign(out.shared.view());
+    else resp->body = std::move(out.body);
+    return out.status;
+}
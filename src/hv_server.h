@@ -0,0 +1,23 @@
+#pragma once
+#ifdef TIMKV_WITH_LIBHV
+#include "hv/HttpServer.h"
+
+#include "api.h"
+
+// Event-loop HTTP frontend on libhv: `threads` worker threads each run their own epoll loop and
+// accept from the shared listening socket, so connections cost no thread of their own.
+class HvServer {
+public:
+    HvServer(Api *api, int port, int threads);
+
+    void start();
+    void stop();
+
+private:
+    Api *api;
+    hv::HttpService router;
+    hv::HttpServer server;
+
+    int handle(HttpRequest *req, HttpResponse *resp);
+};
+#endif
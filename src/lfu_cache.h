@@ -1,160 +1,462 @@
 #pragma once
 #include <chrono>
-#include <list>
-#include <optional>
-#include <unordered_set>
+#include <cstdint>
+#include <functional>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
 
 #include "cache.h"
 #include "dict.h"
+#include "frequency_sketch.h"
+#include "read_buffer.h"
+#include "slab.h"
+#include "timer_wheel.h"
 
-template <typename Key, typename Value>
+// Buckets of equal frequency form a list ordered by frequency; entries of a bucket form an
+// intrusive list ordered by arrival, so get/put/evict are O(1) without extra allocations and ties
+// are broken by LRU. With admission enabled a TinyLFU sketch keeps a new key out of a full cache
+// unless it has been requested more often than the entry it would displace. Entries live in slab
+// chunks together with their key and value bytes and are expired through a timer wheel, as in
+// LRUCache.
+template <typename Key, typename Value, template <class...> class Map = HashMap>
 class LFUCache : public Cache<Key, Value> {
+    static_assert(std::is_same_v<Key, std::string> && std::is_same_v<Value, std::string>,
+                  "entries keep their key and value as bytes inside a slab chunk");
+
    public:
-    explicit LFUCache(size_t capacity, int ttl_seconds)
-        : capacity(capacity), count(0), ttl(ttl_seconds) {
+    // capacity bounds the entry count and maxMemory the accounted bytes; 0 disables either.
+    explicit LFUCache(size_t capacity, int ttl_seconds, size_t maxMemory = 0, bool admission = false)
+        : capacity(capacity), maxMemory(maxMemory), count(0), ttl(ttl_seconds) {
         byKey.reserve(capacity);
+        if (admission) sketch = std::make_unique<FrequencySketch>(capacity ? capacity : 1 << 16);
     }
 
-    void put(const Key& key, const Value& value) override {
-        auto t = now();
-        auto exp = t + std::chrono::seconds(ttl);
+    using Cache<Key, Value>::put;
+    using Cache<Key, Value>::get;
+    using Cache<Key, Value>::read;
+
+    void put(std::string_view key, std::string_view value, std::chrono::milliseconds lifetime,
+             Encoding encoding) override {
+        applyReads();
+        const int64_t deadline = deadlineFor(lifetime);
+        if (sketch) sketch->increment(hashOf(key));
         if (auto it = byKey.get(key)) {
-            auto* item = *it;
-            item->value = value;
-            item->expiration = exp;
+            Node* item = replaceValue(*it, value, deadline, encoding);
             increment(item);
+            while (maxMemory != 0 && memory > maxMemory && count > 1) evictVictim(item);
         } else {
-            auto* item = new CacheItem{key, value, freqs.end(), exp};
-            byKey.insert_or_assign(key, item);
+            const size_t bytes = entryBytes(key.size(), value.size());
+            auto full = [&] {
+                return count != 0 && ((capacity != 0 && count >= capacity) ||
+                                      (maxMemory != 0 && memory + bytes > maxMemory));
+            };
+            // Room taken by expired entries goes first.
+            if (full()) expire(kInlineExpire);
+            if (full() && sketch && !admit(key)) {
+                ++rejections;
+                return;
+            }
+            while (full()) evict();
+            Node* item = create(key, value, deadline, encoding);
+            byKey.insert_or_assign(item->key(), item);
             ++count;
+            memory += bytes;
             increment(item);
         }
     }
 
-    std::optional<Value> get(const Key& key) override {
+    bool get(std::string_view key, const ValueVisitor& fn) override {
+        applyReads();
+        if (sketch) sketch->increment(hashOf(key));
         auto it = byKey.get(key);
-        if (!it) return std::nullopt;
+        if (!it) return false;
         auto* item = *it;
         if (expired(item)) {
-            remove(key);
-            return std::nullopt;
+            erase(item);
+            ++expirations;
+            return false;
         }
         increment(item);
-        return item->value;
+        fn(item->view());
+        return true;
     }
 
-    size_t remove(const Key& key) override {
+    bool sharedReads() const override {
+        return true;
+    }
+
+    // Misses are queued too while admission is on: the sketch counts requests, not hits.
+    bool read(std::string_view key, bool& drain, const ValueVisitor& fn) override {
+        auto it = byKey.find_ptr(key);
+        if (!it) {
+            if (sketch) drain = misses.record(hashOf(key));
+            return false;
+        }
+        Node* item = *it;
+        if (expired(item)) return false;
+        drain = hits.record(item);
+        fn(item->view());
+        return true;
+    }
+
+    void maintain() override {
+        applyReads();
+    }
+
+    size_t remove(std::string_view key) override {
+        applyReads();
         auto it = byKey.get(key);
         if (!it) return 0;
-        auto* item = *it;
-        auto freqIt = item->freqIter;
-        removeEntry(freqIt, item);
-        byKey.erase(key);
-        delete item;
-        --count;
+        erase(*it);
         return 1;
     }
 
-    bool needEvict() override {
-        return count > capacity;
+    void evict() override {
+        applyReads();
+        evictVictim(nullptr);
     }
 
-    void evict() override {
-        if (count == 0 || freqs.empty()) return;
+    size_t expire(size_t limit) override {
+        applyReads();
+        const size_t removed = wheel.advance(now(), limit, [&](TimerWheel::Node* t) { erase(nodeOf(t)); });
+        expirations += removed;
+        return removed;
+    }
 
-        auto freqIt = freqs.begin();
-        if (freqIt->entries.empty()) {
-            freqs.erase(freqIt);
-            return;
-        }
+    size_t size() override {
+        return count;
+    }
 
-        auto it = freqIt->entries.begin();
-        CacheItem* ci = *it;
+    size_t compact(size_t limit) override {
+        applyReads();
+        return slab.rebalance(limit, [&](void* from, void* to) {
+            relocate(static_cast<Node*>(from), static_cast<Node*>(to));
+        });
+    }
 
-        freqIt->entries.erase(it);
-        byKey.erase(ci->key);
-        delete ci;
-        --count;
+    CacheStats stats() override {
+        CacheStats st;
+        st.size = count;
+        st.capacity = capacity;
+        st.evictions = evictions;
+        st.expirations = expirations;
+        st.memory = memory;
+        st.maxMemory = maxMemory;
+        st.rejections = rejections;
+        st.slabs = slab.stats();
+        st.slabBytes = slab.bytes();
+        st.indexCapacity = byKey.capacity();
+        st.rehashing = byKey.rehash_in_progress();
+        return st;
+    }
 
-        if (freqIt->entries.empty()) {
-            freqs.erase(freqIt);
+    void dump(const std::function<void(std::string_view, std::string_view, const EntryMeta&)>& fn) override {
+        applyReads();
+        const int64_t t = now();
+        for (Bucket* b = buckets; b; b = b->next) {
+            for (Node* n = b->head; n; n = n->next) {
+                if (n->timer.deadline <= t) continue;
+                fn(n->key(), n->value(), EntryMeta{n->timer.deadline - t, b->freq, Encoding(n->encoding)});
+            }
         }
     }
 
-    size_t size() override {
-        return count;
+    // Admission is bypassed: the entry already earned its place before the snapshot.
+    void restore(std::string_view key, std::string_view value, const EntryMeta& meta) override {
+        applyReads();
+        const int64_t deadline = now() + meta.ttlMs;
+        if (auto it = byKey.get(key)) {
+            replaceValue(*it, value, deadline, meta.encoding);
+            return;
+        }
+        const size_t bytes = entryBytes(key.size(), value.size());
+        while (count != 0 && ((capacity != 0 && count >= capacity) || (maxMemory != 0 && memory + bytes > maxMemory)))
+            evict();
+        Node* item = create(key, value, deadline, meta.encoding);
+        byKey.insert_or_assign(item->key(), item);
+        ++count;
+        memory += bytes;
+        place(item, meta.freq ? meta.freq : 1);
+    }
+
+    void reserve(size_t n) override {
+        byKey.reserve(n);
     }
 
     ~LFUCache() override {
-        for (auto& f : freqs) {
-            for (auto* p : f.entries) delete p;
+        while (buckets) {
+            Bucket* b = buckets;
+            buckets = b->next;
+            for (Node* n = b->head; n;) {
+                Node* next = n->next;
+                release(n);
+                n = next;
+            }
+            delete b;
+        }
+        while (spare) {
+            Bucket* b = spare;
+            spare = b->next;
+            delete b;
         }
     }
 
    private:
-    struct CacheItem;
+    struct Bucket;
+
+    struct Node {
+        TimerWheel::Node timer;  // first, so nodeOf() can cast back
+        Node* prev;
+        Node* next;
+        Bucket* bucket;
+        uint32_t keySize : 30;
+        uint32_t encoding : 2;  // an Encoding, handed out with the value
+        uint32_t valueSize;
+
+        char* bytes() {
+            return reinterpret_cast<char*>(this + 1);
+        }
 
-    struct FrequencyItem {
-        int freq;
-        std::unordered_set<CacheItem*> entries;
+        std::string_view key() {
+            return {bytes(), keySize};
+        }
+
+        ValueView view() {
+            ValueView v = ValueSlot::load(bytes() + keySize, valueSize);
+            v.encoding = Encoding(encoding);
+            return v;
+        }
+
+        std::string_view value() {
+            return view().bytes;
+        }
     };
 
-    struct CacheItem {
-        Key key;
-        Value value;
-        typename std::list<FrequencyItem>::iterator freqIter;
-        std::chrono::steady_clock::time_point expiration;
+    struct Bucket {
+        uint64_t freq = 0;
+        Node* head = nullptr;
+        Node* tail = nullptr;
+        Bucket* prev = nullptr;
+        Bucket* next = nullptr;
     };
 
-    HashMap<Key, CacheItem*> byKey;
-    std::list<FrequencyItem> freqs;
+    SlabAllocator slab;
+    Map<std::string_view, Node*> byKey;
+    TimerWheel wheel;
+    Bucket* buckets = nullptr;  // lowest frequency first
+    Bucket* spare = nullptr;    // released buckets, reused before allocating
+    Bucket* placeHint = nullptr;
+    std::unique_ptr<FrequencySketch> sketch;
+    ReadBuffer<Node*> hits;         // from read(), not yet counted
+    ReadBuffer<uint64_t> misses;    // key hashes of read() misses, for the sketch
     size_t capacity;
+    size_t maxMemory;
+    size_t memory = 0;
     size_t count;
     int ttl;
+    size_t evictions = 0;
+    size_t expirations = 0;
+    size_t rejections = 0;
 
-    static std::chrono::steady_clock::time_point now() {
-        return std::chrono::steady_clock::now();
+    static constexpr size_t kInlineExpire = 16;
+
+    static int64_t now() {
+        return coarseNowMs();
+    }
+
+    int64_t deadlineFor(std::chrono::milliseconds lifetime) const {
+        return now() + (lifetime.count() > 0 ? lifetime.count() : int64_t(ttl) * 1000);
     }
 
-    bool expired(CacheItem* item) const {
-        return now() > item->expiration;
+    static Node* nodeOf(TimerWheel::Node* t) {
+        return reinterpret_cast<Node*>(t);
     }
 
-    void increment(CacheItem* item) {
-        auto curIt = item->freqIter;
-        int nextFreq = 1;
-        typename std::list<FrequencyItem>::iterator nextIt;
+    static uint64_t hashOf(std::string_view key) {
+        return std::hash<std::string_view>{}(key);
+    }
+
+    static size_t nodeBytes(size_t keySize, size_t valueSize) {
+        return sizeof(Node) + keySize + ValueSlot::bytes(valueSize);
+    }
 
-        if (curIt == freqs.end()) {
-            nextIt = freqs.begin();
+    // The chunk plus an index entry (hash, key view, pointer, chain link, bucket slot).
+    size_t entryBytes(size_t keySize, size_t valueSize) const {
+        constexpr size_t indexBytes = sizeof(size_t) + sizeof(std::string_view) + 3 * sizeof(void*);
+        return slab.chunkSize(nodeBytes(keySize, valueSize)) + ValueSlot::outsideBytes(valueSize) + indexBytes;
+    }
+
+    Node* create(std::string_view key, std::string_view value, int64_t deadline, Encoding encoding) {
+        auto* n = static_cast<Node*>(slab.allocate(nodeBytes(key.size(), value.size())));
+        n->timer = TimerWheel::Node{nullptr, nullptr, deadline};
+        n->prev = n->next = nullptr;
+        n->bucket = nullptr;
+        n->keySize = static_cast<uint32_t>(key.size());
+        n->valueSize = static_cast<uint32_t>(value.size());
+        n->encoding = uint32_t(encoding);
+        std::memcpy(n->bytes(), key.data(), key.size());
+        ValueSlot::store(n->bytes() + key.size(), value);
+        wheel.schedule(&n->timer);
+        return n;
+    }
+
+    void release(Node* n) {
+        ValueSlot::clear(n->bytes() + n->keySize, n->valueSize);
+        slab.deallocate(n, nodeBytes(n->keySize, n->valueSize));
+    }
+
+    // Overwrites the value in place when it fits the same chunk, otherwise moves the entry to a
+    // new chunk at the same position in its bucket. Returns the entry's node.
+    Node* replaceValue(Node* item, std::string_view value, int64_t deadline, Encoding encoding) {
+        memory -= entryBytes(item->keySize, item->valueSize);
+        const size_t chunk = slab.chunkSize(nodeBytes(item->keySize, item->valueSize));
+        if (slab.chunkSize(nodeBytes(item->keySize, value.size())) == chunk) {
+            ValueSlot::clear(item->bytes() + item->keySize, item->valueSize);
+            ValueSlot::store(item->bytes() + item->keySize, value);
+            item->valueSize = static_cast<uint32_t>(value.size());
+            item->encoding = uint32_t(encoding);
+            wheel.reschedule(&item->timer, deadline);
         } else {
-            nextFreq = curIt->freq + 1;
-            nextIt = std::next(curIt);
+            wheel.cancel(&item->timer);
+            Node* moved = create(item->key(), value, deadline, encoding);
+            moved->prev = item->prev;
+            moved->next = item->next;
+            moved->bucket = item->bucket;
+            relocate(item, moved);
+            release(item);
+            item = moved;
         }
+        memory += entryBytes(item->keySize, item->valueSize);
+        return item;
+    }
 
-        if (nextIt == freqs.end() || nextIt->freq != nextFreq) {
-            FrequencyItem node{nextFreq, {}};
-            if (curIt == freqs.end()) {
-                freqs.push_front(std::move(node));
-                nextIt = freqs.begin();
-            } else {
-                nextIt = freqs.insert(nextIt, std::move(node));
-            }
+    // `to` holds the entry of `from` (links included); repoint its neighbours, bucket and index.
+    void relocate(Node* from, Node* to) {
+        wheel.relocated(&to->timer);
+        if (to->prev) to->prev->next = to; else to->bucket->head = to;
+        if (to->next) to->next->prev = to; else to->bucket->tail = to;
+        byKey.erase(from->key());
+        byKey.insert_or_assign(to->key(), to);
+    }
+
+    bool expired(Node* item) const {
+        return item->timer.deadline <= now();
+    }
+
+    Node* victim(const Node* keep) const {
+        for (Bucket* b = buckets; b; b = b->next)
+            for (Node* n = b->head; n; n = n->next)
+                if (n != keep) return n;
+        return nullptr;
+    }
+
+    bool admit(std::string_view key) const {
+        Node* v = victim(nullptr);
+        return !v || sketch->estimate(hashOf(key)) > sketch->estimate(hashOf(v->key()));
+    }
+
+    void evictVictim(const Node* keep) {
+        if (Node* n = victim(keep)) {
+            erase(n);
+            ++evictions;
+        }
+    }
+
+    void erase(Node* item) {
+        unlink(item);
+        wheel.cancel(&item->timer);
+        byKey.erase(item->key());
+        memory -= entryBytes(item->keySize, item->valueSize);
+        release(item);
+        --count;
+    }
+
+    Bucket* newBucket(uint64_t freq) {
+        Bucket* b = spare;
+        if (b) {
+            spare = b->next;
+            *b = Bucket{};
+        } else {
+            b = new Bucket;
         }
+        b->freq = freq;
+        return b;
+    }
+
+    void releaseBucket(Bucket* b) {
+        if (b->prev) b->prev->next = b->next; else buckets = b->next;
+        if (b->next) b->next->prev = b->prev;
+        b->next = spare;
+        spare = b;
+    }
 
-        nextIt->entries.insert(item);
-        item->freqIter = nextIt;
+    void unlink(Node* item) {
+        Bucket* b = item->bucket;
+        if (item->prev) item->prev->next = item->next; else b->head = item->next;
+        if (item->next) item->next->prev = item->prev; else b->tail = item->prev;
+        item->prev = item->next = nullptr;
+        item->bucket = nullptr;
+        if (!b->head) releaseBucket(b);
+    }
 
-        if (curIt != freqs.end()) {
-            removeEntry(curIt, item);
+    // Appends an unlinked item to the bucket for freq. The search starts at the bucket used last,
+    // so restoring a dump, which comes in ascending frequency, finds its bucket in O(1).
+    void place(Node* item, uint64_t freq) {
+        Bucket* prev = (placeHint && placeHint->freq <= freq && placeHint->head) ? placeHint : nullptr;
+        Bucket* target = prev ? prev : buckets;
+        if (prev && prev->freq == freq) {
+            target = prev;
+        } else {
+            while (target && target->freq < freq) {
+                prev = target;
+                target = target->next;
+            }
+            if (!target || target->freq != freq) {
+                Bucket* b = newBucket(freq);
+                b->prev = prev;
+                b->next = target;
+                if (target) target->prev = b;
+                if (prev) prev->next = b; else buckets = b;
+                target = b;
+            }
         }
+        item->bucket = target;
+        item->prev = target->tail;
+        if (target->tail) target->tail->next = item; else target->head = item;
+        target->tail = item;
+        placeHint = target;
     }
 
-    void removeEntry(typename std::list<FrequencyItem>::iterator freqIt, CacheItem* item) {
-        auto& entries = freqIt->entries;
-        entries.erase(item);
-        if (entries.empty()) {
-            freqs.erase(freqIt);
+    // Every call that can free or move a node starts here, so the queued pointers are still live.
+    void applyReads() {
+        hits.drain([&](Node* item) {
+            if (sketch) sketch->increment(hashOf(item->key()));
+            increment(item);
+        });
+        if (sketch) misses.drain([&](uint64_t h) { sketch->increment(h); });
+    }
+
+    void increment(Node* item) {
+        Bucket* cur = item->bucket;
+        const uint64_t nextFreq = cur ? cur->freq + 1 : 1;
+        Bucket* target = cur ? cur->next : buckets;
+
+        if (!target || target->freq != nextFreq) {
+            Bucket* b = newBucket(nextFreq);
+            b->prev = cur;
+            b->next = target;
+            if (target) target->prev = b;
+            if (cur) cur->next = b; else buckets = b;
+            target = b;
         }
+
+        if (cur) unlink(item);
+        item->bucket = target;
+        item->prev = target->tail;
+        if (target->tail) target->tail->next = item; else target->head = item;
+        target->tail = item;
     }
-};
\ No newline at end of file
+};
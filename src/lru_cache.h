@@ -1,102 +1,315 @@
 #pragma once
 #include <chrono>
 #include <cstddef>
-#include <list>
-#include <optional>
-#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
 
 #include "cache.h"
 #include "dict.h"
+#include "read_buffer.h"
+#include "slab.h"
+#include "timer_wheel.h"
 
-template <typename Key, typename Value>
+// Every entry is one slab chunk: its timer, list links and the key and value bytes (a large value
+// by reference, see ValueSlot). The index maps a view of the key inside the chunk to the chunk,
+// so a put costs one chunk and one index slot, both taken from free lists most of the time.
+// Expired entries are found through a timer wheel rather than by scanning.
+template <typename Key, typename Value, template <class...> class Map = HashMap>
 class LRUCache : public Cache<Key, Value> {
+    static_assert(std::is_same_v<Key, std::string> && std::is_same_v<Value, std::string>,
+                  "entries keep their key and value as bytes inside a slab chunk");
+
    public:
-    explicit LRUCache(std::size_t capacity, int ttl_seconds)
-        : capacity(capacity), ttl(ttl_seconds) {
+    // capacity bounds the entry count and maxMemory the accounted bytes; 0 disables either.
+    explicit LRUCache(std::size_t capacity, int ttl_seconds, std::size_t maxMemory = 0)
+        : capacity(capacity), maxMemory(maxMemory), ttl(ttl_seconds) {
         index.reserve(this->capacity);
     }
 
-    void put(const Key& key, const Value& value) override {
-        auto t = now();
-        auto exp = t + std::chrono::seconds(ttl);
-        if (auto it = index.get(key)) {
-            auto li = *it;
-            li->second.value = value;
-            li->second.expiration = exp;
-            touch(li);
-        } else {
-            lru.emplace_front(key, Item{value, exp});
-            index.insert_or_assign(key, lru.begin());
+    ~LRUCache() override {
+        for (Node* n = head; n;) {
+            Node* next = n->next;
+            release(n);
+            n = next;
         }
     }
 
-    std::size_t remove(const Key& key) override {
+    using Cache<Key, Value>::put;
+    using Cache<Key, Value>::get;
+    using Cache<Key, Value>::read;
+
+    void put(std::string_view key, std::string_view value, std::chrono::milliseconds lifetime,
+             Encoding encoding) override {
+        upsert(key, value, deadlineFor(lifetime), encoding);
+    }
+
+    std::size_t remove(std::string_view key) override {
+        applyReads();
         if (auto it = index.get(key)) {
-            auto li = *it;
-            lru.erase(li);
-            index.erase(key);
+            erase(*it);
             return 1;
         }
         return 0;
     }
 
-    std::optional<Value> get(const Key& key) override {
+    bool get(std::string_view key, const ValueVisitor& fn) override {
+        applyReads();
         auto it = index.get(key);
-        if (!it) return std::nullopt;
-        auto li = *it;
-        auto& item = li->second;
-        if (expired(item)) {
-            lru.erase(li);
-            index.erase(key);
-            return std::nullopt;
+        if (!it) return false;
+        Node* n = *it;
+        if (expired(n)) {
+            erase(n);
+            ++expirations;
+            return false;
         }
-        touch(li);
-        return item.value;
+        touch(n);
+        fn(n->view());
+        return true;
+    }
+
+    bool sharedReads() const override {
+        return true;
+    }
+
+    // An expired entry is reported missing but left for the next exclusive call to erase.
+    bool read(std::string_view key, bool& drain, const ValueVisitor& fn) override {
+        auto it = index.find_ptr(key);
+        if (!it || expired(*it)) return false;
+        Node* n = *it;
+        drain = reads.record(n);
+        fn(n->view());
+        return true;
+    }
+
+    void maintain() override {
+        applyReads();
     }
 
     void evict() override {
-        while (!lru.empty()) {
-            auto& last = lru.back();
-            if (expired(last.second)) {
-                index.erase(last.first);
-                lru.pop_back();
-            } else {
-                break;
-            }
-        }
+        applyReads();
+        if (!tail) return;
+        erase(tail);
+        ++evictions;
+    }
+
+    std::size_t expire(std::size_t limit) override {
+        applyReads();
+        const std::size_t removed = wheel.advance(now(), limit, [&](TimerWheel::Node* t) { erase(nodeOf(t)); });
+        expirations += removed;
+        return removed;
     }
 
-    bool needEvict() override {
-        return index.size() > capacity;
+    std::size_t compact(std::size_t limit) override {
+        applyReads();
+        return slab.rebalance(limit, [&](void* from, void* to) {
+            relocate(static_cast<Node*>(from), static_cast<Node*>(to));
+        });
     }
 
     size_t size() override {
         return index.size();
     }
 
+    CacheStats stats() override {
+        CacheStats st;
+        st.size = index.size();
+        st.capacity = capacity;
+        st.evictions = evictions;
+        st.expirations = expirations;
+        st.memory = memory;
+        st.maxMemory = maxMemory;
+        st.slabs = slab.stats();
+        st.slabBytes = slab.bytes();
+        st.indexCapacity = index.capacity();
+        st.rehashing = index.rehash_in_progress();
+        return st;
+    }
+
+    void dump(const std::function<void(std::string_view, std::string_view, const EntryMeta&)>& fn) override {
+        applyReads();
+        const int64_t t = now();
+        for (Node* n = tail; n; n = n->prev) {
+            if (n->timer.deadline <= t) continue;
+            fn(n->key(), n->value(), EntryMeta{n->timer.deadline - t, 0, Encoding(n->encoding)});
+        }
+    }
+
+    void restore(std::string_view key, std::string_view value, const EntryMeta& meta) override {
+        upsert(key, value, now() + meta.ttlMs, meta.encoding);
+    }
+
+    void reserve(std::size_t n) override {
+        index.reserve(n);
+    }
+
    private:
-    struct Item {
-        Value value;
-        std::chrono::steady_clock::time_point expiration;
+    struct Node {
+        TimerWheel::Node timer;  // first, so nodeOf() can cast back
+        Node* prev;
+        Node* next;
+        uint32_t keySize : 30;
+        uint32_t encoding : 2;  // an Encoding, handed out with the value
+        uint32_t valueSize;
+
+        char* bytes() {
+            return reinterpret_cast<char*>(this + 1);
+        }
+
+        std::string_view key() {
+            return {bytes(), keySize};
+        }
+
+        ValueView view() {
+            ValueView v = ValueSlot::load(bytes() + keySize, valueSize);
+            v.encoding = Encoding(encoding);
+            return v;
+        }
+
+        std::string_view value() {
+            return view().bytes;
+        }
     };
 
-    using ListNode = std::pair<Key, Item>;
-    using ListIt = typename std::list<ListNode>::iterator;
+    static constexpr std::size_t kInlineExpire = 16;
 
-    std::list<ListNode> lru;
-    HashMap<Key, ListIt> index;
+    SlabAllocator slab;
+    Map<std::string_view, Node*> index;
+    TimerWheel wheel;
+    Node* head = nullptr;  // most recently used
+    Node* tail = nullptr;
+    ReadBuffer<Node*> reads;  // hits from read(), not yet moved to the front
     std::size_t capacity;
+    std::size_t maxMemory;
+    std::size_t memory = 0;
     int ttl;
+    std::size_t evictions = 0;
+    std::size_t expirations = 0;
+
+    static int64_t now() {
+        return coarseNowMs();
+    }
+
+    int64_t deadlineFor(std::chrono::milliseconds lifetime) const {
+        return now() + (lifetime.count() > 0 ? lifetime.count() : int64_t(ttl) * 1000);
+    }
+
+    static Node* nodeOf(TimerWheel::Node* t) {
+        return reinterpret_cast<Node*>(t);
+    }
+
+    static std::size_t nodeBytes(std::size_t keySize, std::size_t valueSize) {
+        return sizeof(Node) + keySize + ValueSlot::bytes(valueSize);
+    }
+
+    // The chunk plus an index entry (hash, key view, pointer, chain link, bucket slot).
+    std::size_t entryBytes(std::size_t keySize, std::size_t valueSize) const {
+        constexpr std::size_t indexBytes = sizeof(std::size_t) + sizeof(std::string_view) + 3 * sizeof(void*);
+        return slab.chunkSize(nodeBytes(keySize, valueSize)) + ValueSlot::outsideBytes(valueSize) + indexBytes;
+    }
+
+    bool expired(const Node* n) const {
+        return n->timer.deadline <= now();
+    }
+
+    Node* create(std::string_view key, std::string_view value, int64_t deadline, Encoding encoding) {
+        auto* n = static_cast<Node*>(slab.allocate(nodeBytes(key.size(), value.size())));
+        n->timer = TimerWheel::Node{nullptr, nullptr, deadline};
+        n->prev = n->next = nullptr;
+        n->keySize = static_cast<uint32_t>(key.size());
+        n->valueSize = static_cast<uint32_t>(value.size());
+        n->encoding = uint32_t(encoding);
+        std::memcpy(n->bytes(), key.data(), key.size());
+        ValueSlot::store(n->bytes() + key.size(), value);
+        wheel.schedule(&n->timer);
+        return n;
+    }
+
+    void release(Node* n) {
+        ValueSlot::clear(n->bytes() + n->keySize, n->valueSize);
+        slab.deallocate(n, nodeBytes(n->keySize, n->valueSize));
+    }
+
+    void upsert(std::string_view key, std::string_view value, int64_t deadline, Encoding encoding) {
+        applyReads();
+        if (auto it = index.get(key)) {
+            Node* n = *it;
+            const std::size_t oldBytes = entryBytes(n->keySize, n->valueSize);
+            const std::size_t chunk = slab.chunkSize(nodeBytes(n->keySize, n->valueSize));
+            if (slab.chunkSize(nodeBytes(key.size(), value.size())) == chunk) {
+                ValueSlot::clear(n->bytes() + n->keySize, n->valueSize);
+                ValueSlot::store(n->bytes() + n->keySize, value);
+                n->valueSize = static_cast<uint32_t>(value.size());
+                n->encoding = uint32_t(encoding);
+                wheel.reschedule(&n->timer, deadline);
+                touch(n);
+            } else {
+                unlink(n);
+                wheel.cancel(&n->timer);
+                index.erase(n->key());
+                release(n);
+                n = create(key, value, deadline, encoding);
+                pushFront(n);
+                index.insert_or_assign(n->key(), n);
+            }
+            memory = memory - oldBytes + entryBytes(n->keySize, n->valueSize);
+            while (maxMemory != 0 && memory > maxMemory && index.size() > 1) evict();
+        } else {
+            const std::size_t bytes = entryBytes(key.size(), value.size());
+            auto full = [&] {
+                return tail && ((capacity != 0 && index.size() >= capacity) ||
+                                (maxMemory != 0 && memory + bytes > maxMemory));
+            };
+            // Room taken by expired entries goes first.
+            if (full()) expire(kInlineExpire);
+            while (full()) evict();
+            Node* n = create(key, value, deadline, encoding);
+            pushFront(n);
+            index.insert_or_assign(n->key(), n);
+            memory += bytes;
+        }
+    }
+
+    void erase(Node* n) {
+        memory -= entryBytes(n->keySize, n->valueSize);
+        unlink(n);
+        wheel.cancel(&n->timer);
+        index.erase(n->key());
+        release(n);
+    }
+
+    // The chunk at `from` was copied to `to` by the slab; repoint the list and the index.
+    void relocate(Node* from, Node* to) {
+        wheel.relocated(&to->timer);
+        if (to->prev) to->prev->next = to; else head = to;
+        if (to->next) to->next->prev = to; else tail = to;
+        index.erase(from->key());
+        index.insert_or_assign(to->key(), to);
+    }
+
+    void pushFront(Node* n) {
+        n->prev = nullptr;
+        n->next = head;
+        if (head) head->prev = n; else tail = n;
+        head = n;
+    }
 
-    static std::chrono::steady_clock::time_point now() {
-        return std::chrono::steady_clock::now();
+    void unlink(Node* n) {
+        if (n->prev) n->prev->next = n->next; else head = n->next;
+        if (n->next) n->next->prev = n->prev; else tail = n->prev;
+        n->prev = n->next = nullptr;
     }
 
-    bool expired(const Item& item) const {
-        return now() > item.expiration;
+    // Every call that can free or move a node starts here, so the queued pointers are still live.
+    void applyReads() {
+        reads.drain([&](Node* n) { touch(n); });
     }
 
-    void touch(ListIt li) {
-        lru.splice(lru.begin(), lru, li);
+    void touch(Node* n) {
+        if (head == n) return;
+        unlink(n);
+        pushFront(n);
     }
-};
\ No newline at end of file
+};
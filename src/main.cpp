@@ -5,24 +5,67 @@
 #include <Poco/Net/HTTPRequestHandlerFactory.h>
 #include <Poco/Net/HTTPServer.h>
 #include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/TCPServer.h>
 #include <pthread.h>
 
+#include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <cstdio>
 #include <fstream>
+#include <memory>
+#include <thread>
 #include <string>
 #include <vector>
 
+#include "aof.h"
+#include "api.h"
+#include "clock_cache.h"
+#include "epoll_server.h"
+#include "flat_dict.h"
+#include "hv_server.h"
 #include "lfu_cache.h"
 #include "lru_cache.h"
+#include "hot_keys.h"
+#include "metrics.h"
+#include "near_cache.h"
 #include "network.h"
+#include "replication.h"
+#include "resp.h"
 #include "storage.h"
 
 struct Config {
     std::vector<std::string> shards;
+    std::vector<std::vector<std::string>> replicas;  // HTTP addresses of each shard's replicas
     std::size_t capacity = 1000;
     std::string algo = "lru";
     int ttl = 3600;
+    std::size_t partitions = 1;
+    std::string dict = "chained";
+    int reaperIntervalMs = 1000;
+    bool slabRebalance = false;
+    std::size_t maxMemory = 0;
+    std::string admission = "none";
+    int respPort = 0;
+    std::string frontend = "poco";
+    int ioThreads = 0;
+    std::string routing = "redirect";
+    std::string snapshotPath;
+    int snapshotIntervalMs = 60000;
+    std::string aofPath;
+    std::string aofFsync = "interval";
+    int aofFsyncIntervalMs = 1000;
+    std::size_t aofRewriteMinBytes = 64 << 20;
+    bool metrics = true;
+    std::string compression = "none";
+    std::size_t compressionMinBytes = 512;
+    int compressionLevel = 3;
+    bool hotKeys = false;
+    int hotKeysSample = 8;
+    int hotKeyReadsPerSec = 1000;
+    bool nearCache = false;
+    std::size_t nearCacheCapacity = 10000;
+    int nearCacheTtlMs = 1000;
 };
 
 Config parseConfigJson(const std::string& filename) {
@@ -43,23 +86,74 @@ Config parseConfigJson(const std::string& filename) {
             for (std::size_t i = 0; i < arr->size(); ++i)
                 cfg.shards.push_back(arr->getElement<std::string>(i));
         }
+        if (obj->has("replicas")) {
+            auto sets = obj->getArray("replicas");
+            for (std::size_t i = 0; i < sets->size(); ++i) {
+                auto set = sets->getArray(i);
+                cfg.replicas.emplace_back();
+                for (std::size_t j = 0; set && j < set->size(); ++j)
+                    cfg.replicas.back().push_back(set->getElement<std::string>(j));
+            }
+        }
         cfg.capacity = static_cast<std::size_t>(obj->optValue<int>("capacity", static_cast<int>(cfg.capacity)));
         cfg.algo = obj->optValue<std::string>("algo", cfg.algo);
         cfg.ttl = obj->optValue<int>("ttl", cfg.ttl);
+        cfg.partitions = static_cast<std::size_t>(obj->optValue<int>("partitions", static_cast<int>(cfg.partitions)));
+        if (cfg.partitions == 0) cfg.partitions = 1;
+        cfg.dict = obj->optValue<std::string>("dict", cfg.dict);
+        cfg.reaperIntervalMs = obj->optValue<int>("reaper_interval_ms", cfg.reaperIntervalMs);
+        cfg.slabRebalance = obj->optValue<bool>("slab_rebalance", cfg.slabRebalance);
+        cfg.maxMemory = static_cast<std::size_t>(obj->optValue<Poco::UInt64>("max_memory", cfg.maxMemory));
+        cfg.admission = obj->optValue<std::string>("admission", cfg.admission);
+        cfg.respPort = obj->optValue<int>("resp_port", cfg.respPort);
+        cfg.frontend = obj->optValue<std::string>("frontend", cfg.frontend);
+        cfg.ioThreads = obj->optValue<int>("io_threads", cfg.ioThreads);
+        cfg.routing = obj->optValue<std::string>("routing", cfg.routing);
+        cfg.snapshotPath = obj->optValue<std::string>("snapshot_path", cfg.snapshotPath);
+        cfg.snapshotIntervalMs = obj->optValue<int>("snapshot_interval_ms", cfg.snapshotIntervalMs);
+        cfg.aofPath = obj->optValue<std::string>("aof_path", cfg.aofPath);
+        cfg.aofFsync = obj->optValue<std::string>("aof_fsync", cfg.aofFsync);
+        cfg.aofFsyncIntervalMs = obj->optValue<int>("aof_fsync_interval_ms", cfg.aofFsyncIntervalMs);
+        cfg.aofRewriteMinBytes =
+            static_cast<std::size_t>(obj->optValue<Poco::UInt64>("aof_rewrite_min_bytes", cfg.aofRewriteMinBytes));
+        cfg.metrics = obj->optValue<bool>("metrics", cfg.metrics);
+        cfg.compression = obj->optValue<std::string>("compression", cfg.compression);
+        cfg.compressionMinBytes =
+            static_cast<std::size_t>(obj->optValue<Poco::UInt64>("compression_min_bytes", cfg.compressionMinBytes));
+        cfg.compressionLevel = obj->optValue<int>("compression_level", cfg.compressionLevel);
+        cfg.hotKeys = obj->optValue<bool>("hot_keys", cfg.hotKeys);
+        cfg.hotKeysSample = obj->optValue<int>("hot_keys_sample", cfg.hotKeysSample);
+        cfg.hotKeyReadsPerSec = obj->optValue<int>("hot_key_reads_per_sec", cfg.hotKeyReadsPerSec);
+        cfg.nearCache = obj->optValue<bool>("near_cache", cfg.nearCache);
+        cfg.nearCacheCapacity =
+            static_cast<std::size_t>(obj->optValue<Poco::UInt64>("near_cache_capacity", cfg.nearCacheCapacity));
+        cfg.nearCacheTtlMs = obj->optValue<int>("near_cache_ttl_ms", cfg.nearCacheTtlMs);
     } catch (const std::exception& e) {
         std::fprintf(stderr, "config parse error: %s\n", e.what());
     }
     return cfg;
 }
 
+template <template <class...> class Map>
+Cache<std::string, std::string>* makeCache(const Config& cfg, std::size_t capacity, std::size_t maxMemory) {
+    const std::string& algo = cfg.algo;
+    int ttl = cfg.ttl;
+    if (algo == "lfu")
+        return new LFUCache<std::string, std::string, Map>(capacity, ttl, maxMemory, cfg.admission == "tinylfu");
+    if (algo == "clock")
+        return new ClockCache<std::string, std::string, Map>(capacity, ttl, maxMemory);
+    return new LRUCache<std::string, std::string, Map>(capacity, ttl, maxMemory);
+}
+
 int main(int argc, char** argv) {
     if (argc < 2) {
-        std::fprintf(stderr, "Usage: %s <shard_number> [config.json]\n", argv[0]);
+        std::fprintf(stderr, "Usage: %s <shard_number> [config.json] [replica_number]\n", argv[0]);
         return 1;
     }
 
     int instance = std::stoi(argv[1]);
     std::string cfgPath = (argc >= 3) ? argv[2] : "config.json";
+    int replicaIndex = (argc >= 4) ? std::stoi(argv[3]) : -1;  // -1: the shard's primary
     Config cfg = parseConfigJson(cfgPath);
     const auto& shards = cfg.shards;
 
@@ -72,7 +166,26 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    std::string selfAddr = shards[instance];
+    cfg.replicas.resize(shards.size());
+    const bool isReplica = replicaIndex >= 0;
+    if (isReplica && replicaIndex >= static_cast<int>(cfg.replicas[instance].size())) {
+        std::fprintf(stderr, "Invalid replica number: %d (shard %d has %zu)\n", replicaIndex, instance,
+                     cfg.replicas[instance].size());
+        return 1;
+    }
+    if (!cfg.replicas[instance].empty() && cfg.respPort <= 0) {
+        std::fprintf(stderr, "replication needs resp_port\n");
+        return 1;
+    }
+    // Snapshots, log rewrites, replica syncs and a replica's clear() lock one partition at a time,
+    // which with a single partition is every request for the whole dump.
+    const bool dumps = !cfg.snapshotPath.empty() || !cfg.aofPath.empty() || !cfg.replicas[instance].empty();
+    if (dumps && cfg.partitions < 2) {
+        std::fprintf(stderr, "snapshot_path, aof_path and replicas need partitions >= 2\n");
+        return 1;
+    }
+
+    std::string selfAddr = isReplica ? cfg.replicas[instance][replicaIndex] : shards[instance];
     auto pos = selfAddr.rfind(':');
     if (pos == std::string::npos) {
         std::fprintf(stderr, "bad shard address: %s\n", selfAddr.c_str());
@@ -83,30 +196,212 @@ int main(int argc, char** argv) {
 
     std::size_t capacity = cfg.capacity;
     std::string algo = cfg.algo;
-    int ttl = cfg.ttl;
 
-    Poco::Net::ServerSocket socket(port);
-    auto* params = new Poco::Net::HTTPServerParams;
-    params->setMaxThreads(24);
-    params->setKeepAlive(true);
-
-    Cache<std::string, std::string>* cache = nullptr;
-    if (algo == "lru")
-        cache = new LRUCache<std::string, std::string>(capacity, ttl);
-    else if (algo == "lfu")
-        cache = new LFUCache<std::string, std::string>(capacity, ttl);
-    else {
+    if (algo != "lru" && algo != "lfu" && algo != "clock") {
         std::fprintf(stderr, "bad algorithm: %s (fallback to lru)\n", algo.c_str());
-        cache = new LRUCache<std::string, std::string>(capacity, ttl);
+        algo = cfg.algo = "lru";
+    }
+    if (cfg.dict != "chained" && cfg.dict != "flat") {
+        std::fprintf(stderr, "bad dict: %s (fallback to chained)\n", cfg.dict.c_str());
+        cfg.dict = "chained";
+    }
+
+    std::size_t partitions = cfg.partitions;
+    std::size_t partitionCapacity = (capacity + partitions - 1) / partitions;
+    std::size_t partitionMemory = (cfg.maxMemory + partitions - 1) / partitions;
+    std::vector<Cache<std::string, std::string>*> caches;
+    for (std::size_t i = 0; i < partitions; ++i) {
+        if (cfg.dict == "flat")
+            caches.push_back(makeCache<FlatHashMap>(cfg, partitionCapacity, partitionMemory));
+        else
+            caches.push_back(makeCache<HashMap>(cfg, partitionCapacity, partitionMemory));
+    }
+
+    metrics::setEnabled(cfg.metrics);
+    auto* storage = new KVstorage<std::string, std::string>(caches, capacity);
+
+    Codec::Options compression;
+    if (cfg.compression == "lz4") {
+        compression.algorithm = Encoding::Lz4;
+    } else if (cfg.compression == "zstd") {
+        compression.algorithm = Encoding::Zstd;
+    } else if (cfg.compression != "none") {
+        std::fprintf(stderr, "bad compression: %s (fallback to none)\n", cfg.compression.c_str());
+    }
+    if (!Codec::available(compression.algorithm)) {
+        std::fprintf(stderr, "built without %s (-DTIMKV_WITH_%s=ON), fallback to none\n", cfg.compression.c_str(),
+                     compression.algorithm == Encoding::Lz4 ? "LZ4" : "ZSTD");
+        compression.algorithm = Encoding::Raw;
+    }
+    compression.minBytes = cfg.compressionMinBytes;
+    compression.level = cfg.compressionLevel;
+    storage->setCompression(compression);
+
+    // Every shard keeps its own files: "<snapshot_path>.<shard>", "<aof_path>.<shard>".
+    // Replicas get their data from the primary and keep no files of their own.
+    std::string snapshotFile =
+        cfg.snapshotPath.empty() || isReplica ? "" : cfg.snapshotPath + "." + std::to_string(instance);
+    std::string aofFile = cfg.aofPath.empty() || isReplica ? "" : cfg.aofPath + "." + std::to_string(instance);
+    std::unique_ptr<AppendLog> aof;
+    if (!aofFile.empty()) {
+        // The log holds the full state since its last rewrite, so a snapshot is not loaded on top.
+        AppendLog::Options options;
+        if (cfg.aofFsync == "always") {
+            options.fsync = AppendLog::Fsync::Always;
+        } else if (cfg.aofFsync == "never") {
+            options.fsync = AppendLog::Fsync::Never;
+        } else if (cfg.aofFsync != "interval") {
+            std::fprintf(stderr, "bad aof_fsync: %s (fallback to interval)\n", cfg.aofFsync.c_str());
+        }
+        options.interval = std::chrono::milliseconds(cfg.aofFsyncIntervalMs > 0 ? cfg.aofFsyncIntervalMs : 1000);
+        options.ttlSeconds = cfg.ttl;
+        options.rewriteMinBytes = cfg.aofRewriteMinBytes;
+
+        auto started = std::chrono::steady_clock::now();
+        std::string error;
+        std::size_t records = AppendLog::replay(
+            aofFile,
+            [&](std::string_view key, std::string_view value, int64_t ttlMs) {
+                storage->restore(key, value, EntryMeta{ttlMs, 1});
+            },
+            [&](std::string_view key) { storage->remove(key); }, error);
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+        if (!error.empty()) {
+            std::fprintf(stderr, "append log %s: %s\n", aofFile.c_str(), error.c_str());
+            return 1;
+        }
+        std::printf("Shard %d replayed %zu records (%zu keys) from %s in %lld ms\n", instance, records,
+                    storage->size(), aofFile.c_str(), static_cast<long long>(ms.count()));
+
+        aof = std::make_unique<AppendLog>(aofFile, options);
+        if (!aof->open(error)) {
+            std::fprintf(stderr, "cant open append log %s: %s\n", aofFile.c_str(), error.c_str());
+            return 1;
+        }
+        aof->startRewrites([storage](std::size_t i, std::string& chunk) {
+            if (i >= storage->partitionsCount()) return false;
+            storage->dumpPartition(i, chunk, AppendLog::encodeEntry);
+            return true;
+        });
+        storage->addListener(aof.get());
+    } else if (!snapshotFile.empty()) {
+        auto started = std::chrono::steady_clock::now();
+        std::string error;
+        storage->loadSnapshot(snapshotFile, error);
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+        if (error.empty())
+            std::printf("Shard %d loaded %zu keys from %s in %lld ms\n", instance, storage->size(),
+                        snapshotFile.c_str(), static_cast<long long>(ms.count()));
+        else
+            std::fprintf(stderr, "snapshot %s not loaded: %s\n", snapshotFile.c_str(), error.c_str());
+    }
+    // The primary queues its mutations for replicas that connect with SYNC; a replica follows its
+    // primary's RESP port.
+    std::unique_ptr<ReplicationSource> replication;
+    std::unique_ptr<ReplicaLink> link;
+    if (isReplica) {
+        link = std::make_unique<ReplicaLink>(storage, shards[instance].substr(0, shards[instance].rfind(':')),
+                                             cfg.respPort + instance);
+    } else if (!cfg.replicas[instance].empty()) {
+        replication = std::make_unique<ReplicationSource>(storage);
+        storage->addListener(replication.get());
     }
 
-    auto* storage = new KVstorage(cache, capacity);
-    Poco::Net::HTTPServer server(new HandlerFactory(storage, shards, instance), socket, params);
-    server.start();
-    storage->startEviction();
+    Api api(storage, shards, instance);
+    if (link) api.enableReplication([&link] { return link->stats(); }, true);
+    if (replication) api.enableReplication([&replication] { return replication->stats(); }, false);
+    if (cfg.routing != "redirect" && cfg.routing != "proxy") {
+        std::fprintf(stderr, "bad routing: %s (fallback to redirect)\n", cfg.routing.c_str());
+        cfg.routing = "redirect";
+    }
+    if (cfg.routing == "proxy" && cfg.respPort <= 0) {
+        std::fprintf(stderr, "proxy routing needs resp_port (fallback to redirect)\n");
+        cfg.routing = "redirect";
+    }
+    if (cfg.routing == "proxy") api.enableProxy(cfg.respPort);
+
+    // Reads are counted into the hot-key sketch; with the near cache, hot keys of other shards are
+    // copied here for a short while and the shard is told about writes to its own copied keys.
+    std::unique_ptr<HotKeys> hotKeys;
+    if (cfg.hotKeys || cfg.nearCache) {
+        HotKeys::Options options;
+        options.sampleRate = static_cast<uint32_t>(std::max(cfg.hotKeysSample, 1));
+        options.hotReadsPerSecond = static_cast<uint64_t>(std::max(cfg.hotKeyReadsPerSec, 1));
+        hotKeys = std::make_unique<HotKeys>(options);
+        storage->setHotKeys(hotKeys.get());
+    }
+    std::unique_ptr<NearCache> nearCache;
+    if (cfg.nearCache) {
+        if (cfg.routing != "proxy" || isReplica || shards.size() > 64) {
+            std::fprintf(stderr, "near cache needs proxy routing and at most 64 shards, on primaries (off)\n");
+        } else {
+            NearCache::Options options;
+            options.capacity = cfg.nearCacheCapacity;
+            options.ttl = std::chrono::milliseconds(cfg.nearCacheTtlMs > 0 ? cfg.nearCacheTtlMs : 1000);
+            nearCache = std::make_unique<NearCache>(shards, instance, cfg.respPort, options);
+            storage->addListener(nearCache.get());
+        }
+    }
+    api.enableHotKeys(hotKeys.get(), nearCache.get());
+
+#ifndef TIMKV_WITH_LIBHV
+    if (cfg.frontend == "libhv") {
+        std::fprintf(stderr, "built without libhv (-DTIMKV_WITH_LIBHV=ON), fallback to poco\n");
+        cfg.frontend = "poco";
+    }
+#endif
+    if (cfg.frontend != "poco" && cfg.frontend != "libhv" && cfg.frontend != "epoll") {
+        std::fprintf(stderr, "bad frontend: %s (fallback to poco)\n", cfg.frontend.c_str());
+        cfg.frontend = "poco";
+    }
+    std::unique_ptr<Poco::Net::HTTPServer> server;
+#ifdef TIMKV_WITH_LIBHV
+    std::unique_ptr<HvServer> hvServer;
+    if (cfg.frontend == "libhv") {
+        int threads = cfg.ioThreads > 0 ? cfg.ioThreads : static_cast<int>(std::thread::hardware_concurrency());
+        hvServer = std::make_unique<HvServer>(&api, port, threads);
+        hvServer->start();
+    }
+#endif
+    std::unique_ptr<EpollServer> epollServer;
+    if (cfg.frontend == "epoll") {
+        int threads = cfg.ioThreads > 0 ? cfg.ioThreads : static_cast<int>(std::thread::hardware_concurrency());
+        epollServer = std::make_unique<EpollServer>(&api, port, threads);
+        if (!epollServer->start()) return 1;
+    }
+    if (cfg.frontend == "poco") {
+        auto* params = new Poco::Net::HTTPServerParams;
+        params->setMaxThreads(cfg.ioThreads > 0 ? cfg.ioThreads : 24);
+        params->setKeepAlive(true);
+        server = std::make_unique<Poco::Net::HTTPServer>(new HandlerFactory(&api), Poco::Net::ServerSocket(port), params);
+        server->start();
+    }
+
+    // Replicas listen after all primaries: replica j of shard i (counting the replicas of shards
+    // before i first) on resp_port + shards + j.
+    int respListenPort = cfg.respPort + instance;
+    if (isReplica) {
+        respListenPort = cfg.respPort + static_cast<int>(shards.size()) + replicaIndex;
+        for (int i = 0; i < instance; ++i) respListenPort += static_cast<int>(cfg.replicas[i].size());
+    }
+    std::unique_ptr<Poco::Net::TCPServer> respServer;
+    if (cfg.respPort > 0) {
+        auto* respParams = new Poco::Net::TCPServerParams;
+        respParams->setMaxThreads(24);
+        respServer = std::make_unique<Poco::Net::TCPServer>(
+            new RespConnectionFactory(storage, shards, instance, cfg.respPort, replication.get(), isReplica,
+                                      nearCache.get()),
+            Poco::Net::ServerSocket(respListenPort), respParams);
+        respServer->start();
+        std::printf("Shard %d serving RESP at %s:%d\n", instance, host.c_str(), respListenPort);
+    }
+    if (link) link->start();
+    storage->startReaper(std::chrono::milliseconds(cfg.reaperIntervalMs), 1024, cfg.slabRebalance);
+    if (!snapshotFile.empty()) storage->startSnapshots(snapshotFile, std::chrono::milliseconds(cfg.snapshotIntervalMs));
 
-    std::printf("Shard %d serving at %s:%d, cache=%s, cap=%zu\n",
-                instance, host.c_str(), port, algo.c_str(), capacity);
+    std::printf("Shard %d%s serving at %s:%d (%s), cache=%s, dict=%s, cap=%zu, max_memory=%zu, partitions=%zu\n",
+                instance, isReplica ? (" replica " + std::to_string(replicaIndex)).c_str() : "", host.c_str(), port,
+                cfg.frontend.c_str(), algo.c_str(), cfg.dict.c_str(), capacity, cfg.maxMemory, partitions);
 
     sigset_t mask;
     sigemptyset(&mask);
@@ -118,7 +413,18 @@ int main(int argc, char** argv) {
     sigwait(&mask, &sig);
 
     std::printf("stopping\n");
-    server.stop();
+    if (link) link->stop();
+    if (replication) replication->stop();
+    if (respServer) respServer->stop();
+    if (nearCache) nearCache->stop();
+    if (server) server->stop();
+#ifdef TIMKV_WITH_LIBHV
+    if (hvServer) hvServer->stop();
+#endif
+    if (epollServer) epollServer->stop();
+    if (!snapshotFile.empty() && !storage->saveSnapshot(snapshotFile))
+        std::fprintf(stderr, "final snapshot to %s failed\n", snapshotFile.c_str());
+    aof.reset();
     delete storage;
     return 0;
 }
@@ -0,0 +1,176 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "histogram.h"
+
+// Request counters and per-stage latency histograms for /stats and /metrics. Every thread records
+// into a shard of its own with plain loads and stores on relaxed atomics, so the hot path has no
+// shared cache line and no locked instruction; snapshot() adds the shards up while they are
+// written, which can only miss the latest few samples. A shard outlives its thread (it goes back
+// to a free list for the next one), so totals never go down.
+namespace metrics {
+
+enum class Stage { Parse, LockWait, CacheOp, Write, Compress, Decompress };
+// Compressed/Incompressible count the values tried by the codec, CompressedIn/Out the bytes of
+// those kept compressed before and after.
+enum class Event { Hit, Miss, Put, Remove, Compressed, Incompressible, CompressedIn, CompressedOut };
+
+inline constexpr size_t kStages = 6;
+inline constexpr size_t kEvents = 8;
+inline constexpr const char *kStageNames[kStages] = {"parse", "lock_wait", "cache_op", "write", "compress", "decompress"};
+
+// Durations are kept in nanoseconds up to ~69 s; longer ones land in the last bucket.
+inline constexpr uint64_t kMaxNs = (uint64_t(1) << 36) - 1;
+inline constexpr size_t kBuckets = LatencyHistogram::indexOf(kMaxNs) + 1;
+
+struct StageSnapshot {
+    LatencyHistogram histogram;
+    uint64_t sumNs = 0;
+};
+
+struct Snapshot {
+    std::array<uint64_t, kEvents> events{};
+    std::array<StageSnapshot, kStages> stages;
+
+    uint64_t count(Event e) const {
+        return events[size_t(e)];
+    }
+
+    const StageSnapshot &stage(Stage s) const {
+        return stages[size_t(s)];
+    }
+};
+
+namespace detail {
+
+struct Shard {
+    std::atomic<uint64_t> events[kEvents] = {};
+    std::atomic<uint64_t> sums[kStages] = {};
+    std::atomic<uint64_t> buckets[kStages][kBuckets] = {};
+
+    // Only the owning thread writes, so a load and a store replace the locked add.
+    static void bump(std::atomic<uint64_t> &a, uint64_t n) {
+        a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+class Registry {
+public:
+    Shard *acquire() {
+        std::lock_guard lock(mutex);
+        if (!idle.empty()) {
+            Shard *s = idle.back();
+            idle.pop_back();
+            return s;
+        }
+        shards.push_back(std::make_unique<Shard>());
+        return shards.back().get();
+    }
+
+    void release(Shard *s) {
+        std::lock_guard lock(mutex);
+        idle.push_back(s);
+    }
+
+    Snapshot collect() {
+        Snapshot out;
+        std::lock_guard lock(mutex);
+        for (const auto &s : shards) {
+            for (size_t e = 0; e < kEvents; ++e) out.events[e] += s->events[e].load(std::memory_order_relaxed);
+            for (size_t st = 0; st < kStages; ++st) {
+                out.stages[st].sumNs += s->sums[st].load(std::memory_order_relaxed);
+                for (size_t i = 0; i < kBuckets; ++i)
+                    out.stages[st].histogram.add(i, s->buckets[st][i].load(std::memory_order_relaxed));
+            }
+        }
+        return out;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::vector<Shard *> idle;
+};
+
+inline Registry &registry() {
+    static Registry r;
+    return r;
+}
+
+struct Lease {
+    Shard *shard = registry().acquire();
+
+    ~Lease() {
+        registry().release(shard);
+    }
+};
+
+inline Shard &local() {
+    thread_local Lease lease;
+    return *lease.shard;
+}
+
+inline std::atomic<bool> on{true};
+
+}  // namespace detail
+
+// Off with "metrics": false in the config; nothing is timed or counted then.
+inline void setEnabled(bool enabled) {
+    detail::on.store(enabled, std::memory_order_relaxed);
+}
+
+inline bool enabled() {
+    return detail::on.load(std::memory_order_relaxed);
+}
+
+inline int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void record(Stage s, uint64_t ns) {
+    detail::Shard &shard = detail::local();
+    detail::Shard::bump(shard.sums[size_t(s)], ns);
+    detail::Shard::bump(shard.buckets[size_t(s)][LatencyHistogram::indexOf(std::min(ns, kMaxNs))], 1);
+}
+
+inline void count(Event e, uint64_t n = 1) {
+    if (enabled()) detail::Shard::bump(detail::local().events[size_t(e)], n);
+}
+
+inline Snapshot snapshot() {
+    return detail::registry().collect();
+}
+
+// Times consecutive stages of one request: each lap records the time since the previous lap (or
+// since construction) under the given stage.
+class StageTimer {
+public:
+    StageTimer() : last(enabled() ? now() : 0) {
+    }
+
+    void lap(Stage s) {
+        if (last == 0) return;
+        const int64_t t = now();
+        record(s, uint64_t(t - last));
+        last = t;
+    }
+
+    // Starts the next stage from here, leaving out what came since the last lap.
+    void restart() {
+        if (last != 0) last = now();
+    }
+
+private:
+    int64_t last;
+};
+
+}  // namespace metrics
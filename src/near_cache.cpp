@@ -0,0 +1,152 @@
+#include "near_cache.h"
+
+#include <algorithm>
+
+#include "lru_cache.h"
+
+NearCache::NearCache(const std::vector<std::string> &shards, int curr, int respBasePort, Options options)
+    : options(options), queued(shards.size()) {
+    const size_t perStripe = std::max<size_t>(1, options.capacity / kStripes);
+    for (auto &s : stripes) s.cache = std::make_unique<LRUCache<std::string, std::string>>(perStripe, 1);
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (static_cast<int>(i) == curr) {
+            peers.push_back(nullptr);
+            continue;
+        }
+        const std::string &addr = shards[i];
+        peers.push_back(std::make_unique<ShardClient>(addr.substr(0, addr.rfind(':')), respBasePort + static_cast<int>(i)));
+    }
+    sender = std::thread([this] { send(); });
+}
+
+NearCache::~NearCache() {
+    stop();
+}
+
+bool NearCache::get(std::string_view key, std::string &value) {
+    Stripe &s = stripeFor(key);
+    bool drain = false;
+    bool found;
+    auto copy = [&](const ValueView &v) { value.assign(v.bytes); };
+    if (s.cache->sharedReads()) {
+        std::shared_lock lock(s.mutex);
+        found = s.cache->read(key, drain, copy);
+    } else {
+        std::unique_lock lock(s.mutex);
+        found = s.cache->get(key, copy);
+    }
+    if (drain) {
+        std::unique_lock lock(s.mutex, std::try_to_lock);
+        if (lock) s.cache->maintain();
+    }
+    (found ? hits : misses).fetch_add(1, std::memory_order_relaxed);
+    return found;
+}
+
+void NearCache::fill(std::string_view key, std::string_view value, uint64_t epoch) {
+    std::lock_guard guard(fillMutex);
+    if (invalidations.load(std::memory_order_relaxed) != epoch) return;
+    Stripe &s = stripeFor(key);
+    std::unique_lock lock(s.mutex);
+    s.cache->expire(8);
+    s.cache->put(key, value, options.ttl);
+    fills.fetch_add(1, std::memory_order_relaxed);
+}
+
+void NearCache::invalidate(std::string_view key) {
+    std::lock_guard guard(fillMutex);
+    invalidations.fetch_add(1, std::memory_order_release);
+    Stripe &s = stripeFor(key);
+    std::unique_lock lock(s.mutex);
+    invalidated.fetch_add(s.cache->remove(key), std::memory_order_relaxed);
+}
+
+void NearCache::track(std::string_view key, size_t shard) {
+    if (shard >= peers.size() || !peers[shard]) return;
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard lock(mutex);
+    // Tracking outlives the copies it stands for only until the next sweep.
+    if (tracked.size() >= sweepAt) {
+        std::erase_if(tracked, [&](const auto &t) { return t.second.until < now; });
+        sweepAt = std::max<size_t>(1024, 2 * tracked.size());
+    }
+    auto it = tracked.find(key);
+    if (it == tracked.end()) it = tracked.emplace(std::string(key), Tracked{}).first;
+    it->second.shards |= uint64_t(1) << shard;
+    // Twice the ttl: the copy's ttl starts when the reply arrives, a little after this.
+    it->second.until = now + 2 * options.ttl;
+    trackedCount.store(tracked.size(), std::memory_order_release);
+}
+
+uint64_t NearCache::onPut(std::string_view key, std::string_view, std::chrono::milliseconds) {
+    untrack(key);
+    return 0;
+}
+
+uint64_t NearCache::onRemove(std::string_view key) {
+    untrack(key);
+    return 0;
+}
+
+void NearCache::untrack(std::string_view key) {
+    // Unsynchronised check: a NEARGET tracks its key before reading it, so a put that misses the
+    // tracking here was applied before that read and is in the copy.
+    if (trackedCount.load(std::memory_order_acquire) == 0) return;
+    std::lock_guard lock(mutex);
+    auto it = tracked.find(key);
+    if (it == tracked.end()) return;
+    if (it->second.until >= std::chrono::steady_clock::now()) {
+        for (size_t i = 0; i < queued.size(); ++i)
+            if (it->second.shards >> i & 1) queued[i].emplace_back(key);
+        ready.notify_one();
+    }
+    tracked.erase(it);
+    trackedCount.store(tracked.size(), std::memory_order_release);
+}
+
+void NearCache::send() {
+    std::vector<std::string> keys;
+    std::unique_lock lock(mutex);
+    while (true) {
+        ready.wait(lock, [&] {
+            return stopping || std::any_of(queued.begin(), queued.end(), [](const auto &q) { return !q.empty(); });
+        });
+        if (stopping) return;
+        for (size_t i = 0; i < queued.size(); ++i) {
+            if (queued[i].empty()) continue;
+            keys.swap(queued[i]);
+            lock.unlock();
+            std::vector<std::string_view> args{"INVALIDATE"};
+            args.insert(args.end(), keys.begin(), keys.end());
+            // The reply is not waited for: a shard that can't be reached drops its copies at the ttl.
+            peers[i]->send(args);
+            sent.fetch_add(keys.size(), std::memory_order_relaxed);
+            keys.clear();
+            lock.lock();
+        }
+    }
+}
+
+void NearCache::stop() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    ready.notify_one();
+    if (sender.joinable()) sender.join();
+}
+
+NearCacheStats NearCache::stats() {
+    NearCacheStats st;
+    st.hits = hits.load(std::memory_order_relaxed);
+    st.misses = misses.load(std::memory_order_relaxed);
+    st.fills = fills.load(std::memory_order_relaxed);
+    st.invalidated = invalidated.load(std::memory_order_relaxed);
+    st.invalidationsSent = sent.load(std::memory_order_relaxed);
+    for (auto &s : stripes) {
+        std::unique_lock lock(s.mutex);
+        st.entries += s.cache->size();
+    }
+    st.tracked = trackedCount.load(std::memory_order_relaxed);
+    return st;
+}
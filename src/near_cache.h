@@ -0,0 +1,114 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "hot_keys.h"
+#include "shard_client.h"
+#include "storage.h"
+
+struct NearCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t fills = 0;
+    uint64_t invalidated = 0;       // copies dropped on the owner's word or a forwarded write
+    uint64_t invalidationsSent = 0;  // as the owner, keys sent to other shards
+    size_t entries = 0;
+    size_t tracked = 0;  // as the owner, keys some shard holds a copy of
+};
+
+// Short-lived copies of hot keys owned by other shards, kept by the shard that proxies reads for
+// them (routing "proxy"), and the owner's side of keeping such copies fresh. Every shard plays
+// both roles.
+//  - A copy is fetched with `NEARGET key shard`: the owner tracks the key for that shard until the
+//    copy's ttl is up, then answers like GET.
+//  - A put or delete of a tracked key on the owner ends the tracking and queues the key for the
+//    shards holding it; a sender thread delivers each shard's queue as one `INVALIDATE key ...`.
+//    The shard that forwarded the write drops its own copy as soon as the owner answers.
+//  - Invalidations travel apart from the fetches, so one can overtake a fetch's reply; a fill is
+//    dropped if any invalidation arrived since its fetch started. One lost with a connection
+//    leaves a copy stale for at most the ttl.
+class NearCache : public MutationListener {
+public:
+    struct Options {
+        size_t capacity = 10000;
+        std::chrono::milliseconds ttl{1000};
+    };
+
+    // Shard i listens for RESP on respBasePort + i; at most 64 shards.
+    NearCache(const std::vector<std::string> &shards, int curr, int respBasePort, Options options);
+
+    ~NearCache() override;
+
+    NearCache(const NearCache &) = delete;
+    NearCache &operator=(const NearCache &) = delete;
+
+    bool get(std::string_view key, std::string &value);
+
+    // Taken before a fetch and handed to fill with its result.
+    uint64_t epoch() const {
+        return invalidations.load(std::memory_order_acquire);
+    }
+
+    void fill(std::string_view key, std::string_view value, uint64_t epoch);
+
+    void invalidate(std::string_view key);
+
+    void track(std::string_view key, size_t shard);
+
+    uint64_t onPut(std::string_view key, std::string_view value, std::chrono::milliseconds ttl) override;
+
+    uint64_t onRemove(std::string_view key) override;
+
+    void stop();
+
+    NearCacheStats stats();
+
+private:
+    struct Tracked {
+        uint64_t shards = 0;
+        std::chrono::steady_clock::time_point until;
+    };
+
+    // The copies, striped so hot keys spread over locks; readers share a stripe's lock.
+    struct Stripe {
+        PartitionMutex mutex;
+        std::unique_ptr<Cache<std::string, std::string>> cache;
+    };
+    static constexpr size_t kStripes = 16;
+
+    Options options;
+    Stripe stripes[kStripes];
+    std::atomic<uint64_t> invalidations{0};
+    std::mutex fillMutex;  // a fill's epoch check and its put against invalidate()
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> fills{0};
+    std::atomic<uint64_t> invalidated{0};
+    std::atomic<uint64_t> sent{0};
+
+    std::vector<std::unique_ptr<ShardClient>> peers;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::unordered_map<std::string, Tracked, StringViewHash, std::equal_to<>> tracked;
+    std::atomic<size_t> trackedCount{0};  // tracked.size(), read without the mutex on every mutation
+    size_t sweepAt = 1024;
+    std::vector<std::vector<std::string>> queued;  // keys to invalidate, per shard
+    bool stopping = false;
+    std::thread sender;
+
+    Stripe &stripeFor(std::string_view key) {
+        return stripes[std::hash<std::string_view>{}(key) % kStripes];
+    }
+
+    void untrack(std::string_view key);
+    void send();
+};
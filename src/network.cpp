@@ -1,109 +1,34 @@
 #include "network.h"
 
-#include <Poco/JSON/Object.h>
-#include <Poco/JSON/Parser.h>
-#include <Poco/JSON/Stringifier.h>
 #include <Poco/Net/HTTPRequestHandler.h>
 #include <Poco/Net/HTTPServerRequest.h>
 #include <Poco/Net/HTTPServerResponse.h>
 
-#include <functional>
+#include <string_view>
 
-bool redirectIfNeeded(const std::vector<std::string> &shards,
-                      int curr,
-                      const std::string &key,
-                      Poco::Net::HTTPServerRequest &request,
-                      Poco::Net::HTTPServerResponse &response) {
-    if (shards.size() == 1 || key.empty()) return false;
-    size_t idx = std::hash<std::string>{}(key) % shards.size();
-    if (static_cast<int>(idx) != curr) {
-        std::string target = "http://" + shards[idx] + request.getURI();
-        response.setStatus(Poco::Net::HTTPResponse::HTTP_TEMPORARY_REDIRECT);
-        response.set("Location", target);
-        response.send();
-        return true;
-    }
-    return false;
-}
-
-void GetHandler::handleRequest(Poco::Net::HTTPServerRequest &request,
-                               Poco::Net::HTTPServerResponse &response) {
-    Poco::JSON::Object::Ptr jsonResp = new Poco::JSON::Object;
-    response.setContentType("application/json");
-    try {
-        Poco::JSON::Parser parser;
-        auto reqObj = parser.parse(request.stream()).extract<Poco::JSON::Object::Ptr>();
-        std::string key = reqObj->getValue<std::string>("key");
-        if (redirectIfNeeded(shards, curr, key, request, response)) {
-            return;
-        }
-        auto res = storage->get(key);
-        if (res) {
-            jsonResp->set("status", "ok");
-            jsonResp->set("value", res.value());
-        } else {
-            jsonResp->set("status", "not found");
-        }
-    } catch (const std::runtime_error &) {
-        return;
-    } catch (...) {
-        response.setStatus(Poco::Net::HTTPResponse::HTTP_BAD_REQUEST);
-    }
-    std::ostream &out = response.send();
-    Poco::JSON::Stringifier::stringify(jsonResp, out);
-}
+#include "metrics.h"
 
-void PutHandler::handleRequest(Poco::Net::HTTPServerRequest &request,
+void ApiHandler::handleRequest(Poco::Net::HTTPServerRequest &request,
                                Poco::Net::HTTPServerResponse &response) {
-    Poco::JSON::Object::Ptr jsonResp = new Poco::JSON::Object;
-    response.setContentType("application/json");
-    try {
-        Poco::JSON::Parser parser;
-        auto reqObj = parser.parse(request.stream()).extract<Poco::JSON::Object::Ptr>();
-        auto key = reqObj->getValue<std::string>("key");
-        auto value = reqObj->getValue<std::string>("value");
-        if (redirectIfNeeded(shards, curr, key, request, response)) {
-            return;
-        }
-        storage->put(key, value);
-        jsonResp->set("status", "ok");
-    } catch (const std::runtime_error &) {
-        return;
-    } catch (...) {
-        response.setStatus(Poco::Net::HTTPResponse::HTTP_BAD_REQUEST);
+    ApiResponse out;
+    api->handle(request.getMethod(), request.getURI(), request.stream(), out, request.get("Accept-Encoding", ""));
+    response.setStatus(static_cast<Poco::Net::HTTPResponse::HTTPStatus>(out.status));
+    if (!out.location.empty()) {
+        response.set("Location", out.location);
     }
-    std::ostream &out = response.send();
-    Poco::JSON::Stringifier::stringify(jsonResp, out);
-}
-
-void DeleteHandler::handleRequest(Poco::Net::HTTPServerRequest &request,
-                                  Poco::Net::HTTPServerResponse &response) {
-    Poco::JSON::Object::Ptr jsonResp = new Poco::JSON::Object;
-    response.setContentType("application/json");
-    try {
-        Poco::JSON::Parser parser;
-        auto reqObj = parser.parse(request.stream()).extract<Poco::JSON::Object::Ptr>();
-        std::string key = reqObj->getValue<std::string>("key");
-        if (redirectIfNeeded(shards, curr, key, request, response)) {
-            return;
-        }
-        storage->remove(key);
-        jsonResp->set("status", "ok");
-    } catch (const std::runtime_error &) {
-        return;
-    } catch (...) {
-        response.setStatus(Poco::Net::HTTPResponse::HTTP_BAD_REQUEST);
+    response.setContentType(out.contentType);
+    if (!out.contentEncoding.empty()) {
+        response.set("Content-Encoding", out.contentEncoding);
     }
-    std::ostream &out = response.send();
-    Poco::JSON::Stringifier::stringify(jsonResp, out);
+    // sendBuffer writes the bytes to the socket as they are, so a shared value is not copied.
+    const std::string_view body = out.shared ? out.shared.view() : std::string_view(out.body);
+    metrics::StageTimer timer;
+    response.sendBuffer(body.data(), body.size());
+    timer.lap(metrics::Stage::Write);
 }
 
 Poco::Net::HTTPRequestHandler *HandlerFactory::createRequestHandler(
     const Poco::Net::HTTPServerRequest &request) {
-    if (request.getMethod() != Poco::Net::HTTPRequest::HTTP_POST) return nullptr;
-    std::string uri = request.getURI();
-    if (uri == "/get") return new GetHandler(storage, shards, curr);
-    if (uri == "/put") return new PutHandler(storage, shards, curr);
-    if (uri == "/delete") return new DeleteHandler(storage, shards, curr);
-    return nullptr;
+    if (!api->hasRoute(request.getMethod(), request.getURI())) return nullptr;
+    return new ApiHandler(api);
 }
@@ -1,75 +1,32 @@
 #pragma once
 #include <Poco/Net/HTTPRequestHandler.h>
 #include <Poco/Net/HTTPRequestHandlerFactory.h>
-#include "storage.h"
+#include "api.h"
 #include <vector>
 #include <string>
 
-class GetHandler : public Poco::Net::HTTPRequestHandler {
+class ApiHandler : public Poco::Net::HTTPRequestHandler {
 public:
-    GetHandler(KVstorage<std::string, std::string> *storage,
-               const std::vector<std::string> &shards,
-               int curr)
-        : storage(storage), shards(shards), curr(curr) {
+    explicit ApiHandler(Api *api)
+        : api(api) {
     }
 
     void handleRequest(Poco::Net::HTTPServerRequest &request,
                        Poco::Net::HTTPServerResponse &response) override;
 
 private:
-    KVstorage<std::string, std::string> *storage;
-    std::vector<std::string> shards;
-    int curr;
+    Api *api;
 };
 
-class PutHandler : public Poco::Net::HTTPRequestHandler {
-public:
-    PutHandler(KVstorage<std::string, std::string> *storage,
-               const std::vector<std::string> &shards,
-               int curr)
-        : storage(storage), shards(shards), curr(curr) {
-    }
-
-    void handleRequest(Poco::Net::HTTPServerRequest &request,
-                       Poco::Net::HTTPServerResponse &response) override;
-
-private:
-    KVstorage<std::string, std::string> *storage;
-    std::vector<std::string> shards;
-    int curr;
-};
-
-class DeleteHandler : public Poco::Net::HTTPRequestHandler {
-public:
-    DeleteHandler(KVstorage<std::string, std::string> *storage,
-                  const std::vector<std::string> &shards,
-                  int curr)
-        : storage(storage), shards(shards), curr(curr) {
-    }
-
-    void handleRequest(Poco::Net::HTTPServerRequest &request,
-                       Poco::Net::HTTPServerResponse &response) override;
-
-private:
-    KVstorage<std::string, std::string> *storage;
-    std::vector<std::string> shards;
-    int curr;
-};
-
-
 class HandlerFactory : public Poco::Net::HTTPRequestHandlerFactory {
 public:
-    HandlerFactory(KVstorage<std::string, std::string> *storage,
-                   const std::vector<std::string> &shards,
-                   int curr)
-        : storage(storage), shards(shards), curr(curr) {
+    explicit HandlerFactory(Api *api)
+        : api(api) {
     }
 
     Poco::Net::HTTPRequestHandler *createRequestHandler(
         const Poco::Net::HTTPServerRequest &request) override;
 
 private:
-    KVstorage<std::string, std::string> *storage;
-    std::vector<std::string> shards;
-    int curr;
+    Api *api;
 };
@@ -0,0 +1,60 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// Hits recorded by readers that hold a partition lock shared, replayed later by whoever holds it
+// exclusively (Caffeine's read buffer). Readers are spread over stripes on separate cache lines by
+// thread, and a full stripe drops further hits, which only makes the recency order approximate.
+// record() runs concurrently with other record() calls only; drain() must not overlap either.
+// T is a pointer or integer, with T{} meaning an empty slot.
+template<typename T>
+class ReadBuffer {
+public:
+    static constexpr size_t kStripes = 8;
+    static constexpr size_t kSlots = 32;  // per stripe
+
+    // Returns true once the stripe is half full, as a hint that it is worth draining.
+    bool record(T item) {
+        Stripe &s = stripes[stripeIndex()];
+        uint32_t w = s.written.load(std::memory_order_relaxed);
+        if (w - s.drained >= kSlots) return true;
+        w = s.written.fetch_add(1, std::memory_order_relaxed);
+        if (w - s.drained >= kSlots) return true;
+        s.slots[w % kSlots].store(item, std::memory_order_relaxed);
+        return w - s.drained >= kSlots / 2;
+    }
+
+    template<typename Fn>
+    void drain(Fn fn) {
+        for (auto &s : stripes) {
+            const uint32_t w = s.written.load(std::memory_order_relaxed);
+            const uint32_t n = w - s.drained < kSlots ? w - s.drained : uint32_t(kSlots);
+            for (uint32_t i = 0; i < n; ++i) {
+                auto &slot = s.slots[(s.drained + i) % kSlots];
+                T item = slot.load(std::memory_order_relaxed);
+                if (item == T{}) continue;
+                slot.store(T{}, std::memory_order_relaxed);
+                fn(item);
+            }
+            s.drained = w;
+        }
+    }
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic<uint32_t> written{0};
+        uint32_t drained = 0;  // only changed by drain()
+        std::atomic<T> slots[kSlots];
+    };
+
+    Stripe stripes[kStripes];
+
+    static size_t stripeIndex() {
+        static thread_local const size_t index =
+            (std::hash<std::thread::id>{}(std::this_thread::get_id()) * 0x9e3779b97f4a7c15ULL >> 32) % kStripes;
+        return index;
+    }
+};
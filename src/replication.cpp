@@ -0,0 +1,235 @@
+#include "replication.h"
+
+#include <Poco/Exception.h>
+#include <Poco/Net/SocketAddress.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <initializer_list>
+#include <stdexcept>
+
+namespace {
+
+constexpr auto kHeartbeat = std::chrono::seconds(1);
+constexpr long kSilenceSeconds = 5;  // a replica reconnects when its primary is quiet this long
+constexpr auto kRetry = std::chrono::seconds(1);
+
+void appendCommand(std::string &out, std::initializer_list<std::string_view> args) {
+    out += '*';
+    out += std::to_string(args.size());
+    out += "\r\n";
+    for (auto arg : args) {
+        out += '$';
+        out += std::to_string(arg.size());
+        out += "\r\n";
+        out += arg;
+        out += "\r\n";
+    }
+}
+
+void appendEntry(std::string &out, std::string_view key, std::string_view value, const EntryMeta &meta) {
+    appendCommand(out, {"RESTORE", key, value, std::to_string(meta.ttlMs), std::to_string(meta.freq)});
+}
+
+void sendAll(Poco::Net::StreamSocket &socket, std::string_view bytes) {
+    while (!bytes.empty()) {
+        const int n = socket.sendBytes(bytes.data(), static_cast<int>(std::min<size_t>(bytes.size(), 1 << 30)));
+        if (n <= 0) throw Poco::IOException("replication send failed");
+        bytes.remove_prefix(static_cast<size_t>(n));
+    }
+}
+
+}  // namespace
+
+ReplicationSource::~ReplicationSource() {
+    stop();
+}
+
+uint64_t ReplicationSource::onPut(std::string_view key, std::string_view value, std::chrono::milliseconds ttl) {
+    // Unsynchronised check: a replica registered after it dumps this partition later, under the
+    // lock this put holds, so the dump has the entry.
+    if (active.load(std::memory_order_acquire) == 0) return 0;
+    std::string command;
+    if (ttl.count() > 0)
+        appendCommand(command, {"SET", key, value, "PX", std::to_string(ttl.count())});
+    else
+        appendCommand(command, {"SET", key, value});
+    enqueue(command);
+    return 0;
+}
+
+uint64_t ReplicationSource::onRemove(std::string_view key) {
+    if (active.load(std::memory_order_acquire) == 0) return 0;
+    std::string command;
+    appendCommand(command, {"DEL", key});
+    enqueue(command);
+    return 0;
+}
+
+void ReplicationSource::enqueue(const std::string &command) {
+    std::lock_guard lock(mutex);
+    for (Replica *r : replicas) {
+        if (r->dropped) continue;
+        if (r->queued.size() + command.size() > maxBacklog) {
+            r->dropped = true;
+            r->ready.notify_one();
+            continue;
+        }
+        const bool wake = r->queued.empty();
+        r->queued += command;
+        if (wake) r->ready.notify_one();
+    }
+}
+
+void ReplicationSource::serve(Poco::Net::StreamSocket &socket) {
+    Replica replica;
+    {
+        std::lock_guard lock(mutex);
+        if (stopping) return;
+        replicas.push_back(&replica);
+        active.store(replicas.size(), std::memory_order_release);
+    }
+    std::string out;
+    try {
+        sendAll(socket, "+FULLSYNC\r\n");
+        for (size_t i = 0; i < storage->partitionsCount(); ++i) {
+            out.clear();
+            storage->dumpPartition(i, out, appendEntry);
+            sendAll(socket, out);
+        }
+        sendAll(socket, "+SYNCED\r\n");
+
+        // Whatever queued up while the previous batch was being sent goes out as the next one.
+        std::unique_lock lock(mutex);
+        while (true) {
+            replica.ready.wait_for(lock, kHeartbeat,
+                                   [&] { return !replica.queued.empty() || replica.dropped || stopping; });
+            if (replica.dropped || stopping) break;
+            out.clear();
+            if (replica.queued.empty()) appendCommand(out, {"PING"});
+            else out.swap(replica.queued);
+            lock.unlock();
+            sendAll(socket, out);
+            lock.lock();
+        }
+        if (replica.dropped) std::fprintf(stderr, "replica dropped: more than %zu bytes behind\n", maxBacklog);
+    } catch (const Poco::Exception &) {
+    }
+
+    std::lock_guard lock(mutex);
+    replicas.erase(std::find(replicas.begin(), replicas.end(), &replica));
+    active.store(replicas.size(), std::memory_order_release);
+}
+
+void ReplicationSource::stop() {
+    std::lock_guard lock(mutex);
+    stopping = true;
+    for (Replica *r : replicas) r->ready.notify_one();
+}
+
+ReplicationStats ReplicationSource::stats() const {
+    ReplicationStats st;
+    std::lock_guard lock(mutex);
+    st.replicas = replicas.size();
+    for (const Replica *r : replicas) st.backlogBytes += r->queued.size();
+    return st;
+}
+
+void ReplicaLink::start() {
+    running.store(true);
+    thread = std::thread([this] { run(); });
+}
+
+void ReplicaLink::stop() {
+    if (!running.exchange(false)) return;
+    {
+        std::lock_guard lock(socketMutex);
+        try {
+            socket.shutdown();
+        } catch (const Poco::Exception &) {
+        }
+    }
+    if (thread.joinable()) thread.join();
+}
+
+ReplicationStats ReplicaLink::stats() const {
+    ReplicationStats st;
+    st.synced = synced.load();
+    st.applied = applied.load(std::memory_order_relaxed);
+    st.fullSyncs = fullSyncs.load(std::memory_order_relaxed);
+    return st;
+}
+
+void ReplicaLink::run() {
+    bool reported = false;  // a failure to connect is logged once until the next success
+    while (running.load()) {
+        try {
+            Poco::Net::StreamSocket s;
+            s.connect(Poco::Net::SocketAddress(host, static_cast<Poco::UInt16>(port)), Poco::Timespan(1, 0));
+            s.setNoDelay(true);
+            s.setReceiveTimeout(Poco::Timespan(kSilenceSeconds, 0));
+            {
+                // stop() shuts down whatever socket is here; past this point it sees the new one.
+                std::lock_guard lock(socketMutex);
+                socket = s;
+            }
+            reported = false;
+            if (running.load()) follow();
+            if (running.load()) std::fprintf(stderr, "replication from %s:%d: connection closed\n", host.c_str(), port);
+        } catch (const std::exception &e) {
+            if (running.load() && !reported)
+                std::fprintf(stderr, "replication from %s:%d: %s\n", host.c_str(), port, e.what());
+            reported = true;
+        }
+        synced.store(false);
+        for (auto waited = std::chrono::milliseconds(0); running.load() && waited < kRetry;
+             waited += std::chrono::milliseconds(100))
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+void ReplicaLink::follow() {
+    sendAll(socket, "*1\r\n$4\r\nSYNC\r\n");
+    RespReplyReader reader;
+    RespReply reply;
+    std::vector<char> buf(64 * 1024);
+    while (running.load()) {
+        const int n = socket.receiveBytes(buf.data(), static_cast<int>(buf.size()));
+        if (n <= 0) return;
+        reader.feed(buf.data(), static_cast<size_t>(n));
+        while (reader.next(reply)) apply(reply);
+    }
+}
+
+void ReplicaLink::apply(const RespReply &reply) {
+    using Type = RespReply::Type;
+    if (reply.type == Type::Simple) {
+        if (reply.str == "FULLSYNC") {
+            synced.store(false);
+            storage->clear();
+            fullSyncs.fetch_add(1, std::memory_order_relaxed);
+        } else if (reply.str == "SYNCED") {
+            synced.store(true);
+            std::printf("Replica synced from %s:%d, %zu keys\n", host.c_str(), port, storage->size());
+        }
+        return;
+    }
+    if (reply.type == Type::Error) throw std::runtime_error(reply.str);
+    if (reply.type != Type::Array || reply.elements.empty()) throw std::runtime_error("bad replication stream");
+
+    const auto &args = reply.elements;
+    const std::string &cmd = args[0].str;
+    if (cmd == "RESTORE" && args.size() == 5) {
+        storage->restore(args[1].str, args[2].str, EntryMeta{std::stoll(args[3].str), std::stoull(args[4].str)});
+    } else if (cmd == "SET" && (args.size() == 3 || args.size() == 5)) {
+        const long long ttl = args.size() == 5 ? std::stoll(args[4].str) : 0;
+        storage->put(args[1].str, args[2].str, std::chrono::milliseconds(ttl));
+    } else if (cmd == "DEL" && args.size() == 2) {
+        storage->remove(args[1].str);
+    } else if (cmd == "PING") {
+        return;
+    } else {
+        throw std::runtime_error("bad replication command " + cmd);
+    }
+    applied.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <Poco/Net/StreamSocket.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "shard_client.h"
+#include "storage.h"
+
+// Asynchronous primary-replica replication over the RESP listener. A replica connects to its
+// primary's RESP port and sends SYNC; the primary answers on that connection with
+//   +FULLSYNC                              the replica drops what it has
+//   *5 RESTORE key value ttl_ms freq       one per live entry, a partition at a time
+//   +SYNCED                                end of the dump
+// followed by its mutations, in batches, as they are applied:
+//   *3 SET key value  |  *5 SET key value PX ttl_ms  |  *2 DEL key
+//   *1 PING                                once a second when there is nothing to send
+// Expirations are not sent: entries carry their deadline, and a replica's reaper drops them on its
+// own clock.
+
+struct ReplicationStats {
+    size_t replicas = 0;      // primary: replicas being fed
+    size_t backlogBytes = 0;  // primary: mutations queued for them, not yet sent
+    bool synced = false;      // replica: past the dump and following the stream
+    uint64_t applied = 0;     // replica: commands applied from the primary
+    uint64_t fullSyncs = 0;   // replica: dumps received
+};
+
+// The primary's side. serve() runs on the thread of the RESP connection that sent SYNC: it
+// registers the replica first, so every mutation from then on is queued for it, then streams a
+// dump and the queue. A mutation made during the dump may reach the replica twice, in the dump and
+// from the queue, but always in the order the partition applied it, so the replica ends in the
+// primary's state. A replica more than maxBacklog bytes behind is dropped and has to resync.
+class ReplicationSource : public MutationListener {
+public:
+    explicit ReplicationSource(KVstorage<std::string, std::string> *storage, size_t maxBacklog = size_t(256) << 20)
+        : storage(storage), maxBacklog(maxBacklog) {
+    }
+
+    ~ReplicationSource() override;
+
+    uint64_t onPut(std::string_view key, std::string_view value, std::chrono::milliseconds ttl) override;
+
+    uint64_t onRemove(std::string_view key) override;
+
+    // Returns once the replica disconnects, is dropped, or stop() is called.
+    void serve(Poco::Net::StreamSocket &socket);
+
+    void stop();
+
+    ReplicationStats stats() const;
+
+private:
+    struct Replica {
+        std::string queued;
+        bool dropped = false;
+        std::condition_variable ready;
+    };
+
+    KVstorage<std::string, std::string> *storage;
+    size_t maxBacklog;
+    mutable std::mutex mutex;
+    std::vector<Replica *> replicas;
+    std::atomic<size_t> active{0};  // replicas.size(), read without the mutex on every mutation
+    bool stopping = false;
+
+    void enqueue(const std::string &command);
+};
+
+// The replica's side: keeps a connection to the primary, asks for SYNC and applies what comes
+// back to the local storage. A broken connection, or one silent for longer than the heartbeat
+// allows, is reopened after a second with a new full sync.
+class ReplicaLink {
+public:
+    ReplicaLink(KVstorage<std::string, std::string> *storage, std::string host, int port)
+        : storage(storage), host(std::move(host)), port(port) {
+    }
+
+    ~ReplicaLink() {
+        stop();
+    }
+
+    ReplicaLink(const ReplicaLink &) = delete;
+    ReplicaLink &operator=(const ReplicaLink &) = delete;
+
+    void start();
+
+    void stop();
+
+    ReplicationStats stats() const;
+
+private:
+    KVstorage<std::string, std::string> *storage;
+    std::string host;
+    int port;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::mutex socketMutex;  // guards `socket` between the link thread and stop()
+    Poco::Net::StreamSocket socket;
+    std::atomic<bool> synced{false};
+    std::atomic<uint64_t> applied{0};
+    std::atomic<uint64_t> fullSyncs{0};
+
+    void run();
+    // Reads and applies until the connection ends.
+    void follow();
+    void apply(const RespReply &reply);
+};
@@ -0,0 +1,338 @@
+#include "resp.h"
+
+#include <Poco/Exception.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+#include "metrics.h"
+
+namespace {
+
+constexpr size_t kMaxRequest = 512 * 1024 * 1024;
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::toupper(static_cast<unsigned char>(x)) == std::toupper(static_cast<unsigned char>(y));
+           });
+}
+
+// writev until every segment is out, picking up after partial writes.
+bool writeAll(int fd, std::vector<iovec> &iov) {
+    size_t first = 0;
+    while (first < iov.size()) {
+        const int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+        ssize_t n = ::writev(fd, iov.data() + first, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        size_t left = size_t(n);
+        while (first < iov.size() && left >= iov[first].iov_len) left -= iov[first++].iov_len;
+        if (left > 0) {
+            iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + left;
+            iov[first].iov_len -= left;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+bool RespParser::readLine(const char *data, size_t len, size_t &pos, std::string_view &line) {
+    const char *begin = data + pos;
+    const char *nl = static_cast<const char *>(std::memchr(begin, '\n', len - pos));
+    if (!nl) return false;
+    const char *end = (nl > begin && nl[-1] == '\r') ? nl - 1 : nl;
+    line = std::string_view(begin, end - begin);
+    pos = nl - data + 1;
+    return true;
+}
+
+bool RespParser::parseInt(std::string_view s, long long &out) {
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+    return ec == std::errc() && ptr == s.data() + s.size();
+}
+
+RespParser::Result RespParser::parse(const char *data, size_t len, size_t &consumed,
+                                     std::vector<std::string_view> &args) {
+    args.clear();
+    size_t pos = 0;
+    std::string_view line;
+    if (!readLine(data, len, pos, line)) return len > 64 * 1024 ? Result::Error : Result::Incomplete;
+
+    if (line.empty() || line[0] != '*') {
+        // Inline command, as typed into telnet.
+        size_t i = 0;
+        while (i < line.size()) {
+            while (i < line.size() && line[i] == ' ') ++i;
+            size_t start = i;
+            while (i < line.size() && line[i] != ' ') ++i;
+            if (i > start) args.push_back(line.substr(start, i - start));
+        }
+        consumed = pos;
+        return Result::Ok;
+    }
+
+    long long count = 0;
+    if (!parseInt(line.substr(1), count) || count < 0 || count > 1024 * 1024) return Result::Error;
+    for (long long i = 0; i < count; ++i) {
+        if (!readLine(data, len, pos, line)) return Result::Incomplete;
+        long long size = 0;
+        if (line.empty() || line[0] != '$' || !parseInt(line.substr(1), size) || size < 0 ||
+            size_t(size) > kMaxRequest)
+            return Result::Error;
+        if (len - pos < size_t(size) + 2) return Result::Incomplete;
+        args.emplace_back(data + pos, size_t(size));
+        pos += size_t(size) + 2;
+    }
+    consumed = pos;
+    return Result::Ok;
+}
+
+void RespConnection::run() {
+    Poco::Net::StreamSocket &sock = socket();
+    sock.setNoDelay(true);
+
+    RespParser parser;
+    std::vector<std::string_view> args;
+    std::vector<char> in(16 * 1024);
+    size_t begin = 0;
+    size_t end = 0;
+    bool open = true;
+
+    try {
+        while (open) {
+            if (end == in.size()) {
+                if (begin > 0) {
+                    std::memmove(in.data(), in.data() + begin, end - begin);
+                    end -= begin;
+                    begin = 0;
+                } else if (in.size() < kMaxRequest) {
+                    in.resize(in.size() * 2);
+                } else {
+                    break;
+                }
+            }
+            int n = sock.receiveBytes(in.data() + end, static_cast<int>(in.size() - end));
+            if (n <= 0) break;
+            end += static_cast<size_t>(n);
+
+            while (open && begin < end) {
+                size_t consumed = 0;
+                metrics::StageTimer timer;
+                auto res = parser.parse(in.data() + begin, end - begin, consumed, args);
+                timer.lap(metrics::Stage::Parse);
+                if (res == RespParser::Result::Incomplete) break;
+                if (res == RespParser::Result::Error) {
+                    replyError("ERR Protocol error");
+                    open = false;
+                    break;
+                }
+                begin += consumed;
+                if (!args.empty()) open = execute(args);
+            }
+            if (begin == end) begin = end = 0;
+
+            if (!flush(sock)) open = false;
+        }
+    } catch (const Poco::Exception &) {
+    }
+}
+
+bool RespConnection::redirectIfNeeded(std::string_view key) {
+    if (shards.size() == 1) return false;
+    size_t idx = ring.owner(key);
+    if (static_cast<int>(idx) == curr) return false;
+    const std::string &addr = shards[idx];
+    std::string host = addr.substr(0, addr.rfind(':'));
+    out += "-MOVED " + std::to_string(idx) + " " + host + ":" + std::to_string(basePort + idx) + "\r\n";
+    return true;
+}
+
+bool RespConnection::redirectAnyIfNeeded(const std::vector<std::string_view> &args) {
+    for (size_t i = 1; i < args.size(); ++i)
+        if (redirectIfNeeded(args[i])) return true;
+    return false;
+}
+
+void RespConnection::get(std::string_view key) {
+    // A small value goes from the cache straight into the reply buffer; a large one is retained
+    // and written from its own buffer by flush(), after the lock is released.
+    SharedValue large;
+    const bool found = storage->get(key, [&](const ValueView &value) {
+        if (value.buffer) large = SharedValue(value.buffer); else replyBulk(value.bytes);
+    });
+    if (!found) replyNull(); else if (large) replyShared(std::move(large));
+}
+
+bool RespConnection::execute(const std::vector<std::string_view> &args) {
+    std::string_view cmd = args[0];
+    const size_t argc = args.size();
+
+    if (equalsIgnoreCase(cmd, "GET")) {
+        if (argc != 2) {
+            replyError("ERR wrong number of arguments for 'get' command");
+        } else if (!redirectIfNeeded(args[1])) {
+            get(args[1]);
+        }
+    } else if (equalsIgnoreCase(cmd, "NEARGET")) {
+        // NEARGET key shard: GET for a shard that keeps a copy, tracked before the read so any
+        // later write invalidates it.
+        long long shard = 0;
+        if (argc != 3 || !RespParser::parseInt(args[2], shard) || shard < 0) {
+            replyError("ERR wrong number of arguments for 'nearget' command");
+        } else if (!nearCache) {
+            replyError("ERR near cache is not served here");
+        } else if (!redirectIfNeeded(args[1])) {
+            nearCache->track(args[1], static_cast<size_t>(shard));
+            get(args[1]);
+        }
+    } else if (equalsIgnoreCase(cmd, "INVALIDATE")) {
+        if (!nearCache) {
+            replyError("ERR near cache is not served here");
+            return true;
+        }
+        for (size_t i = 1; i < argc; ++i) nearCache->invalidate(args[i]);
+        replySimple("OK");
+    } else if (readOnly && (equalsIgnoreCase(cmd, "SET") || equalsIgnoreCase(cmd, "DEL") ||
+                            equalsIgnoreCase(cmd, "UNLINK"))) {
+        replyError("READONLY You can't write against a read only replica.");
+    } else if (equalsIgnoreCase(cmd, "SET")) {
+        // EX seconds / PX milliseconds set the entry's ttl; other options (NX, XX, ...) are accepted
+        // for client compatibility and ignored.
+        if (argc < 3) {
+            replyError("ERR wrong number of arguments for 'set' command");
+            return true;
+        }
+        std::chrono::milliseconds ttl(0);
+        for (size_t i = 3; i < argc; ++i) {
+            const bool seconds = equalsIgnoreCase(args[i], "EX");
+            if (!seconds && !equalsIgnoreCase(args[i], "PX")) continue;
+            long long n = 0;
+            if (i + 1 == argc || !RespParser::parseInt(args[i + 1], n) || n <= 0) {
+                replyError("ERR invalid expire time in 'set' command");
+                return true;
+            }
+            ttl = std::chrono::milliseconds(seconds ? n * 1000 : n);
+            ++i;
+        }
+        if (!redirectIfNeeded(args[1])) {
+            storage->put(args[1], args[2], ttl);
+            replySimple("OK");
+        }
+    } else if (equalsIgnoreCase(cmd, "DEL") || equalsIgnoreCase(cmd, "UNLINK")) {
+        if (argc < 2) {
+            replyError("ERR wrong number of arguments for 'del' command");
+            return true;
+        }
+        if (redirectAnyIfNeeded(args)) return true;
+        long long removed = 0;
+        for (size_t i = 1; i < argc; ++i) removed += storage->remove(args[i]);
+        replyInt(removed);
+    } else if (equalsIgnoreCase(cmd, "EXISTS")) {
+        if (argc < 2) {
+            replyError("ERR wrong number of arguments for 'exists' command");
+            return true;
+        }
+        if (redirectAnyIfNeeded(args)) return true;
+        long long found = 0;
+        for (size_t i = 1; i < argc; ++i) found += storage->get(args[i], [](const ValueView &) {}, false);
+        replyInt(found);
+    } else if (equalsIgnoreCase(cmd, "PING")) {
+        if (argc > 1) replyBulk(args[1]); else replySimple("PONG");
+    } else if (equalsIgnoreCase(cmd, "ECHO")) {
+        if (argc != 2) replyError("ERR wrong number of arguments for 'echo' command"); else replyBulk(args[1]);
+    } else if (equalsIgnoreCase(cmd, "QUIT")) {
+        replySimple("OK");
+        return false;
+    } else if (equalsIgnoreCase(cmd, "SYNC")) {
+        if (!replication) {
+            replyError("ERR replication is not served here");
+            return true;
+        }
+        // The connection now belongs to the replica: pending replies go first, then the stream.
+        if (flush(socket())) replication->serve(socket());
+        return false;
+    } else if (equalsIgnoreCase(cmd, "COMMAND")) {
+        out += "*0\r\n";
+    } else if (equalsIgnoreCase(cmd, "CLIENT") || equalsIgnoreCase(cmd, "SELECT")) {
+        replySimple("OK");
+    } else {
+        out += "-ERR unknown command '";
+        out.append(cmd.data(), std::min<size_t>(cmd.size(), 64));
+        out += "'\r\n";
+    }
+    return true;
+}
+
+void RespConnection::replySimple(std::string_view s) {
+    out += '+';
+    out += s;
+    out += "\r\n";
+}
+
+void RespConnection::replyError(std::string_view s) {
+    out += '-';
+    out += s;
+    out += "\r\n";
+}
+
+void RespConnection::replyInt(long long n) {
+    out += ':';
+    out += std::to_string(n);
+    out += "\r\n";
+}
+
+void RespConnection::replyBulk(std::string_view s) {
+    out += '$';
+    out += std::to_string(s.size());
+    out += "\r\n";
+    out += s;
+    out += "\r\n";
+}
+
+void RespConnection::replyShared(SharedValue value) {
+    out += '$';
+    out += std::to_string(value.view().size());
+    out += "\r\n";
+    held.push_back(Held{out.size(), std::move(value)});
+    out += "\r\n";
+}
+
+bool RespConnection::flush(Poco::Net::StreamSocket &sock) {
+    if (out.empty()) return true;
+    metrics::StageTimer timer;
+    if (held.empty()) {
+        sock.sendBytes(out.data(), static_cast<int>(out.size()));
+        timer.lap(metrics::Stage::Write);
+        out.clear();
+        return true;
+    }
+    std::vector<iovec> iov;
+    iov.reserve(2 * held.size() + 1);
+    size_t from = 0;
+    for (const auto &h : held) {
+        const std::string_view value = h.value.view();
+        iov.push_back(iovec{out.data() + from, h.offset - from});
+        iov.push_back(iovec{const_cast<char *>(value.data()), value.size()});
+        from = h.offset;
+    }
+    iov.push_back(iovec{out.data() + from, out.size() - from});
+    const bool ok = writeAll(sock.impl()->sockfd(), iov);
+    timer.lap(metrics::Stage::Write);
+    out.clear();
+    held.clear();
+    return ok;
+}
+
+void RespConnection::replyNull() {
+    out += "$-1\r\n";
+}
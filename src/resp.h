@@ -0,0 +1,115 @@
+#pragma once
+#include <Poco/Net/StreamSocket.h>
+#include <Poco/Net/TCPServerConnection.h>
+#include <Poco/Net/TCPServerConnectionFactory.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "near_cache.h"
+#include "replication.h"
+#include "routing.h"
+#include "storage.h"
+
+// Parses one RESP2 request (an array of bulk strings, or an inline command) straight out of the
+// receive buffer. The arguments are views into that buffer and stay valid until it is refilled.
+class RespParser {
+public:
+    enum class Result { Ok, Incomplete, Error };
+
+    Result parse(const char *data, size_t len, size_t &consumed, std::vector<std::string_view> &args);
+
+    static bool parseInt(std::string_view s, long long &out);
+
+private:
+    static bool readLine(const char *data, size_t len, size_t &pos, std::string_view &line);
+};
+
+// Serves the RESP2 subset used by redis clients for plain key-value traffic: GET, SET, DEL,
+// EXISTS, PING, ECHO, QUIT, plus no-op COMMAND/CLIENT/SELECT so handshakes succeed. Every batch of
+// pipelined requests read in one recv is answered with a single send. On a primary, SYNC turns the
+// connection into a replication stream (see ReplicationSource); a replica answers writes with
+// -READONLY. With a near cache, shards exchange NEARGET and INVALIDATE (see NearCache).
+class RespConnection : public Poco::Net::TCPServerConnection {
+public:
+    RespConnection(const Poco::Net::StreamSocket &socket,
+                   KVstorage<std::string, std::string> *storage,
+                   const std::vector<std::string> &shards,
+                   const ShardRing &ring,
+                   int curr,
+                   int basePort,
+                   ReplicationSource *replication,
+                   bool readOnly,
+                   NearCache *nearCache)
+        : Poco::Net::TCPServerConnection(socket), storage(storage), shards(shards), ring(ring), curr(curr),
+          basePort(basePort), replication(replication), readOnly(readOnly), nearCache(nearCache) {
+    }
+
+    void run() override;
+
+private:
+    KVstorage<std::string, std::string> *storage;
+    const std::vector<std::string> &shards;
+    const ShardRing &ring;
+    int curr;
+    int basePort;
+    ReplicationSource *replication;
+    bool readOnly;
+    NearCache *nearCache;
+    std::string out;
+
+    // A large GET value waiting in the reply: it goes out from its buffer, after out[0, offset).
+    struct Held {
+        size_t offset;
+        SharedValue value;
+    };
+    std::vector<Held> held;
+
+    // Returns false when the connection should be closed after flushing.
+    bool execute(const std::vector<std::string_view> &args);
+    void get(std::string_view key);
+    bool redirectIfNeeded(std::string_view key);
+    // Multi-key commands are redirected as a whole to the owner of the first foreign key.
+    bool redirectAnyIfNeeded(const std::vector<std::string_view> &args);
+
+    void replySimple(std::string_view s);
+    void replyError(std::string_view s);
+    void replyInt(long long n);
+    void replyBulk(std::string_view s);
+    void replyShared(SharedValue value);
+    void replyNull();
+
+    // Sends the pending reply; false if the connection failed.
+    bool flush(Poco::Net::StreamSocket &sock);
+};
+
+class RespConnectionFactory : public Poco::Net::TCPServerConnectionFactory {
+public:
+    // Shard i listens for RESP on basePort + i, on the host of its HTTP address. A primary passes
+    // its ReplicationSource to serve SYNC; a replica passes none and readOnly.
+    RespConnectionFactory(KVstorage<std::string, std::string> *storage,
+                          const std::vector<std::string> &shards,
+                          int curr,
+                          int basePort,
+                          ReplicationSource *replication = nullptr,
+                          bool readOnly = false,
+                          NearCache *nearCache = nullptr)
+        : storage(storage), shards(shards), ring(this->shards), curr(curr), basePort(basePort),
+          replication(replication), readOnly(readOnly), nearCache(nearCache) {
+    }
+
+    Poco::Net::TCPServerConnection *createConnection(const Poco::Net::StreamSocket &socket) override {
+        return new RespConnection(socket, storage, shards, ring, curr, basePort, replication, readOnly, nearCache);
+    }
+
+private:
+    KVstorage<std::string, std::string> *storage;
+    std::vector<std::string> shards;
+    ShardRing ring;
+    int curr;
+    int basePort;
+    ReplicationSource *replication;
+    bool readOnly;
+    NearCache *nearCache;
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "hash.h"
+
+// Consistent-hash ring over the shard list. Every shard contributes `vnodes` points at
+// xxh64("<host:port>#<i>"); a key belongs to the shard of the first point at or after
+// xxh64(key), wrapping around. Points depend only on a shard's address, so adding or removing
+// one shard moves about 1/N of the keys and the order of the `shards` list does not matter.
+// util/timkv_routing.py implements the same ring for clients.
+class ShardRing {
+public:
+    static constexpr size_t kDefaultVnodes = 160;
+
+    explicit ShardRing(const std::vector<std::string> &shards, size_t vnodes = kDefaultVnodes)
+        : shardsCount(shards.size()) {
+        points.reserve(shards.size() * vnodes);
+        for (size_t s = 0; s < shards.size(); ++s) {
+            for (size_t i = 0; i < vnodes; ++i) {
+                std::string label = shards[s] + "#" + std::to_string(i);
+                points.emplace_back(xxh64(label), static_cast<uint32_t>(s));
+            }
+        }
+        std::sort(points.begin(), points.end());
+    }
+
+    // Index into the shard list of the shard that owns key.
+    size_t owner(std::string_view key) const {
+        if (shardsCount <= 1) return 0;
+        const uint64_t h = xxh64(key);
+        auto it = std::lower_bound(points.begin(), points.end(), h,
+                                   [](const std::pair<uint64_t, uint32_t> &p, uint64_t v) { return p.first < v; });
+        if (it == points.end()) it = points.begin();
+        return it->second;
+    }
+
+    size_t size() const {
+        return shardsCount;
+    }
+
+private:
+    std::vector<std::pair<uint64_t, uint32_t>> points;
+    size_t shardsCount;
+};
@@ -0,0 +1,225 @@
+#include "shard_client.h"
+
+#include <Poco/Exception.h>
+#include <Poco/Net/SocketAddress.h>
+
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+void RespReplyReader::feed(const char *data, size_t len) {
+    if (pos > 0 && pos == buf.size()) {
+        buf.clear();
+        pos = 0;
+    } else if (pos > 64 * 1024) {
+        buf.erase(0, pos);
+        pos = 0;
+    }
+    buf.append(data, len);
+}
+
+bool RespReplyReader::next(RespReply &reply) {
+    size_t at = pos;
+    if (!parse(at, reply)) return false;
+    pos = at;
+    return true;
+}
+
+bool RespReplyReader::parse(size_t &at, RespReply &reply) {
+    size_t nl = buf.find("\r\n", at);
+    if (nl == std::string::npos) return false;
+    const char tag = buf[at];
+    const char *num = buf.data() + at + 1;
+    const char *numEnd = buf.data() + nl;
+    const size_t after = nl + 2;
+
+    auto readInt = [&] {
+        long long v = 0;
+        auto [ptr, ec] = std::from_chars(num, numEnd, v);
+        if (ec != std::errc() || ptr != numEnd) throw std::runtime_error("bad RESP integer");
+        return v;
+    };
+
+    switch (tag) {
+        case '+':
+        case '-':
+            reply = RespReply{};
+            reply.type = tag == '+' ? RespReply::Type::Simple : RespReply::Type::Error;
+            reply.str.assign(num, numEnd);
+            at = after;
+            return true;
+        case ':':
+            reply = RespReply{};
+            reply.type = RespReply::Type::Integer;
+            reply.integer = readInt();
+            at = after;
+            return true;
+        case '$': {
+            long long len = readInt();
+            reply = RespReply{};
+            if (len < 0) {
+                reply.type = RespReply::Type::Null;
+                at = after;
+                return true;
+            }
+            if (buf.size() < after + size_t(len) + 2) return false;
+            reply.type = RespReply::Type::Bulk;
+            reply.str.assign(buf, after, size_t(len));
+            at = after + size_t(len) + 2;
+            return true;
+        }
+        case '*': {
+            long long count = readInt();
+            RespReply arr;
+            if (count < 0) {
+                arr.type = RespReply::Type::Null;
+                at = after;
+                reply = std::move(arr);
+                return true;
+            }
+            arr.type = RespReply::Type::Array;
+            size_t cur = after;
+            for (long long i = 0; i < count; ++i) {
+                RespReply elem;
+                if (!parse(cur, elem)) return false;
+                arr.elements.push_back(std::move(elem));
+            }
+            at = cur;
+            reply = std::move(arr);
+            return true;
+        }
+        default:
+            throw std::runtime_error("bad RESP reply");
+    }
+}
+
+ShardClient::ShardClient(std::string host, int port, std::chrono::milliseconds timeout)
+    : host(std::move(host)), port(port), timeout(timeout) {
+}
+
+ShardClient::~ShardClient() {
+    std::lock_guard lock(mutex);
+    if (conn) {
+        try {
+            conn->socket.shutdown();
+        } catch (const Poco::Exception &) {
+        }
+        if (conn->reader.joinable()) conn->reader.join();
+    }
+}
+
+bool ShardClient::ensureConnected() {
+    if (conn) {
+        {
+            std::lock_guard connLock(conn->mutex);
+            if (conn->alive) return true;
+        }
+        if (conn->reader.joinable()) conn->reader.join();
+        conn.reset();
+    }
+    try {
+        auto c = std::make_unique<Connection>();
+        c->socket.connect(Poco::Net::SocketAddress(host, static_cast<Poco::UInt16>(port)),
+                          Poco::Timespan(timeout.count() * 1000));
+        c->socket.setNoDelay(true);
+        c->reader = std::thread(readLoop, c.get());
+        conn = std::move(c);
+        return true;
+    } catch (const Poco::Exception &) {
+        return false;
+    }
+}
+
+std::future<RespReply> ShardClient::send(const std::vector<std::string_view> &args) {
+    auto unavailable = [this] {
+        std::promise<RespReply> failed;
+        failed.set_value(RespReply::error("ERR shard " + host + ":" + std::to_string(port) + " unavailable"));
+        return failed.get_future();
+    };
+    std::lock_guard lock(mutex);
+    if (!ensureConnected()) return unavailable();
+
+    out.clear();
+    out += '*';
+    out += std::to_string(args.size());
+    out += "\r\n";
+    for (auto arg : args) {
+        out += '$';
+        out += std::to_string(arg.size());
+        out += "\r\n";
+        out += arg;
+        out += "\r\n";
+    }
+
+    std::future<RespReply> reply;
+    {
+        std::lock_guard connLock(conn->mutex);
+        // The reader may have failed the connection since ensureConnected(), and nothing would
+        // answer a request queued now; the next send reconnects.
+        if (!conn->alive) return unavailable();
+        conn->pending.emplace_back();
+        reply = conn->pending.back().get_future();
+    }
+    try {
+        conn->socket.sendBytes(out.data(), static_cast<int>(out.size()));
+    } catch (const Poco::Exception &) {
+        // The reader notices the shutdown and fails everything still pending, this request included.
+        try {
+            conn->socket.shutdown();
+        } catch (const Poco::Exception &) {
+        }
+    }
+    return reply;
+}
+
+RespReply ShardClient::call(const std::vector<std::string_view> &args) {
+    auto reply = send(args);
+    return wait(reply);
+}
+
+RespReply ShardClient::wait(std::future<RespReply> &reply) {
+    if (reply.wait_for(timeout) != std::future_status::ready) {
+        // A failed connection fails its requests, so the one that timed out is still the current
+        // one: a peer gone without a word. Drop it so the next send reconnects instead of timing
+        // out again.
+        std::lock_guard lock(mutex);
+        if (reply.wait_for(std::chrono::seconds(0)) == std::future_status::ready) return reply.get();
+        if (conn) fail(conn.get(), "ERR shard timeout");
+        return RespReply::error("ERR shard " + host + ":" + std::to_string(port) + " timeout");
+    }
+    return reply.get();
+}
+
+void ShardClient::readLoop(Connection *c) {
+    RespReplyReader reader;
+    std::vector<char> buf(64 * 1024);
+    try {
+        while (true) {
+            int n = c->socket.receiveBytes(buf.data(), static_cast<int>(buf.size()));
+            if (n <= 0) break;
+            reader.feed(buf.data(), static_cast<size_t>(n));
+            RespReply reply;
+            while (reader.next(reply)) {
+                std::lock_guard lock(c->mutex);
+                if (c->pending.empty()) throw std::runtime_error("unsolicited reply");
+                c->pending.front().set_value(std::move(reply));
+                c->pending.pop_front();
+            }
+        }
+        fail(c, "ERR shard connection closed");
+    } catch (const std::exception &e) {
+        fail(c, std::string("ERR shard connection: ") + e.what());
+    }
+}
+
+void ShardClient::fail(Connection *c, const std::string &reason) {
+    std::lock_guard lock(c->mutex);
+    c->alive = false;
+    for (auto &p : c->pending) p.set_value(RespReply::error(reason));
+    c->pending.clear();
+    // Only shut down: a sender may still be using the descriptor, it is closed with the Connection.
+    try {
+        c->socket.shutdown();
+    } catch (const Poco::Exception &) {
+    }
+}
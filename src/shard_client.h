@@ -0,0 +1,85 @@
+#pragma once
+#include <Poco/Net/StreamSocket.h>
+
+#include <chrono>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct RespReply {
+    enum class Type { Simple, Error, Integer, Bulk, Null, Array };
+
+    Type type = Type::Null;
+    std::string str;
+    long long integer = 0;
+    std::vector<RespReply> elements;
+
+    bool isError() const { return type == Type::Error; }
+
+    static RespReply error(std::string message) {
+        RespReply r;
+        r.type = Type::Error;
+        r.str = std::move(message);
+        return r;
+    }
+};
+
+// Incremental RESP2 reply decoder.
+class RespReplyReader {
+public:
+    void feed(const char *data, size_t len);
+    // Pops the next complete reply; false if more bytes are needed. Throws on malformed input.
+    bool next(RespReply &reply);
+
+private:
+    std::string buf;
+    size_t pos = 0;
+
+    bool parse(size_t &at, RespReply &reply);
+};
+
+// One persistent connection to a peer shard's RESP listener. Requests from any number of threads
+// are written back to back without waiting for earlier replies; a reader thread hands replies
+// out in request order. A broken or unresponsive connection fails its in-flight requests and is
+// reopened by the next request.
+class ShardClient {
+public:
+    ShardClient(std::string host, int port, std::chrono::milliseconds timeout = std::chrono::milliseconds(1000));
+    ~ShardClient();
+
+    ShardClient(const ShardClient &) = delete;
+    ShardClient &operator=(const ShardClient &) = delete;
+
+    std::future<RespReply> send(const std::vector<std::string_view> &args);
+
+    RespReply call(const std::vector<std::string_view> &args);
+
+    // Waits for a reply returned by send, turning a timeout into an error reply; a timeout also
+    // drops the connection.
+    RespReply wait(std::future<RespReply> &reply);
+
+private:
+    struct Connection {
+        Poco::Net::StreamSocket socket;
+        std::mutex mutex;
+        std::deque<std::promise<RespReply>> pending;
+        bool alive = true;
+        std::thread reader;
+    };
+
+    std::string host;
+    int port;
+    std::chrono::milliseconds timeout;
+    std::mutex mutex;  // serialises writes so the byte order on the wire matches `pending`
+    std::unique_ptr<Connection> conn;
+    std::string out;
+
+    bool ensureConnected();
+    static void readLoop(Connection *c);
+    static void fail(Connection *c, const std::string &reason);
+};
@@ -0,0 +1,302 @@
+#pragma once
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <vector>
+
+struct SlabClassStats {
+    size_t chunkSize = 0;
+    size_t pages = 0;
+    size_t used = 0;  // chunks holding an entry
+    size_t free = 0;  // chunks on the class's pages not holding one
+
+    SlabClassStats &operator+=(const SlabClassStats &other) {
+        chunkSize = other.chunkSize;
+        pages += other.pages;
+        used += other.used;
+        free += other.free;
+        return *this;
+    }
+};
+
+// memcached-style slab allocator for cache entries. Memory comes in 64 KiB pages, each carved
+// into equal chunks of one size class; classes grow by 1.25x from 64 bytes, so a request wastes
+// at most a fifth of its chunk. Allocation and release are a free-list pop and push on the page,
+// without touching malloc. A page whose chunks are all free is released (a couple are pooled for
+// reuse by any class), and rebalance() empties sparse pages by moving their entries into free
+// chunks elsewhere in the class, so memory follows the live size mix instead of its peak.
+// Requests bigger than a page's payload fall back to operator new. Not thread-safe: one
+// allocator per partition, used under the partition lock.
+class SlabAllocator {
+public:
+    static constexpr size_t kPageSize = size_t(64) << 10;
+    static constexpr size_t kMinChunk = 64;
+    static constexpr size_t kPoolPages = 2;  // empty pages kept for reuse, the rest go back to the OS
+
+    SlabAllocator() {
+        for (size_t size = kMinChunk;; size = std::max(size + 8, size_t(double(size) * 1.25) & ~size_t(7))) {
+            const size_t chunks = chunksPerPage(size);
+            if (chunks < 2) break;
+            classes.push_back(Class{size, chunks});
+        }
+    }
+
+    ~SlabAllocator() {
+        for (auto &c : classes) {
+            freePages(c.partial);
+            freePages(c.full);
+        }
+        freePages(pool);
+    }
+
+    SlabAllocator(const SlabAllocator &) = delete;
+    SlabAllocator &operator=(const SlabAllocator &) = delete;
+
+    void *allocate(size_t n) {
+        const size_t cls = classFor(n);
+        if (cls == classes.size()) {
+            largeBytes += n;
+            return ::operator new(n);
+        }
+        Class &c = classes[cls];
+        Page *page = c.partial;
+        if (!page) {
+            page = newPage(cls);
+            push(c.partial, page);
+        }
+        void *chunk;
+        if (page->freeList) {
+            chunk = page->freeList;
+            std::memcpy(&page->freeList, chunk, sizeof(void *));
+        } else {
+            chunk = page->base() + size_t(page->carved++) * c.chunkSize;
+        }
+        page->setUsed(page->indexOf(chunk, c.chunkSize), true);
+        ++c.used;
+        if (++page->used == c.chunks) {
+            unlink(c.partial, page);
+            push(c.full, page);
+        }
+        return chunk;
+    }
+
+    // n must be the size the chunk was allocated with.
+    void deallocate(void *p, size_t n) {
+        const size_t cls = classFor(n);
+        if (cls == classes.size()) {
+            largeBytes -= n;
+            ::operator delete(p);
+            return;
+        }
+        release(classes[cls], pageOf(p), p);
+    }
+
+    // Bytes a request of n actually takes.
+    size_t chunkSize(size_t n) const {
+        const size_t cls = classFor(n);
+        return cls == classes.size() ? n : classes[cls].chunkSize;
+    }
+
+    // Empties the sparsest page of every class that has a page's worth of free chunks on its
+    // other pages, moving at most `limit` entries in total. For each move the chunk is copied and
+    // relocate(from, to) is called to repoint whatever referred to `from`; `from` is released
+    // afterwards. Returns the number of entries moved.
+    template<typename Relocate>
+    size_t rebalance(size_t limit, Relocate relocate) {
+        size_t moved = 0;
+        for (size_t cls = 0; cls < classes.size() && moved < limit; ++cls) {
+            Class &c = classes[cls];
+            Page *sparse = nullptr;
+            size_t scanned = 0;
+            for (Page *p = c.partial; p && scanned < 64; p = p->next, ++scanned)
+                if (!sparse || p->used < sparse->used) sparse = p;
+            if (!sparse || sparse->used > limit - moved) continue;
+            const size_t freeElsewhere = (c.pages - 1) * c.chunks - (c.used - sparse->used);
+            if (freeElsewhere < sparse->used) continue;
+
+            unlink(c.partial, sparse);
+            for (size_t i = 0; i < sparse->carved && sparse->used > 0; ++i) {
+                if (!sparse->isUsed(i)) continue;
+                void *from = sparse->base() + i * c.chunkSize;
+                void *to = allocate(c.chunkSize);
+                std::memcpy(to, from, c.chunkSize);
+                relocate(from, to);
+                --c.used;
+                --sparse->used;
+                sparse->setUsed(i, false);
+                ++moved;
+            }
+            --c.pages;
+            recycle(sparse);
+        }
+        return moved;
+    }
+
+    std::vector<SlabClassStats> stats() const {
+        std::vector<SlabClassStats> out(classes.size());
+        for (size_t i = 0; i < classes.size(); ++i) {
+            const Class &c = classes[i];
+            out[i] = SlabClassStats{c.chunkSize, c.pages, c.used, c.pages * c.chunks - c.used};
+        }
+        return out;
+    }
+
+    // Memory held: pages carved for a class or pooled, plus oversized allocations.
+    size_t bytes() const {
+        size_t pages = pooled;
+        for (const auto &c : classes) pages += c.pages;
+        return pages * kPageSize + largeBytes;
+    }
+
+private:
+    struct Page {
+        Page *prev = nullptr;
+        Page *next = nullptr;
+        void *freeList = nullptr;
+        uint32_t carved = 0;  // chunks handed out at least once; the rest are untouched
+        uint32_t used = 0;
+        uint32_t dataOffset = 0;
+        // Followed by one bit per chunk marking it used, then the chunks.
+
+        uint64_t *bitmap() {
+            return reinterpret_cast<uint64_t *>(this + 1);
+        }
+
+        const uint64_t *bitmap() const {
+            return reinterpret_cast<const uint64_t *>(this + 1);
+        }
+
+        char *base() {
+            return reinterpret_cast<char *>(this) + dataOffset;
+        }
+
+        size_t indexOf(void *chunk, size_t chunkSize) {
+            return size_t(static_cast<char *>(chunk) - base()) / chunkSize;
+        }
+
+        bool isUsed(size_t i) const {
+            return (bitmap()[i / 64] >> (i % 64)) & 1;
+        }
+
+        void setUsed(size_t i, bool used) {
+            if (used) bitmap()[i / 64] |= uint64_t(1) << (i % 64);
+            else bitmap()[i / 64] &= ~(uint64_t(1) << (i % 64));
+        }
+    };
+
+    struct Class {
+        size_t chunkSize;
+        size_t chunks;  // per page
+        Page *partial = nullptr;
+        Page *full = nullptr;
+        size_t pages = 0;
+        size_t used = 0;
+    };
+
+    std::vector<Class> classes;
+    Page *pool = nullptr;
+    size_t pooled = 0;
+    size_t largeBytes = 0;
+
+    static size_t headerBytes(size_t chunks) {
+        const size_t bytes = sizeof(Page) + (chunks + 63) / 64 * sizeof(uint64_t);
+        return (bytes + 15) & ~size_t(15);
+    }
+
+    static size_t chunksPerPage(size_t chunkSize) {
+        size_t chunks = (kPageSize - headerBytes(1)) / chunkSize;
+        while (chunks > 0 && headerBytes(chunks) + chunks * chunkSize > kPageSize) --chunks;
+        return chunks;
+    }
+
+    size_t classFor(size_t n) const {
+        auto it = std::lower_bound(classes.begin(), classes.end(), n,
+                                   [](const Class &c, size_t size) { return c.chunkSize < size; });
+        return size_t(it - classes.begin());
+    }
+
+    static Page *pageOf(void *p) {
+        return reinterpret_cast<Page *>(reinterpret_cast<uintptr_t>(p) & ~(uintptr_t(kPageSize) - 1));
+    }
+
+    Page *newPage(size_t cls) {
+        Class &c = classes[cls];
+        void *mem = pool;
+        if (pool) {
+            Page *reused = pool;
+            unlink(pool, reused);
+            --pooled;
+        } else {
+            mem = mapPage();
+        }
+        const size_t header = headerBytes(c.chunks);
+        auto *page = new (mem) Page;
+        std::memset(page->bitmap(), 0, header - sizeof(Page));
+        page->dataOffset = static_cast<uint32_t>(header);
+        ++c.pages;
+        return page;
+    }
+
+    void release(Class &c, Page *page, void *chunk) {
+        page->setUsed(page->indexOf(chunk, c.chunkSize), false);
+        std::memcpy(chunk, &page->freeList, sizeof(void *));
+        page->freeList = chunk;
+        --c.used;
+        if (page->used-- == c.chunks) {
+            unlink(c.full, page);
+            push(c.partial, page);
+        }
+        if (page->used == 0) {
+            unlink(c.partial, page);
+            --c.pages;
+            recycle(page);
+        }
+    }
+
+    void recycle(Page *page) {
+        if (pooled < kPoolPages) {
+            push(pool, page);
+            ++pooled;
+        } else {
+            ::munmap(page, kPageSize);
+        }
+    }
+
+    // Pages are mapped one by one rather than taken from malloc, so a released page is returned
+    // to the OS at once instead of staying in the heap.
+    static void *mapPage() {
+        void *mem = ::mmap(nullptr, 2 * kPageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) throw std::bad_alloc();
+        const uintptr_t raw = reinterpret_cast<uintptr_t>(mem);
+        const uintptr_t aligned = (raw + kPageSize - 1) & ~(uintptr_t(kPageSize) - 1);
+        if (aligned > raw) ::munmap(mem, aligned - raw);
+        if (aligned + kPageSize < raw + 2 * kPageSize)
+            ::munmap(reinterpret_cast<void *>(aligned + kPageSize), raw + 2 * kPageSize - aligned - kPageSize);
+        return reinterpret_cast<void *>(aligned);
+    }
+
+    static void push(Page *&head, Page *page) {
+        page->prev = nullptr;
+        page->next = head;
+        if (head) head->prev = page;
+        head = page;
+    }
+
+    static void unlink(Page *&head, Page *page) {
+        if (page->prev) page->prev->next = page->next; else head = page->next;
+        if (page->next) page->next->prev = page->prev;
+        page->prev = page->next = nullptr;
+    }
+
+    static void freePages(Page *head) {
+        while (head) {
+            Page *next = head->next;
+            ::munmap(head, kPageSize);
+            head = next;
+        }
+    }
+};
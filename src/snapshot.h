@@ -0,0 +1,190 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "cache.h"
+
+// Snapshot file, little-endian:
+//   header  "TIMKVSN1" | u64 unix time of the dump in ms | u64 entry count
+//   entry   u32 key length | u32 value length | i64 ttl left in ms | u64 LFU count | key | value
+//   footer  "TIMKVEND"
+// Entries come partition by partition, each from its cold end to its hot end, so replaying them
+// in file order rebuilds the eviction order. Fields are fixed size and unaligned, read in place
+// out of the mapping.
+namespace snapshot {
+
+constexpr char kMagic[8] = {'T', 'I', 'M', 'K', 'V', 'S', 'N', '1'};
+constexpr char kEnd[8] = {'T', 'I', 'M', 'K', 'V', 'E', 'N', 'D'};
+constexpr size_t kHeaderSize = 24;
+constexpr size_t kEntryHeaderSize = 24;
+
+inline int64_t unixMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+template<typename T>
+void put(std::string &out, T v) {
+    out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+template<typename T>
+T get(const char *p) {
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline void appendEntry(std::string &out, std::string_view key, std::string_view value, const EntryMeta &meta) {
+    put<uint32_t>(out, static_cast<uint32_t>(key.size()));
+    put<uint32_t>(out, static_cast<uint32_t>(value.size()));
+    put<int64_t>(out, meta.ttlMs);
+    put<uint64_t>(out, meta.freq);
+    out += key;
+    out += value;
+}
+
+// Writes to "<path>.tmp" and renames over path on commit, so a crash mid-dump leaves the
+// previous snapshot in place.
+class Writer {
+public:
+    explicit Writer(std::string path) : path(std::move(path)), tmp(this->path + ".tmp") {
+    }
+
+    ~Writer() {
+        if (file) {
+            std::fclose(file);
+            std::remove(tmp.c_str());
+        }
+    }
+
+    bool open() {
+        file = std::fopen(tmp.c_str(), "wb");
+        if (!file) return false;
+        std::string header(kMagic, sizeof(kMagic));
+        put<int64_t>(header, unixMs());
+        put<uint64_t>(header, 0);
+        return write(header, 0);
+    }
+
+    bool write(const std::string &chunk, size_t entries) {
+        count += entries;
+        return std::fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+    }
+
+    bool commit() {
+        bool ok = std::fwrite(kEnd, 1, sizeof(kEnd), file) == sizeof(kEnd) &&
+                  std::fseek(file, sizeof(kMagic) + sizeof(int64_t), SEEK_SET) == 0 &&
+                  std::fwrite(&count, sizeof(count), 1, file) == 1 &&
+                  std::fflush(file) == 0 && ::fsync(fileno(file)) == 0;
+        ok = std::fclose(file) == 0 && ok;
+        file = nullptr;
+        if (ok) ok = std::rename(tmp.c_str(), path.c_str()) == 0;
+        if (!ok) std::remove(tmp.c_str());
+        return ok;
+    }
+
+private:
+    std::string path;
+    std::string tmp;
+    std::FILE *file = nullptr;
+    uint64_t count = 0;
+};
+
+// Maps a snapshot read-only and walks its entries without copying them.
+class Reader {
+public:
+    ~Reader() {
+        if (data) ::munmap(const_cast<char *>(data), len);
+    }
+
+    // False if the file is missing, truncated or not a snapshot; error() says which.
+    bool open(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return fail("cannot open");
+        struct stat st{};
+        if (::fstat(fd, &st) != 0 || size_t(st.st_size) < kHeaderSize + sizeof(kEnd)) {
+            ::close(fd);
+            return fail("truncated");
+        }
+        len = size_t(st.st_size);
+        void *m = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) return fail("mmap failed");
+        data = static_cast<const char *>(m);
+        ::madvise(m, len, MADV_SEQUENTIAL);
+
+        if (std::memcmp(data, kMagic, sizeof(kMagic)) != 0) return fail("bad magic");
+        if (std::memcmp(data + len - sizeof(kEnd), kEnd, sizeof(kEnd)) != 0) return fail("truncated");
+        writtenAt = get<int64_t>(data + 8);
+        count = get<uint64_t>(data + 16);
+        return true;
+    }
+
+    uint64_t entries() const {
+        return count;
+    }
+
+    // Milliseconds since the dump, subtracted from every ttl on load.
+    int64_t ageMs() const {
+        int64_t age = unixMs() - writtenAt;
+        return age > 0 ? age : 0;
+    }
+
+    // Calls fn(offset, key, value, meta) for every entry; false if the body is malformed.
+    template<typename Fn>
+    bool forEach(Fn fn) const {
+        const size_t end = len - sizeof(kEnd);
+        size_t pos = kHeaderSize;
+        for (uint64_t i = 0; i < count; ++i) {
+            if (end - pos < kEntryHeaderSize) return false;
+            const size_t at = pos;
+            uint32_t keyLen = get<uint32_t>(data + pos);
+            uint32_t valueLen = get<uint32_t>(data + pos + 4);
+            EntryMeta meta{get<int64_t>(data + pos + 8), get<uint64_t>(data + pos + 16)};
+            pos += kEntryHeaderSize;
+            if (end - pos < size_t(keyLen) + valueLen) return false;
+            fn(at, std::string_view(data + pos, keyLen), std::string_view(data + pos + keyLen, valueLen), meta);
+            pos += size_t(keyLen) + valueLen;
+        }
+        return pos == end;
+    }
+
+    // Decodes the entry that forEach reported at offset.
+    void entryAt(size_t offset, std::string_view &key, std::string_view &value, EntryMeta &meta) const {
+        const char *p = data + offset;
+        uint32_t keyLen = get<uint32_t>(p);
+        uint32_t valueLen = get<uint32_t>(p + 4);
+        meta = EntryMeta{get<int64_t>(p + 8), get<uint64_t>(p + 16)};
+        key = std::string_view(p + kEntryHeaderSize, keyLen);
+        value = std::string_view(p + kEntryHeaderSize + keyLen, valueLen);
+    }
+
+    const std::string &error() const {
+        return err;
+    }
+
+private:
+    const char *data = nullptr;
+    size_t len = 0;
+    int64_t writtenAt = 0;
+    uint64_t count = 0;
+    std::string err;
+
+    bool fail(const char *why) {
+        err = why;
+        return false;
+    }
+};
+
+}  // namespace snapshot
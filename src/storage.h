@@ -1,70 +1,576 @@
 #pragma once
+#include <pthread.h>
+
+#include <algorithm>
 #include <mutex>
+#include <shared_mutex>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <atomic>
+#include <chrono>
 #include "cache.h"
+#include "codec.h"
+#include "hot_keys.h"
+#include "metrics.h"
+#include "snapshot.h"
+#include <cstdint>
 #include <future>
 #include <fstream>
+#include <functional>
 #include <iostream>
-#include <shared_mutex>
+#include <memory>
 #include <thread>
+#include <utility>
+#include <vector>
+
+// Observes every successful put and remove. The notification is made with the partition lock
+// held, so a listener sees the mutations of any one key in the order they were applied. It
+// returns a ticket that the storage passes to await() once the lock is released; a listener that
+// has to wait for something (an fsync) blocks there instead of under the lock.
+class MutationListener {
+public:
+    // ttl is as given to the put: zero means the configured default.
+    virtual uint64_t onPut(std::string_view key, std::string_view value, std::chrono::milliseconds ttl) = 0;
+
+    virtual uint64_t onRemove(std::string_view key) = 0;
+
+    virtual void await(uint64_t) {
+    }
+
+    virtual ~MutationListener() = default;
+};
+
+// A reader-writer lock whose queued writers keep new readers out. std::shared_mutex on glibc
+// lets readers in ahead of a waiting writer, so a stream of gets on a hot partition could
+// starve its puts.
+class PartitionMutex {
+public:
+    PartitionMutex() {
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+        pthread_rwlock_init(&rw, &attr);
+        pthread_rwlockattr_destroy(&attr);
+    }
+
+    ~PartitionMutex() {
+        pthread_rwlock_destroy(&rw);
+    }
+
+    PartitionMutex(const PartitionMutex &) = delete;
+    PartitionMutex &operator=(const PartitionMutex &) = delete;
+
+    void lock() {
+        pthread_rwlock_wrlock(&rw);
+    }
+
+    bool try_lock() {
+        return pthread_rwlock_trywrlock(&rw) == 0;
+    }
+
+    void unlock() {
+        pthread_rwlock_unlock(&rw);
+    }
+
+    void lock_shared() {
+        pthread_rwlock_rdlock(&rw);
+    }
+
+    bool try_lock_shared() {
+        return pthread_rwlock_tryrdlock(&rw) == 0;
+    }
+
+    void unlock_shared() {
+        pthread_rwlock_unlock(&rw);
+    }
+
+private:
+    pthread_rwlock_t rw;
+};
 
 template<typename Key, typename Value>
 class KVstorage {
 public:
-    explicit KVstorage(Cache<Key, Value> *cache, unsigned long capacity): cache(cache), capacity(capacity) {
+    explicit KVstorage(Cache<Key, Value> *cache, unsigned long capacity)
+        : KVstorage(std::vector<Cache<Key, Value> *>{cache}, capacity) {
+    }
+
+    // Every partition owns a disjoint slice of the key space, its own lock and its own cache
+    // (and therefore its own eviction and capacity slice).
+    explicit KVstorage(std::vector<Cache<Key, Value> *> caches, unsigned long capacity)
+        : partitionCount(caches.empty() ? 1 : caches.size()),
+          partitions(new Partition[partitionCount]),
+          capacity(capacity) {
+        for (size_t i = 0; i < caches.size(); ++i) {
+            partitions[i].cache = caches[i];
+            sharedReads = sharedReads && caches[i]->sharedReads();
+        }
+    }
+
+    // Not synchronised with requests: set it before the storage starts serving.
+    void setCompression(const Codec::Options &options) {
+        codec = Codec(options);
+    }
+
+    const Codec &compression() const {
+        return codec;
+    }
+
+    // Counts every read key into hotKeys; set before serving, like the codec.
+    void setHotKeys(HotKeys *hotKeys) {
+        this->hotKeys = hotKeys;
+    }
+
+    // A zero ttl leaves the entry the cache's default lifetime. The value is compressed, when the
+    // codec takes it, before the lock; listeners see it raw.
+    void put(std::string_view key, std::string_view value,
+             std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+        auto &p = partitionFor(key);
+        Tickets tickets(listeners.size());
+        const ValueView stored = pack(value);
+        {
+            metrics::StageTimer timer;
+            std::unique_lock lock(p.mutex);
+            timer.lap(metrics::Stage::LockWait);
+            p.cache->put(key, stored.bytes, ttl, stored.encoding);
+            timer.lap(metrics::Stage::CacheOp);
+            notifyPut(key, value, ttl, tickets);
+        }
+        metrics::count(metrics::Event::Put);
+        await(tickets);
+    }
+
+    size_t remove(std::string_view key) {
+        auto &p = partitionFor(key);
+        Tickets tickets(listeners.size());
+        size_t removed = 0;
+        {
+            metrics::StageTimer timer;
+            std::unique_lock lock(p.mutex);
+            timer.lap(metrics::Stage::LockWait);
+            removed = p.cache->remove(key);
+            timer.lap(metrics::Stage::CacheOp);
+            if (removed) notifyRemove(key, tickets);
+        }
+        metrics::count(metrics::Event::Remove, removed);
+        await(tickets);
+        return removed;
+    }
+
+    // Inserts an entry read back from a snapshot or a log, with its raw value: no listener is told
+    // about it.
+    void restore(std::string_view key, std::string_view value, const EntryMeta &meta) {
+        auto &p = partitionFor(key);
+        const ValueView stored = pack(value);
+        EntryMeta packed = meta;
+        packed.encoding = stored.encoding;
+        std::unique_lock lock(p.mutex);
+        p.cache->restore(key, stored.bytes, packed);
     }
 
-    void put(const std::string &key, const std::string &value) {
-        std::unique_lock lock(mutex);
-        cache->put(key, value);
+    // Drops every entry, one partition at a time; no listener is told.
+    void clear() {
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < partitionCount; ++i) {
+            auto &p = partitions[i];
+            std::unique_lock lock(p.mutex);
+            keys.clear();
+            p.cache->dump([&](std::string_view key, std::string_view, const EntryMeta &) { keys.emplace_back(key); });
+            for (const auto &key : keys) p.cache->remove(key);
+            p.cache->expire(SIZE_MAX);  // entries past their deadline, which dump() leaves out
+        }
     }
 
-    size_t remove(const std::string &key) {
-        std::unique_lock lock(mutex);
-        return cache->remove(key);
+    // Not synchronised with requests: register listeners before the storage starts serving.
+    void addListener(MutationListener *listener) {
+        listeners.push_back(listener);
     }
 
-    std::optional<std::string> get(const std::string &key) {
-        std::shared_lock lock(mutex);
-        return cache->get(key);
+    // Readers share the partition lock when the caches allow it: a hit is only queued, and the
+    // queue is applied by the next writer, or here once it fills up and the lock is free, so a
+    // hot key no longer serialises its readers. Otherwise Cache::get reorders the eviction order
+    // and drives the rehash, and needs the lock exclusively.
+    std::optional<std::string> get(std::string_view key) {
+        std::optional<std::string> value;
+        get(key, [&](const ValueView &v) { value.emplace(v.bytes); });
+        return value;
     }
 
+    // Hands the value to fn in place, with the partition locked (shared on the read path), so a
+    // caller that only writes it out saves the copy; fn must not call back into the storage. A
+    // large value comes with its buffer, which fn can retain to send it after the lock is gone.
+    // A compressed value is decompressed for fn, unless decode is false: fn then gets the stored
+    // bytes and their encoding (see Codec::decode). Decompression runs after the lock is released,
+    // on a reference to a large value's buffer or a copy of a small one. Returns whether the key
+    // was found.
+    bool get(std::string_view key, const ValueVisitor &fn, bool decode = true) {
+        if (!decode || !codec.enabled()) return find(key, fn);
+        SharedValue held;
+        std::string copy;
+        Encoding encoding = Encoding::Raw;
+        const bool found = find(key, [&](const ValueView &v) {
+            encoding = v.encoding;
+            if (encoding == Encoding::Raw) fn(v);
+            else if (v.buffer) held = SharedValue(v.buffer);
+            else copy.assign(v.bytes);
+        });
+        if (found && encoding != Encoding::Raw)
+            fn(Codec::decode(ValueView{held ? held.view() : std::string_view(copy), nullptr, encoding}));
+        return found;
+    }
 
-    void startEviction() {
-        if (runningEviction.load()) {
+    // Batch variants: keys are grouped by partition and each partition lock is taken once.
+    std::vector<std::optional<std::string>> multiGet(const std::vector<std::string> &keys) {
+        std::vector<std::optional<std::string>> values(keys.size());
+        std::vector<Encoding> encodings(keys.size(), Encoding::Raw);
+        if (hotKeys)
+            for (const auto &key : keys) hotKeys->record(key);
+        auto keyOf = [&](size_t i) -> const std::string & { return keys[i]; };
+        // Stored bytes are copied under the lock and decompressed once all locks are released.
+        auto copyTo = [&values, &encodings](size_t i) {
+            return [&values, &encodings, i](const ValueView &v) {
+                values[i].emplace(v.bytes);
+                encodings[i] = v.encoding;
+            };
+        };
+        std::vector<size_t> drains;
+        if (!sharedReads) {
+            forEachByPartition(keys.size(), keyOf,
+                               [&](Cache<Key, Value> &cache, size_t i) { cache.get(keys[i], copyTo(i)); });
+        } else {
+            forEachByPartition<std::shared_lock<PartitionMutex>>(
+                keys.size(), keyOf, [&](Cache<Key, Value> &cache, size_t i) {
+                    bool drain = false;
+                    cache.read(keys[i], drain, copyTo(i));
+                    if (drain) drains.push_back(partitionIndex(keys[i]));
+                });
+        }
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (encodings[i] == Encoding::Raw) continue;
+            values[i] = std::string(Codec::decode(ValueView{*values[i], nullptr, encodings[i]}).bytes);
+        }
+        const size_t hits = std::count_if(values.begin(), values.end(), [](const auto &v) { return v.has_value(); });
+        metrics::count(metrics::Event::Hit, hits);
+        metrics::count(metrics::Event::Miss, values.size() - hits);
+        for (size_t i : drains) maintain(partitions[i]);
+        return values;
+    }
+
+    void multiPut(const std::vector<std::pair<std::string, std::string>> &items,
+                  std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+        // Compressed up front, before any lock.
+        std::vector<std::string> packed(codec.enabled() ? items.size() : 0);
+        std::vector<Encoding> encodings(packed.size(), Encoding::Raw);
+        for (size_t i = 0; i < packed.size(); ++i) encodings[i] = codec.encode(items[i].second, packed[i]);
+        Tickets tickets(listeners.size());
+        forEachByPartition(items.size(), [&](size_t i) -> const std::string & { return items[i].first; },
+                           [&](Cache<Key, Value> &cache, size_t i) {
+                               const Encoding e = packed.empty() ? Encoding::Raw : encodings[i];
+                               cache.put(items[i].first, e == Encoding::Raw ? items[i].second : packed[i], ttl, e);
+                               notifyPut(items[i].first, items[i].second, ttl, tickets);
+                           });
+        metrics::count(metrics::Event::Put, items.size());
+        await(tickets);
+    }
+
+    size_t multiRemove(const std::vector<std::string> &keys) {
+        Tickets tickets(listeners.size());
+        size_t removed = 0;
+        forEachByPartition(keys.size(), [&](size_t i) -> const std::string & { return keys[i]; },
+                           [&](Cache<Key, Value> &cache, size_t i) {
+                               if (cache.remove(keys[i]) == 0) return;
+                               ++removed;
+                               notifyRemove(keys[i], tickets);
+                           });
+        metrics::count(metrics::Event::Remove, removed);
+        await(tickets);
+        return removed;
+    }
+
+    size_t size() {
+        size_t total = 0;
+        for (size_t i = 0; i < partitionCount; ++i) {
+            std::unique_lock lock(partitions[i].mutex);
+            total += partitions[i].cache->size();
+        }
+        return total;
+    }
+
+    size_t partitionsCount() const {
+        return partitionCount;
+    }
+
+    CacheStats stats() {
+        CacheStats total;
+        for (size_t i = 0; i < partitionCount; ++i) {
+            std::unique_lock lock(partitions[i].mutex);
+            total += partitions[i].cache->stats();
+        }
+        return total;
+    }
+
+    // Capacity is enforced inline by Cache::put; the background task only reclaims expired
+    // entries that are never read again, up to perPartition per pass, taken from the caches'
+    // timer wheels in small batches so the lock is never held for long.
+    // With compactSlabs it also moves up to perPartition entries out of sparse allocator pages.
+    void startReaper(std::chrono::milliseconds interval, size_t perPartition = 1024, bool compactSlabs = false) {
+        if (runningReaper.load() || interval.count() <= 0) {
             return;
         }
-        runningEviction.store(true);
+        runningReaper.store(true);
 
-        evictionTask = std::async(std::launch::async, [this] {
-            while (runningEviction.load()) {
-                std::this_thread::sleep_for(std::chrono::seconds(3));
+        reaperTask = std::async(std::launch::async, [this, interval, perPartition, compactSlabs] {
+            constexpr size_t batch = 64;
+            while (runningReaper.load()) {
+                std::this_thread::sleep_for(interval);
 
-                int attempts = 0;
-                while (cache->needEvict() && attempts++ < 4000) {
-                    {
-                        std::unique_lock lock(mutex);
-                        cache->evict();
+                for (size_t i = 0; i < partitionCount && runningReaper.load(); ++i) {
+                    auto &p = partitions[i];
+                    for (size_t seen = 0; seen < perPartition; seen += batch) {
+                        std::unique_lock lock(p.mutex);
+                        if (p.cache->expire(batch) == 0) break;
+                    }
+                    if (compactSlabs) {
+                        std::unique_lock lock(p.mutex);
+                        p.cache->compact(perPartition);
                     }
                 }
             }
         });
     }
 
+    // Dumps one partition at a time: entries are serialised with that partition locked and
+    // written out after it is released, so requests only ever wait for a single partition's copy.
+    bool saveSnapshot(const std::string &path) {
+        std::lock_guard saving(snapshotMutex);
+        snapshot::Writer writer(path);
+        if (!writer.open()) return false;
+        std::string chunk;
+        for (size_t i = 0; i < partitionCount; ++i) {
+            chunk.clear();
+            size_t entries = dumpPartition(i, chunk, snapshot::appendEntry);
+            if (!writer.write(chunk, entries)) return false;
+        }
+        return writer.commit();
+    }
+
+    // Appends encode(chunk, key, value, meta) for every live entry of partition i, cold to hot,
+    // with only that partition locked. Returns the number of entries. Values go out raw, so
+    // snapshots and replicas don't depend on the codec this node runs with.
+    template<typename Encode>
+    size_t dumpPartition(size_t i, std::string &chunk, Encode encode) {
+        size_t entries = 0;
+        std::unique_lock lock(partitions[i].mutex);
+        partitions[i].cache->dump([&](std::string_view key, std::string_view value, const EntryMeta &meta) {
+            if (meta.encoding == Encoding::Raw) {
+                encode(chunk, key, value, meta);
+            } else {
+                EntryMeta raw = meta;
+                raw.encoding = Encoding::Raw;
+                encode(chunk, key, Codec::decode(ValueView{value, nullptr, meta.encoding}).bytes, raw);
+            }
+            ++entries;
+        });
+        return entries;
+    }
+
+    // Loads a snapshot into the (normally empty) storage before it starts serving. Entries are
+    // bucketed by partition in one pass over the mapping, then partitions are filled in parallel,
+    // each reserved up front and replayed in file order. Returns the number of entries restored;
+    // error explains a failure.
+    size_t loadSnapshot(const std::string &path, std::string &error) {
+        snapshot::Reader reader;
+        if (!reader.open(path)) {
+            error = reader.error();
+            return 0;
+        }
+        const int64_t age = reader.ageMs();
+        std::vector<std::vector<size_t>> byPartition(partitionCount);
+        for (auto &offsets : byPartition) offsets.reserve(reader.entries() / partitionCount + 1);
+        bool ok = reader.forEach([&](size_t offset, std::string_view key, std::string_view, const EntryMeta &meta) {
+            if (meta.ttlMs > age) byPartition[partitionIndex(key)].push_back(offset);
+        });
+        if (!ok) {
+            error = "corrupt";
+            return 0;
+        }
+
+        std::atomic<size_t> next{0};
+        auto fill = [&] {
+            for (size_t i; (i = next.fetch_add(1)) < partitionCount;) {
+                auto &p = partitions[i];
+                std::unique_lock lock(p.mutex);
+                p.cache->reserve(byPartition[i].size());
+                std::string_view key, value;
+                EntryMeta meta;
+                for (size_t offset : byPartition[i]) {
+                    reader.entryAt(offset, key, value, meta);
+                    meta.ttlMs -= age;
+                    const ValueView stored = pack(value);
+                    meta.encoding = stored.encoding;
+                    p.cache->restore(key, stored.bytes, meta);
+                }
+            }
+        };
+        std::vector<std::thread> workers(std::min<size_t>(partitionCount, std::max(1u, std::thread::hardware_concurrency())) - 1);
+        for (auto &w : workers) w = std::thread(fill);
+        fill();
+        for (auto &w : workers) w.join();
+
+        size_t restored = 0;
+        for (auto &offsets : byPartition) restored += offsets.size();
+        return restored;
+    }
+
+    void startSnapshots(const std::string &path, std::chrono::milliseconds interval) {
+        if (runningSnapshots.load() || interval.count() <= 0) {
+            return;
+        }
+        runningSnapshots.store(true);
+
+        snapshotTask = std::async(std::launch::async, [this, path, interval] {
+            auto step = std::min<std::chrono::milliseconds>(interval, std::chrono::milliseconds(100));
+            auto due = std::chrono::steady_clock::now() + interval;
+            while (runningSnapshots.load()) {
+                std::this_thread::sleep_for(step);
+                if (std::chrono::steady_clock::now() < due) continue;
+                if (!saveSnapshot(path)) std::cerr << "snapshot to " << path << " failed" << std::endl;
+                due = std::chrono::steady_clock::now() + interval;
+            }
+        });
+    }
+
     ~KVstorage() {
-        runningEviction.store(false);
-        if (evictionTask.valid()) {
-            evictionTask.wait();
+        runningReaper.store(false);
+        runningSnapshots.store(false);
+        if (reaperTask.valid()) {
+            reaperTask.wait();
+        }
+        if (snapshotTask.valid()) {
+            snapshotTask.wait();
+        }
+        for (size_t i = 0; i < partitionCount; ++i) {
+            delete partitions[i].cache;
         }
-        delete cache;
     }
 
 private:
-    Cache<Key, Value> *cache;
-    std::shared_mutex mutex;
+    struct alignas(64) Partition {
+        PartitionMutex mutex;
+        Cache<Key, Value> *cache = nullptr;
+    };
+
+    size_t partitionCount;
+    std::unique_ptr<Partition[]> partitions;
     unsigned long capacity;
-    std::atomic<bool> runningEviction{false};
-    std::future<void> evictionTask;
+    bool sharedReads = true;
+    Codec codec;
+    HotKeys *hotKeys = nullptr;
+    std::atomic<bool> runningReaper{false};
+    std::future<void> reaperTask;
+    std::atomic<bool> runningSnapshots{false};
+    std::future<void> snapshotTask;
+    std::mutex snapshotMutex;
+    std::vector<MutationListener *> listeners;
+
+    // Latest ticket per listener; tickets only grow, so awaiting the last one covers a batch.
+    using Tickets = std::vector<uint64_t>;
+
+    void notifyPut(std::string_view key, std::string_view value, std::chrono::milliseconds ttl,
+                   Tickets &tickets) {
+        for (size_t i = 0; i < listeners.size(); ++i) tickets[i] = listeners[i]->onPut(key, value, ttl);
+    }
+
+    void notifyRemove(std::string_view key, Tickets &tickets) {
+        for (size_t i = 0; i < listeners.size(); ++i) tickets[i] = listeners[i]->onRemove(key);
+    }
+
+    void await(const Tickets &tickets) {
+        for (size_t i = 0; i < listeners.size(); ++i)
+            if (tickets[i]) listeners[i]->await(tickets[i]);
+    }
+
+    // std::hash gives no guarantee about its low bits, so the hash is remixed before taking it
+    // modulo the partition count.
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    size_t partitionIndex(std::string_view key) const {
+        if (partitionCount == 1) return 0;
+        return mix(std::hash<std::string_view>{}(key)) % partitionCount;
+    }
+
+    Partition &partitionFor(std::string_view key) {
+        return partitions[partitionIndex(key)];
+    }
+
+    // The bytes to store for value and their encoding: value itself, or its compressed form in a
+    // buffer of the calling thread.
+    ValueView pack(std::string_view value) const {
+        thread_local std::string packed;
+        const Encoding e = codec.encode(value, packed);
+        return e == Encoding::Raw ? ValueView{value} : ValueView{packed, nullptr, e};
+    }
+
+    bool find(std::string_view key, const ValueVisitor &fn) {
+        if (hotKeys) hotKeys->record(key);
+        auto &p = partitionFor(key);
+        bool drain = false;
+        bool found;
+        metrics::StageTimer timer;
+        if (!sharedReads) {
+            std::unique_lock lock(p.mutex);
+            timer.lap(metrics::Stage::LockWait);
+            found = p.cache->get(key, fn);
+            timer.lap(metrics::Stage::CacheOp);
+        } else {
+            std::shared_lock lock(p.mutex);
+            timer.lap(metrics::Stage::LockWait);
+            found = p.cache->read(key, drain, fn);
+            timer.lap(metrics::Stage::CacheOp);
+        }
+        metrics::count(found ? metrics::Event::Hit : metrics::Event::Miss);
+        if (drain) maintain(p);
+        return found;
+    }
+
+    // Applies queued hits if nobody holds the lock; otherwise the next writer will.
+    void maintain(Partition &p) {
+        std::unique_lock lock(p.mutex, std::try_to_lock);
+        if (lock) p.cache->maintain();
+    }
+
+    // Counting-sorts item indices by partition, then calls fn(cache, i) for every item with its
+    // partition locked (by a Lock), one lock acquisition per partition touched. The wait for each
+    // lock and the time spent under it are recorded as one LockWait and one CacheOp sample.
+    template<typename Lock = std::unique_lock<PartitionMutex>, typename KeyOf, typename Fn>
+    void forEachByPartition(size_t n, KeyOf keyOf, Fn fn) {
+        if (n == 0) return;
+        std::vector<uint32_t> part(n);
+        std::vector<size_t> start(partitionCount + 1, 0);
+        for (size_t i = 0; i < n; ++i) {
+            part[i] = static_cast<uint32_t>(partitionIndex(keyOf(i)));
+            ++start[part[i] + 1];
+        }
+        for (size_t p = 0; p < partitionCount; ++p) start[p + 1] += start[p];
+        std::vector<size_t> order(n);
+        std::vector<size_t> fill(start.begin(), start.end() - 1);
+        for (size_t i = 0; i < n; ++i) order[fill[part[i]]++] = i;
+
+        for (size_t p = 0; p < partitionCount; ++p) {
+            if (start[p] == start[p + 1]) continue;
+            metrics::StageTimer timer;
+            Lock lock(partitions[p].mutex);
+            timer.lap(metrics::Stage::LockWait);
+            for (size_t j = start[p]; j < start[p + 1]; ++j) fn(*partitions[p].cache, order[j]);
+            timer.lap(metrics::Stage::CacheOp);
+        }
+    }
 };
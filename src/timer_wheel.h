@@ -0,0 +1,143 @@
+#pragma once
+#include <time.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// Milliseconds on the monotonic clock, read with CLOCK_MONOTONIC_COARSE: the vDSO returns the
+// kernel's last tick (1-4 ms resolution) without touching the hardware timer, which is all a TTL
+// needs.
+inline int64_t coarseNowMs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Hierarchical timing wheel over millisecond deadlines (Varghese & Lauck, as in the Linux timer
+// list). Level l has 64 slots of 64^l ms each, so five levels reach about 12 days; later deadlines
+// wait in the last slot of the top level and are placed again when it comes round. A slot is an
+// intrusive circular list, so scheduling and cancelling are O(1). advance() jumps straight to the
+// next non-empty slot of any level, so its cost follows the number of timers, not the time passed.
+// Not thread-safe.
+class TimerWheel {
+public:
+    struct Node {
+        Node *prev = nullptr;  // null while not scheduled
+        Node *next = nullptr;
+        int64_t deadline = 0;  // coarseNowMs() based
+    };
+
+    static constexpr int kLevels = 5;
+    static constexpr int kBits = 6;
+    static constexpr int64_t kSlots = int64_t(1) << kBits;
+
+    explicit TimerWheel(int64_t now = coarseNowMs()) : current(now) {
+        for (auto &level : slots)
+            for (auto &s : level) s.prev = s.next = &s;
+    }
+
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    // Links n by n->deadline; n must not be scheduled. A deadline already passed is due at the
+    // next advance().
+    void schedule(Node *n) {
+        const int64_t delta = n->deadline - current;
+        int level = 0;
+        while (level < kLevels - 1 && delta >= kSlots << (kBits * level)) ++level;
+        const int64_t at = delta >= kSlots << (kBits * level) ? current + (kSlots << (kBits * level)) - 1
+                                                               : (delta < 0 ? current : n->deadline);
+        const size_t index = size_t(at >> (kBits * level)) & (kSlots - 1);
+        Node &head = slots[level][index];
+        n->prev = head.prev;
+        n->next = &head;
+        head.prev->next = n;
+        head.prev = n;
+        occupied[level] |= uint64_t(1) << index;
+    }
+
+    void cancel(Node *n) {
+        if (!n->prev) return;
+        n->prev->next = n->next;
+        n->next->prev = n->prev;
+        n->prev = n->next = nullptr;
+    }
+
+    void reschedule(Node *n, int64_t deadline) {
+        cancel(n);
+        n->deadline = deadline;
+        schedule(n);
+    }
+
+    // n was copied to a new address (a slab move): repoint its neighbours.
+    void relocated(Node *n) {
+        if (!n->prev) return;
+        n->prev->next = n;
+        n->next->prev = n;
+    }
+
+    // Unlinks nodes whose deadline is at or before now and passes each to fn, at most `limit` of
+    // them; the rest stay due for the next call. Returns how many were passed.
+    template<typename Fn>
+    size_t advance(int64_t now, size_t limit, Fn fn) {
+        size_t expired = 0;
+        for (;;) {
+            const size_t index = size_t(current) & (kSlots - 1);
+            Node &head = slots[0][index];
+            while (head.next != &head) {
+                if (expired == limit) return expired;
+                Node *n = head.next;
+                cancel(n);
+                ++expired;
+                fn(n);
+            }
+            occupied[0] &= ~(uint64_t(1) << index);
+            if (current >= now) return expired;
+
+            int64_t next = INT64_MAX;
+            for (int level = 0; level < kLevels; ++level) next = std::min(next, nextSlot(level));
+            if (next > now) {
+                current = now;
+                return expired;
+            }
+            current = next;
+            // The slots of the higher levels that start here move down; those skipped were empty.
+            for (int level = 1; level < kLevels && (current & ((int64_t(1) << (kBits * level)) - 1)) == 0; ++level)
+                cascade(level);
+        }
+    }
+
+private:
+    Node slots[kLevels][kSlots];
+    uint64_t occupied[kLevels] = {};  // slots that may hold nodes, per level
+    int64_t current;                  // every deadline before it has been handed out
+
+    // Time at which the first possibly non-empty slot of `level` after the current one starts.
+    int64_t nextSlot(int level) const {
+        const uint64_t bits = occupied[level];
+        if (!bits) return INT64_MAX;
+        const int shift = kBits * level;
+        const int64_t block = current >> shift;
+        const size_t index = size_t(block) & (kSlots - 1);
+        const int64_t lap = block & ~(kSlots - 1);
+        const uint64_t ahead = index == kSlots - 1 ? 0 : bits & (~uint64_t(0) << (index + 1));
+        if (ahead) return (lap + std::countr_zero(ahead)) << shift;
+        return (lap + kSlots + std::countr_zero(bits)) << shift;
+    }
+
+    // Places the nodes of the level's slot starting now again, at lower levels.
+    void cascade(int level) {
+        const size_t index = size_t(current >> (kBits * level)) & (kSlots - 1);
+        occupied[level] &= ~(uint64_t(1) << index);
+        Node &head = slots[level][index];
+        Node *n = head.next;
+        head.prev = head.next = &head;
+        while (n != &head) {
+            Node *next = n->next;
+            schedule(n);
+            n = next;
+        }
+    }
+};
@@ -0,0 +1,143 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+
+// Immutable bytes of a large value with a reference count. The cache holds one reference; a reader
+// that takes another can keep sending the bytes after the partition lock is released, while the
+// entry is overwritten or dropped.
+class ValueBuffer {
+public:
+    static ValueBuffer *create(std::string_view bytes) {
+        auto *b = new (::operator new(sizeof(ValueBuffer) + bytes.size())) ValueBuffer(bytes.size());
+        std::memcpy(b->data(), bytes.data(), bytes.size());
+        return b;
+    }
+
+    ValueBuffer(const ValueBuffer &) = delete;
+    ValueBuffer &operator=(const ValueBuffer &) = delete;
+
+    void retain() {
+        refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        this->~ValueBuffer();
+        ::operator delete(this);
+    }
+
+    std::string_view view() const {
+        return {reinterpret_cast<const char *>(this + 1), size};
+    }
+
+private:
+    std::atomic<uint32_t> refs{1};
+    size_t size;
+
+    explicit ValueBuffer(size_t size) : size(size) {
+    }
+
+    char *data() {
+        return reinterpret_cast<char *>(this + 1);
+    }
+};
+
+// A counted reference to a ValueBuffer; empty when default-constructed.
+class SharedValue {
+public:
+    SharedValue() = default;
+
+    explicit SharedValue(ValueBuffer *buffer) : buffer(buffer) {
+        if (buffer) buffer->retain();
+    }
+
+    SharedValue(const SharedValue &other) : SharedValue(other.buffer) {
+    }
+
+    SharedValue(SharedValue &&other) noexcept : buffer(std::exchange(other.buffer, nullptr)) {
+    }
+
+    SharedValue &operator=(SharedValue other) noexcept {
+        std::swap(buffer, other.buffer);
+        return *this;
+    }
+
+    ~SharedValue() {
+        if (buffer) buffer->release();
+    }
+
+    explicit operator bool() const {
+        return buffer != nullptr;
+    }
+
+    std::string_view view() const {
+        return buffer ? buffer->view() : std::string_view();
+    }
+
+private:
+    ValueBuffer *buffer = nullptr;
+};
+
+// How a value's bytes are stored: as given, or compressed by the storage (see Codec).
+enum class Encoding : uint8_t { Raw = 0, Lz4 = 1, Zstd = 2 };
+
+// What a cache hands a reader: the value's bytes, valid during the call, and the buffer holding
+// them when the value is large (see ValueSlot), which the reader may retain through a SharedValue.
+struct ValueView {
+    std::string_view bytes;
+    ValueBuffer *buffer = nullptr;
+    Encoding encoding = Encoding::Raw;
+};
+
+// How a slab entry keeps its value after the key: inline below kSharedBytes, otherwise as a
+// pointer to a ValueBuffer. Large values then skip the slab's operator new fallback, are not
+// copied when the slab moves an entry, and can be sent without holding the lock.
+struct ValueSlot {
+    static constexpr size_t kSharedBytes = size_t(16) << 10;
+
+    static bool shared(size_t size) {
+        return size >= kSharedBytes;
+    }
+
+    // Bytes the value takes inside the chunk.
+    static size_t bytes(size_t size) {
+        return shared(size) ? sizeof(ValueBuffer *) : size;
+    }
+
+    // Bytes it takes outside the chunk, for memory accounting.
+    static size_t outsideBytes(size_t size) {
+        return shared(size) ? sizeof(ValueBuffer) + size : 0;
+    }
+
+    static void store(char *at, std::string_view value) {
+        if (!shared(value.size())) {
+            std::memcpy(at, value.data(), value.size());
+            return;
+        }
+        ValueBuffer *b = ValueBuffer::create(value);
+        std::memcpy(at, &b, sizeof(b));
+    }
+
+    static ValueView load(const char *at, size_t size) {
+        if (!shared(size)) return ValueView{{at, size}, nullptr};
+        ValueBuffer *b = bufferAt(at);
+        return ValueView{b->view(), b};
+    }
+
+    // Drops the entry's reference; `at` must not be loaded again before the next store.
+    static void clear(char *at, size_t size) {
+        if (shared(size)) bufferAt(at)->release();
+    }
+
+private:
+    static ValueBuffer *bufferAt(const char *at) {
+        ValueBuffer *b;
+        std::memcpy(&b, at, sizeof(b));
+        return b;
+    }
+};
@@ -0,0 +1,85 @@
+import socket
+import sys
+import time
+
+# Regression checks for the epoll frontend. Pipelined GETs of a shared (>= 16 KiB) value back the
+# response write up, then one more request arrives while it is stuck. Every request must be answered.
+# The GETs are padded to fill the server's 16 KiB read buffer exactly, so the server takes the path
+# that keeps reading before it writes.
+host = 'localhost'
+port = int(sys.argv[1]) if len(sys.argv) > 1 else 8080
+key = 'pipelinecheck'
+value = 'v' * 65536
+pipelined = 128
+
+put = socket.create_connection((host, port))
+body = ('{"key": "%s", "value": "%s"}' % (key, value)).encode()
+put.sendall(b'POST /put HTTP/1.1\r\nContent-Type: application/json\r\nContent-Length: %d\r\nConnection: close\r\n\r\n'
+            % len(body) + body)
+while put.recv(65536):
+    pass
+put.close()
+
+get = b'GET /raw/%s HTTP/1.1\r\nX-Pad: \r\n\r\n' % key.encode()
+get = get.replace(b'X-Pad: ', b'X-Pad: ' + b'p' * (16384 // pipelined - len(get)))
+s = socket.socket()
+s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 65536)  # before connect, so the window stays small
+s.connect((host, port))
+s.sendall(get * pipelined)
+time.sleep(0.5)
+s.sendall(get)
+
+s.settimeout(5)
+data = b''
+expected = pipelined + 1
+try:
+    while data.count(b'HTTP/1.1 200') < expected:
+        chunk = s.recv(1 << 20)
+        if not chunk:
+            break
+        data += chunk
+except socket.timeout:
+    pass
+
+answered = data.count(b'HTTP/1.1 200')
+print(f'{answered} of {expected} responses')
+ok = answered == expected
+
+
+# An HTTP/1.0 client that asks for keep-alive must be told it got it, or it reads the body until EOF.
+def response(sock):
+    buf = b''
+    while b'\r\n\r\n' not in buf:
+        chunk = sock.recv(65536)
+        if not chunk:
+            return None, b''
+        buf += chunk
+    head, _, body = buf.partition(b'\r\n\r\n')
+    length = 0
+    for line in head.split(b'\r\n')[1:]:
+        name, _, value = line.partition(b':')
+        if name.strip().lower() == b'content-length':
+            length = int(value)
+    while len(body) < length:
+        chunk = sock.recv(65536)
+        if not chunk:
+            break
+        body += chunk
+    return head, body
+
+
+s = socket.create_connection((host, port))
+s.settimeout(5)
+kept = 0
+try:
+    for _ in range(2):
+        s.sendall(b'GET /raw/%s HTTP/1.0\r\nConnection: keep-alive\r\n\r\n' % key.encode())
+        head, body = response(s)
+        if head is None or b'connection: keep-alive' not in head.lower() or len(body) != len(value):
+            break
+        kept += 1
+except socket.timeout:
+    pass
+print(f'{kept} of 2 HTTP/1.0 keep-alive responses')
+ok = ok and kept == 2
+sys.exit(0 if ok else 1)
@@ -0,0 +1,88 @@
+"""Client-side shard routing, identical to src/routing.h.
+
+    ring = ShardRing(["localhost:8080", "localhost:8081"])
+    url = f"http://{ring.owner_address('key1')}/get"
+"""
+import bisect
+import struct
+
+_M = (1 << 64) - 1
+_P1 = 0x9E3779B185EBCA87
+_P2 = 0xC2B2AE3D27D4EB4F
+_P3 = 0x165667B19E3779F9
+_P4 = 0x85EBCA77C2B2AE63
+_P5 = 0x27D4EB2F165667C5
+
+DEFAULT_VNODES = 160
+
+
+def _rotl(x, r):
+    return ((x << r) | (x >> (64 - r))) & _M
+
+
+def _accumulate(acc, lane):
+    acc = (acc + lane * _P2) & _M
+    return (_rotl(acc, 31) * _P1) & _M
+
+
+def _merge(acc, val):
+    acc ^= _accumulate(0, val)
+    return (acc * _P1 + _P4) & _M
+
+
+def xxh64(data, seed=0):
+    if isinstance(data, str):
+        data = data.encode()
+    n = len(data)
+    p = 0
+    if n >= 32:
+        v = [(seed + _P1 + _P2) & _M, (seed + _P2) & _M, seed, (seed - _P1) & _M]
+        while n - p >= 32:
+            lanes = struct.unpack_from("<4Q", data, p)
+            v = [_accumulate(a, l) for a, l in zip(v, lanes)]
+            p += 32
+        h = (_rotl(v[0], 1) + _rotl(v[1], 7) + _rotl(v[2], 12) + _rotl(v[3], 18)) & _M
+        for a in v:
+            h = _merge(h, a)
+    else:
+        h = (seed + _P5) & _M
+    h = (h + n) & _M
+
+    while n - p >= 8:
+        (lane,) = struct.unpack_from("<Q", data, p)
+        h ^= _accumulate(0, lane)
+        h = (_rotl(h, 27) * _P1 + _P4) & _M
+        p += 8
+    if n - p >= 4:
+        (lane,) = struct.unpack_from("<I", data, p)
+        h ^= (lane * _P1) & _M
+        h = (_rotl(h, 23) * _P2 + _P3) & _M
+        p += 4
+    while p < n:
+        h ^= (data[p] * _P5) & _M
+        h = (_rotl(h, 11) * _P1) & _M
+        p += 1
+
+    h ^= h >> 33
+    h = (h * _P2) & _M
+    h ^= h >> 29
+    h = (h * _P3) & _M
+    h ^= h >> 32
+    return h
+
+
+class ShardRing:
+    def __init__(self, shards, vnodes=DEFAULT_VNODES):
+        self.shards = list(shards)
+        points = sorted((xxh64(f"{addr}#{i}"), s) for s, addr in enumerate(self.shards) for i in range(vnodes))
+        self._hashes = [h for h, _ in points]
+        self._owners = [s for _, s in points]
+
+    def owner(self, key):
+        if len(self.shards) <= 1:
+            return 0
+        i = bisect.bisect_left(self._hashes, xxh64(key))
+        return self._owners[i % len(self._owners)]
+
+    def owner_address(self, key):
+        return self.shards[self.owner(key)]